@@ -109,6 +109,7 @@ pchheader "std_include.hpp"
 pchsource "src/std_include.cpp"
 
 files {"./src/**.rc", "./src/**.hpp", "./src/**.cpp"}
+removefiles {"./src/replay/**"}
 
 includedirs {"./src", "%{prj.location}/src"}
 
@@ -129,6 +130,20 @@ filter {}
 
 dependencies.imports()
 
+project "anon-replay"
+kind "ConsoleApp"
+language "C++"
+
+pchheader "std_include.hpp"
+pchsource "src/std_include.cpp"
+
+files {"./src/**.hpp", "./src/**.cpp"}
+removefiles {"./src/main.cpp"}
+
+includedirs {"./src", "%{prj.location}/src"}
+
+dependencies.imports()
+
 
 group "Dependencies"
 dependencies.projects()
@@ -0,0 +1,145 @@
+#include "std_include.hpp"
+#include "capture.hpp"
+
+namespace capture
+{
+	namespace
+	{
+		constexpr char magic[] = "ANONCAP";
+		constexpr uint8_t version = 1;
+
+		template <typename T>
+		void append(utils::io::file_writer& file, const T& value)
+		{
+			file.write(&value, sizeof(value));
+		}
+
+		template <typename T>
+		bool read_value(utils::io::file_reader& file, T& value)
+		{
+			return file.read(&value, sizeof(value));
+		}
+	}
+
+	writer::writer(const std::string& file)
+		: file_(file)
+	{
+		this->file_.write(magic, sizeof(magic));
+		append(this->file_, version);
+	}
+
+	writer::~writer()
+	{
+		this->flush();
+	}
+
+	void writer::write(const std::chrono::system_clock::time_point timestamp, const network::address& address,
+	                   const std::string_view data)
+	{
+		if (!address.is_supported() || data.size() > UINT16_MAX)
+		{
+			return;
+		}
+
+		const auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp.time_since_epoch()).count();
+		append(this->file_, static_cast<int64_t>(time));
+
+		const auto port = static_cast<uint16_t>(address.get_port());
+
+		if (address.is_ipv4())
+		{
+			append(this->file_, static_cast<uint8_t>(4));
+			append(this->file_, port);
+			append(this->file_, address.get_in_addr().sin_addr);
+		}
+		else
+		{
+			append(this->file_, static_cast<uint8_t>(6));
+			append(this->file_, port);
+			append(this->file_, address.get_in6_addr().sin6_addr);
+		}
+
+		append(this->file_, static_cast<uint16_t>(data.size()));
+		this->file_.write(data);
+		++this->count_;
+	}
+
+	void writer::flush()
+	{
+		this->file_.flush();
+	}
+
+	uint64_t writer::get_count() const
+	{
+		return this->count_;
+	}
+
+	reader::reader(const std::string& file)
+		: file_(file)
+	{
+		char header[sizeof(magic)]{};
+		uint8_t file_version{};
+
+		if (!this->file_.read(header, sizeof(header)) || memcmp(header, magic, sizeof(magic)) != 0
+			|| !read_value(this->file_, file_version))
+		{
+			throw std::runtime_error("Invalid capture file: " + file);
+		}
+
+		if (file_version != version)
+		{
+			throw std::runtime_error("Unsupported capture version: " + std::to_string(file_version));
+		}
+	}
+
+	bool reader::read(record& record)
+	{
+		int64_t time{};
+		uint8_t family{};
+		uint16_t port{};
+		uint16_t size{};
+
+		if (!read_value(this->file_, time) || !read_value(this->file_, family) || !read_value(
+			this->file_, port))
+		{
+			return false;
+		}
+
+		if (family == 4)
+		{
+			in_addr address{};
+			if (!read_value(this->file_, address))
+			{
+				return false;
+			}
+
+			record.address.set_ipv4(address);
+		}
+		else if (family == 6)
+		{
+			in6_addr address{};
+			if (!read_value(this->file_, address))
+			{
+				return false;
+			}
+
+			record.address.set_ipv6(address);
+		}
+		else
+		{
+			throw std::runtime_error("Capture file is corrupted");
+		}
+
+		if (!read_value(this->file_, size))
+		{
+			return false;
+		}
+
+		record.address.set_port(port);
+		record.timestamp = std::chrono::system_clock::time_point(
+			std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(time)));
+		record.data.resize(size);
+
+		return size == 0 || this->file_.read(record.data.data(), size);
+	}
+}
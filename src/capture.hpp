@@ -0,0 +1,48 @@
+#pragma once
+
+#include "network/address.hpp"
+#include "utils/io.hpp"
+
+// Binary capture of inbound datagrams
+// File: "ANONCAP" magic, uint8 version, followed by records of
+// int64 receive time (ns since epoch), uint8 family, uint16 port, 4 or 16 address bytes, uint16 size, payload
+namespace capture
+{
+	struct record
+	{
+		std::chrono::system_clock::time_point timestamp{};
+		network::address address{};
+		std::string data{};
+	};
+
+	class writer
+	{
+	public:
+		writer(const std::string& file);
+		~writer();
+
+		writer(const writer&) = delete;
+		writer& operator=(const writer&) = delete;
+
+		void write(std::chrono::system_clock::time_point timestamp, const network::address& address,
+		           std::string_view data);
+		void flush();
+
+		uint64_t get_count() const;
+
+	private:
+		utils::io::file_writer file_;
+		uint64_t count_{};
+	};
+
+	class reader
+	{
+	public:
+		reader(const std::string& file);
+
+		bool read(record& record);
+
+	private:
+		utils::io::file_reader file_;
+	};
+}
@@ -0,0 +1,134 @@
+#include "std_include.hpp"
+#include "checkpointer.hpp"
+
+#include "console.hpp"
+#include "utils/io.hpp"
+
+checkpointer::checkpointer()
+{
+	this->thread_ = std::thread([this]()
+	{
+		this->run();
+	});
+}
+
+checkpointer::~checkpointer()
+{
+	this->state_.access([](state& state)
+	{
+		state.stop = true;
+	});
+
+	this->work_.notify_all();
+
+	if (this->thread_.joinable())
+	{
+		this->thread_.join();
+	}
+}
+
+void checkpointer::submit(const std::string& file, serializer serializer)
+{
+	this->state_.access([&](state& state)
+	{
+		state.pending[file] = std::move(serializer);
+	});
+
+	this->work_.notify_one();
+}
+
+void checkpointer::flush()
+{
+	this->state_.access_with_lock([this](state& state, std::unique_lock<std::mutex>& lock)
+	{
+		this->idle_.wait(lock, [&state]()
+		{
+			return state.pending.empty() && !state.writing;
+		});
+	});
+}
+
+checkpointer::statistics checkpointer::get_statistics() const
+{
+	return this->state_.access<statistics>([](const state& state)
+	{
+		return state.totals;
+	});
+}
+
+void checkpointer::run()
+{
+	while (true)
+	{
+		std::map<std::string, serializer> jobs{};
+
+		const auto stop = this->state_.access_with_lock<bool>(
+			[this, &jobs](state& state, std::unique_lock<std::mutex>& lock)
+			{
+				this->work_.wait(lock, [&state]()
+				{
+					return state.stop || !state.pending.empty();
+				});
+
+				jobs = std::move(state.pending);
+				state.pending = {};
+				state.writing = !jobs.empty();
+
+				return state.stop && jobs.empty();
+			});
+
+		if (stop)
+		{
+			return;
+		}
+
+		for (auto& job : jobs)
+		{
+			const auto start = std::chrono::steady_clock::now();
+
+			bool written = false;
+			size_t size = 0;
+
+			try
+			{
+				const auto data = job.second();
+				size = data.size();
+				written = utils::io::write_file_atomic(job.first, data.data(), data.size());
+			}
+			catch (std::exception& e)
+			{
+				console::error("Failed to serialize %s: %s", job.first.data(), e.what());
+			}
+
+			if (!written)
+			{
+				console::warn("Failed to write checkpoint %s", job.first.data());
+			}
+
+			const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - start);
+
+			this->state_.access([&](state& state)
+			{
+				if (written)
+				{
+					++state.totals.written;
+					state.totals.bytes += size;
+				}
+				else
+				{
+					++state.totals.failed;
+				}
+
+				state.totals.last_duration = duration;
+			});
+		}
+
+		this->state_.access([](state& state)
+		{
+			state.writing = false;
+		});
+
+		this->idle_.notify_all();
+	}
+}
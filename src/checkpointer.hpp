@@ -0,0 +1,52 @@
+#pragma once
+
+#include "utils/concurrency.hpp"
+
+// Serializes and writes files on a background thread, so the network thread never waits for the disk.
+// Files are replaced atomically. A job submitted for a file that is still waiting replaces the older job.
+class checkpointer
+{
+public:
+	using serializer = std::function<std::string()>;
+
+	struct statistics
+	{
+		uint64_t written{};
+		uint64_t failed{};
+		uint64_t bytes{};
+		std::chrono::microseconds last_duration{};
+	};
+
+	checkpointer();
+	// Writes everything that is still pending
+	~checkpointer();
+
+	checkpointer(const checkpointer&) = delete;
+	checkpointer& operator=(const checkpointer&) = delete;
+
+	checkpointer(checkpointer&&) = delete;
+	checkpointer& operator=(checkpointer&&) = delete;
+
+	void submit(const std::string& file, serializer serializer);
+
+	// Blocks until every job submitted so far is written
+	void flush();
+
+	statistics get_statistics() const;
+
+private:
+	struct state
+	{
+		std::map<std::string, serializer> pending{};
+		bool writing{false};
+		bool stop{false};
+		statistics totals{};
+	};
+
+	utils::concurrency::container<state> state_{};
+	std::condition_variable work_{};
+	std::condition_variable idle_{};
+	std::thread thread_{};
+
+	void run();
+};
@@ -2,6 +2,8 @@
 #include "dht.hpp"
 #include "console.hpp"
 #include "utils/io.hpp"
+#include "utils/bencode.hpp"
+#include "utils/sha256.hpp"
 
 #include <atomic>
 #include <string_view>
@@ -54,178 +56,279 @@ namespace
 		return get_fd_mapping().at(fd);
 	}
 
-	struct dht_store
+	constexpr auto search_interval = 1min;
+	constexpr auto max_search_jitter = std::chrono::milliseconds{6s};
+	// Caps how many searches go out per frame, the rest waits for the next one
+	constexpr size_t max_searches_per_frame = 64;
+	constexpr auto search_backlog_delay = 10ms;
+	constexpr auto batch_follower_delay = 2s;
+
+	// Changes are batched for this long, a crash loses at most this window
+	constexpr auto journal_commit_interval = 1s;
+	constexpr auto journal_refresh_interval = 10min;
+	// Past this the journal is folded into a fresh snapshot
+	constexpr size_t max_journal_size = 1 << 20;
+
+	constexpr size_t max_pending_queries = 0x10000;
+	constexpr size_t max_rtt_estimates = 0x10000;
+	constexpr size_t max_node_health = 0x10000;
+	constexpr auto node_health_lifetime = 24h;
+	// Like BEP 5, a node that misses several queries in a row is bad and leaves the routing table
+	constexpr uint32_t max_unanswered_queries = 3;
+
+	// Persisted nodes are pinged best first, a wave at a time
+	constexpr size_t warm_start_wave_size = 32;
+	constexpr auto warm_start_wave_interval = 50ms;
+	constexpr size_t max_warm_start_pings = 512;
+	// A full bucket of good nodes, the point where lookups get useful answers
+	constexpr int good_bucket_size = 8;
+
+	// BEP 5 accepts tokens up to ten minutes old, that is the current and the previous secret
+	constexpr auto token_rotation_interval = 5min;
+	// Like the rate limit of the library, spoofed queries can't turn the node into an amplifier
+	constexpr double max_answers_per_second = 400;
+	constexpr size_t answer_node_count = 8;
+	// Keeps get_peers answers within a single unfragmented datagram
+	constexpr size_t max_answer_peers_v4 = 50;
+	constexpr size_t max_answer_peers_v6 = 30;
+
+	void append_string(std::string& message, const std::string_view value)
 	{
-		dht::id id{};
-		std::vector<dht::node> nodes{};
-	};
+		message.append(std::to_string(value.size()));
+		message.push_back(':');
+		message.append(value);
+	}
 
-	std::string serialize_dht_store(const dht_store& store)
+	std::string_view to_view(const dht::id& value)
 	{
-		std::string data{};
-		data.append(reinterpret_cast<const char*>(store.id.data()), store.id.size());
+		return {reinterpret_cast<const char*>(value.data()), value.size()};
+	}
 
-		std::vector<dht::node> ipv4_nodes{};
-		std::vector<dht::node> ipv6_nodes{};
+	double get_warm_start_score(const dht::node_health& health, const dht::latency_clock::time_point now)
+	{
+		const auto reliability = (health.responses + 1.0) / (health.responses + health.failures + 2.0);
 
-		for (const auto& node : store.nodes)
+		if (!health.last_seen.time_since_epoch().count() || health.last_seen > now)
 		{
-			if (node.address.is_ipv4())
-			{
-				ipv4_nodes.emplace_back(node);
-			}
-			else if (node.address.is_ipv6())
-			{
-				ipv6_nodes.emplace_back(node);
-			}
+			return reliability / 1000.0;
 		}
 
-		const auto ipv4_node_count = static_cast<uint32_t>(ipv4_nodes.size());
-		const auto ipv6_node_count = static_cast<uint32_t>(ipv6_nodes.size());
+		const auto age = std::chrono::duration<double, std::ratio<3600>>(now - health.last_seen).count();
+		return reliability / (1.0 + age);
+	}
+
+	uint64_t to_microseconds(const std::chrono::system_clock::duration duration)
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+	}
 
-		data.append(reinterpret_cast<const char*>(&ipv4_node_count), sizeof(ipv4_node_count));
-		data.append(reinterpret_cast<const char*>(&ipv6_node_count), sizeof(ipv6_node_count));
+	void save_dht_store(const std::string& file, const node_store::snapshot& store)
+	{
+		const auto data = node_store::serialize(store);
+		utils::io::write_file_atomic(file, data.data(), data.size());
+	}
 
-		for (const auto& node : ipv4_nodes)
-		{
-			data.append(reinterpret_cast<const char*>(node.id_.data()), node.id_.size());
+	struct bootstrap_router
+	{
+		const char* hostname;
+		uint16_t port;
+	};
 
-			const auto& in_addr = node.address.get_in_addr();
-			const auto addr_size = sizeof(in_addr.sin_addr);
-			static_assert(addr_size == 4);
-			data.append(reinterpret_cast<const char*>(&in_addr.sin_addr), addr_size);
+	constexpr bootstrap_router bootstrap_routers[] = {
+		{"router.bittorrent.com", 6881},
+		{"router.utorrent.com", 6881},
+		{"dht.transmissionbt.com", 6881},
+		{"dht.aelitis.com", 6881},
+	};
 
-			const auto port = node.address.get_port();
-			const auto port_size = sizeof(port);
-			static_assert(port_size == 2);
+	constexpr auto bootstrap_timeout = 5s;
+	// Keeps the frame short while resolutions are outstanding
+	constexpr auto bootstrap_poll_interval = 100ms;
 
-			data.append(reinterpret_cast<const char*>(&port), port_size);
-		}
+	std::string serialize_bootstrap_cache(const std::map<std::string, std::vector<network::address>>& cache)
+	{
+		std::string data{};
 
-		for (const auto& node : ipv6_nodes)
+		const auto append = [&data](const void* value, const size_t size)
 		{
-			data.append(reinterpret_cast<const char*>(node.id_.data()), node.id_.size());
+			data.append(static_cast<const char*>(value), size);
+		};
 
-			const auto& in6_addr = node.address.get_in6_addr();
-			const auto addr6_size = sizeof(in6_addr.sin6_addr);
-			static_assert(addr6_size == 16);
-			data.append(reinterpret_cast<const char*>(&in6_addr.sin6_addr), addr6_size);
+		const auto host_count = static_cast<uint32_t>(cache.size());
+		append(&host_count, sizeof(host_count));
 
-			const auto port = node.address.get_port();
-			const auto port_size = sizeof(port);
-			static_assert(port_size == 2);
+		for (const auto& entry : cache)
+		{
+			const auto name_length = static_cast<uint16_t>(entry.first.size());
+			append(&name_length, sizeof(name_length));
+			append(entry.first.data(), name_length);
+
+			const auto address_count = static_cast<uint32_t>(entry.second.size());
+			append(&address_count, sizeof(address_count));
 
-			data.append(reinterpret_cast<const char*>(&port), port_size);
+			for (const auto& address : entry.second)
+			{
+				const uint8_t family = address.is_ipv4() ? 4 : 6;
+				append(&family, sizeof(family));
+
+				if (address.is_ipv4())
+				{
+					append(&address.get_in_addr().sin_addr, 4);
+				}
+				else
+				{
+					append(&address.get_in6_addr().sin6_addr, 16);
+				}
+
+				const auto port = address.get_port();
+				append(&port, sizeof(port));
+			}
 		}
 
 		return data;
 	}
 
-	void save_dht_store(const dht_store& store)
-	{
-		const auto data = serialize_dht_store(store);
-		utils::io::write_file("./dht.store", data.data(), data.size(), false);
-	}
-
-	dht_store create_new_dht_store()
-	{
-		std::vector<uint8_t> random_data{};
-		random_data.resize(0x100);
-		dht_random_bytes(random_data.data(), random_data.size());
-
-		dht_store store{};
-		dht_hash(store.id.data(), static_cast<int>(store.id.size()), random_data.data(),
-		         static_cast<int>(random_data.size()), "",
-		         0, "", 0);
-
-		save_dht_store(store);
-		return store;
-	}
-
-	dht_store deserialize_dht_store(const std::string& data)
+	std::map<std::string, std::vector<network::address>> deserialize_bootstrap_cache(const std::string& data)
 	{
-		dht_store store{};
-		uint32_t ipv4_node_count{};
-		uint32_t ipv6_node_count{};
+		std::map<std::string, std::vector<network::address>> cache{};
 
 		size_t offset = 0;
 		const auto read_data = [&data, &offset](void* destination, const size_t size)
 		{
 			if ((offset + size) > data.size())
 			{
-				throw std::runtime_error{"Serialized dht store is corrupted"};
+				throw std::runtime_error{"Serialized bootstrap cache is corrupted"};
 			}
 
 			memcpy(destination, data.data() + offset, size);
 			offset += size;
 		};
 
-		read_data(store.id.data(), store.id.size());
-		read_data(&ipv4_node_count, sizeof(ipv4_node_count));
-		read_data(&ipv6_node_count, sizeof(ipv6_node_count));
-
-		store.nodes.reserve(static_cast<size_t>(ipv4_node_count) + static_cast<size_t>(ipv6_node_count));
+		uint32_t host_count{};
+		read_data(&host_count, sizeof(host_count));
 
-		for (uint32_t i = 0; i < ipv4_node_count; ++i)
+		for (uint32_t i = 0; i < host_count; ++i)
 		{
-			dht::node node{};
+			uint16_t name_length{};
+			read_data(&name_length, sizeof(name_length));
 
-			read_data(node.id_.data(), node.id_.size());
+			std::string hostname(name_length, '\0');
+			read_data(hostname.data(), name_length);
 
-			in_addr address{};
-			static_assert(sizeof(address) == 4);
-			read_data(&address, sizeof(address));
+			uint32_t address_count{};
+			read_data(&address_count, sizeof(address_count));
 
-			uint16_t port{};
-			static_assert(sizeof(port) == 2);
+			auto& addresses = cache[hostname];
 
-			read_data(&port, sizeof(port));
-
-			node.address.set_ipv4(address);
-			node.address.set_port(port);
-
-			store.nodes.emplace_back(std::move(node));
+			for (uint32_t j = 0; j < address_count; ++j)
+			{
+				uint8_t family{};
+				read_data(&family, sizeof(family));
+
+				network::address address{};
+
+				if (family == 4)
+				{
+					in_addr ip{};
+					read_data(&ip, 4);
+					address.set_ipv4(ip);
+				}
+				else if (family == 6)
+				{
+					in6_addr ip{};
+					read_data(&ip, 16);
+					address.set_ipv6(ip);
+				}
+				else
+				{
+					throw std::runtime_error{"Serialized bootstrap cache is corrupted"};
+				}
+
+				uint16_t port{};
+				read_data(&port, sizeof(port));
+				address.set_port(port);
+
+				addresses.emplace_back(std::move(address));
+			}
 		}
 
-		for (uint32_t i = 0; i < ipv4_node_count; ++i)
-		{
-			dht::node node{};
-
-			read_data(node.id_.data(), node.id_.size());
-
-			in6_addr address{};
-			static_assert(sizeof(address) == 16);
-			read_data(&address, sizeof(address));
-
-			uint16_t port{};
-			static_assert(sizeof(port) == 2);
-
-			read_data(&port, sizeof(port));
+		return cache;
+	}
 
-			node.address.set_ipv6(address);
-			node.address.set_port(port);
+	node_store::snapshot create_new_dht_store(const std::string& file)
+	{
+		std::vector<uint8_t> random_data{};
+		random_data.resize(0x100);
+		dht_random_bytes(random_data.data(), random_data.size());
 
-			store.nodes.emplace_back(std::move(node));
-		}
+		node_store::snapshot store{};
+		dht_hash(store.id.data(), static_cast<int>(store.id.size()), random_data.data(),
+		         static_cast<int>(random_data.size()), "",
+		         0, "", 0);
 
+		save_dht_store(file, store);
 		return store;
 	}
 
-	dht_store get_dht_store()
+	// Returns the snapshot with the journal applied, journal_size is the intact part of the journal
+	node_store::snapshot get_dht_store(const std::string& file, size_t& journal_size)
 	{
+		journal_size = 0;
+
 		try
 		{
-			std::string data{};
-			if (utils::io::read_file("./dht.store", &data))
+			if (utils::io::file_exists(file))
 			{
-				return deserialize_dht_store(data);
+				// Records are decoded straight from the mapping, the file is never copied as a whole
+				std::string legacy{};
+				auto store = [&]()
+				{
+					const utils::io::file_view data{file, utils::io::access_pattern::sequential};
+					if (node_store::is_legacy(data.get_data()))
+					{
+						legacy.assign(data.get_data());
+					}
+
+					return node_store::deserialize(data.get_data());
+				}();
+
+				if (!legacy.empty())
+				{
+					// The legacy file is kept next to the converted one
+					utils::io::write_file(file + ".legacy", legacy);
+					save_dht_store(file, store);
+					console::log("Converted legacy store %s with %zu nodes", file.data(), store.nodes.size());
+					return store;
+				}
+
+				const auto journal_file = node_journal::get_file(file);
+				if (utils::io::file_exists(journal_file))
+				{
+					const utils::io::file_view journal{journal_file, utils::io::access_pattern::sequential};
+					const auto result = node_store::replay_journal(store, journal.get_data());
+					journal_size = result.valid_size;
+
+					if (result.applied)
+					{
+						console::log("Replayed %zu journal records, %zu nodes", result.applied, store.nodes.size());
+					}
+
+					if (result.valid_size && result.valid_size != journal.size())
+					{
+						console::warn("Journal of %s ends in a torn record, dropped %zu bytes", file.data(),
+						              journal.size() - result.valid_size);
+					}
+				}
+
+				return store;
 			}
 		}
-		catch (...)
+		catch (std::exception& e)
 		{
+			console::warn("Failed to load %s: %s", file.data(), e.what());
 		}
 
-		return create_new_dht_store();
+		return create_new_dht_store(file);
 	}
 }
 
@@ -246,25 +349,21 @@ int dht_random_bytes(void* buf, const size_t size)
 void dht_hash(void* hash_return, const int hash_size, const void* v1, const int len1, const void* v2, const int len2,
               const void* v3, const int len3)
 {
-	ZeroMemory(hash_return, hash_size);
-
-	SHA256 hash{};
-	hash.update(reinterpret_cast<const uint8_t*>(&hash_size), sizeof(hash_size));
-	hash.update(reinterpret_cast<const uint8_t*>(&len1), sizeof(len1));
-	hash.update(static_cast<const uint8_t*>(v1), len1);
-	hash.update(reinterpret_cast<const uint8_t*>(&len2), sizeof(len2));
-	hash.update(static_cast<const uint8_t*>(v2), len2);
-	hash.update(reinterpret_cast<const uint8_t*>(&len3), sizeof(len3));
-	hash.update(static_cast<const uint8_t*>(v3), len3);
+	utils::sha256::hasher hash{};
+	hash.update(&hash_size, sizeof(hash_size));
+	hash.update(&len1, sizeof(len1));
+	hash.update(v1, len1);
+	hash.update(&len2, sizeof(len2));
+	hash.update(v2, len2);
+	hash.update(&len3, sizeof(len3));
+	hash.update(v3, len3);
+
+	// One digest per call, longer outputs repeat it
+	const auto digest = hash.finish();
 
 	for (int i = 0; i < hash_size; ++i)
 	{
-		if (hash_size % 32 == 0)
-		{
-			hash.update(static_cast<const uint8_t*>(hash_return), hash_size);
-		}
-
-		static_cast<uint8_t*>(hash_return)[i] = hash.digest()[i % 32];
+		static_cast<uint8_t*>(hash_return)[i] = digest[i % digest.size()];
 	}
 }
 
@@ -302,17 +401,29 @@ extern "C" int dht_gettimeofday(struct timeval* tp, struct timezone* /*tzp*/)
 }
 #endif
 
-dht::dht(data_transmitter transmitter)
-	: transmitter_(std::move(transmitter))
+dht::dht(data_transmitter transmitter, std::string store_file, const bool bootstrap)
+	: store_file_(std::move(store_file))
+	  , transmitter_(std::move(transmitter))
 {
+	// The dht library keeps its routing table in globals,
+	// additional identities have to run in their own process
 	bool expected = false;
 	if (!get_dht_barrier().compare_exchange_strong(expected, true))
 	{
-		throw std::runtime_error("Only one DHT instance supported at a time");
+		throw std::runtime_error("Only one DHT instance supported per process");
 	}
 
-	const auto store = get_dht_store();
+	size_t journal_size{};
+	const auto store = get_dht_store(this->store_file_, journal_size);
 	this->id_ = store.id;
+	this->journal_ = std::make_unique<node_journal>(this->store_file_, this->id_, store.generation, journal_size);
+	this->journal_size_ = journal_size;
+	this->routes_v4_ = routing_table{this->id_};
+	this->routes_v6_ = routing_table{this->id_};
+	// Random from the start, a zeroed previous secret would accept tokens anyone can compute
+	dht_random_bytes(this->token_secret_.data(), this->token_secret_.size());
+	this->rotate_token_secret(search_clock::now());
+	this->segments_ = std::make_unique<peer_segments>(this->store_file_ + ".segments", peer_segments::config{});
 
 	const auto fd_v4 = store_fd_mapping(protocol::v4, *this);
 	const auto fd_v6 = store_fd_mapping(protocol::v6, *this);
@@ -324,14 +435,11 @@ dht::dht(data_transmitter transmitter)
 	dht_init(fd_v4, fd_v6, this->id_.data(),
 	         reinterpret_cast<const unsigned char*>("JC\0\0"));
 
-	this->try_ping("router.bittorrent.com", 6881);
-	this->try_ping("router.utorrent.com", 6881);
-	this->try_ping("dht.transmissionbt.com", 6881);
-	this->try_ping("dht.aelitis.com", 6881);
+	this->start_warm_start(store.nodes, bootstrap);
 
-	for (const auto& node : store.nodes)
+	if (bootstrap)
 	{
-		this->insert_node(node);
+		this->start_bootstrap();
 	}
 }
 
@@ -351,232 +459,1403 @@ dht::~dht()
 	get_dht_barrier().store(false);
 }
 
-void dht::on_data(protocol /*protocol*/, const network::address& address, const std::string& data)
+void dht::on_data(const protocol protocol, const network::address& address, const std::string_view data,
+                  latency_clock::time_point received)
 {
+	const auto now = latency_clock::now();
+	if (!received.time_since_epoch().count())
+	{
+		received = now;
+	}
+	else if (now >= received)
+	{
+		this->latency_statistics_.queueing.add(to_microseconds(now - received));
+	}
+
+	const auto type = utils::bencode::find_string(data, "y");
+
+	// Unsolicited responses would let anyone place nodes into the persisted routing table
+	if (this->track_response(address, data, type, received))
+	{
+		this->learn_node(address, data, type);
+	}
+
+	if (type == "q" && this->answer_query(protocol, address, data))
+	{
+		return;
+	}
+
+	if ((type == "r" || type == "e") && this->lookups_ && this->lookups_->on_response(address, data))
+	{
+		return;
+	}
+
 	time_t tosleep = 0;
 	dht_periodic(data.data(), data.size(), &address.get_addr(), address.get_size(), &tosleep,
 	             &dht::callback_static, this);
+
+	this->check_good_bucket();
 }
 
 int dht::on_send(const protocol protocol, const void* buf, const int len, const int /*flags*/,
                  const struct sockaddr* to, const int tolen)
 {
-	const network::address target{to, tolen};
-	const std::string string{reinterpret_cast<const char*>(buf), static_cast<size_t>(len)};
-	this->transmitter_(protocol, target, string);
+	const network::endpoint target{to, tolen};
+	const std::string_view data{static_cast<const char*>(buf), static_cast<size_t>(len)};
+	this->track_query(target, data);
+	this->transmitter_(protocol, target, data);
 	return len;
 }
 
-void dht::insert_node(const node& node)
+const dht::latency_statistics& dht::get_latency_statistics() const
 {
-	auto address = node.address;
-	dht_insert_node(node.id_.data(), &address.get_addr(), address.get_size());
+	return this->latency_statistics_;
 }
 
-bool dht::try_ping(const std::string& hostname, const uint16_t port)
+std::optional<dht::rtt_estimate> dht::get_rtt(const network::address& address) const
 {
-	bool pinged = false;
-	auto addresses = network::address::resolve_multiple(hostname);
-
-	for (auto& address : addresses)
+	const auto entry = this->rtt_estimates_.find(address);
+	if (entry == this->rtt_estimates_.end())
 	{
-		if (address.is_supported())
-		{
-			address.set_port(port);
-			this->ping(address);
-			pinged = true;
-		}
+		return {};
 	}
 
-	return pinged;
+	return entry->second;
 }
 
-void dht::ping(const network::address& address)
+bool dht::query_key::operator==(const query_key& obj) const
 {
-	dht_ping_node(&address.get_addr(), address.get_size());
+	return this->transaction == obj.transaction && this->transaction_size == obj.transaction_size
+		&& this->family == obj.family && this->port == obj.port && this->address == obj.address;
 }
 
-void dht::search(const std::string& keyword, results results, const uint16_t port)
+size_t dht::query_key_hash::operator()(const query_key& key) const
 {
-	id hash{};
-	dht_hash(hash.data(), static_cast<int>(hash.size()), keyword.data(), static_cast<int>(keyword.size()), "", 0, "",
-	         0);
-	this->search(hash, std::move(results), port);
-}
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const auto add = [&hash](const uint8_t* data, const size_t size)
+	{
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash = (hash ^ data[i]) * 0x100000001b3ULL;
+		}
+	};
 
-void dht::search(const id& hash, results results, const uint16_t port)
-{
-	search_entry entry{};
-	entry.callback = std::move(results);
-	entry.port = port;
+	add(key.transaction.data(), key.transaction_size);
+	add(&key.family, sizeof(key.family));
+	add(reinterpret_cast<const uint8_t*>(&key.port), sizeof(key.port));
+	add(key.address.data(), key.address.size());
 
-	this->searches_[hash] = std::move(entry);
+	return static_cast<size_t>(hash);
 }
 
-std::chrono::milliseconds dht::run_frame()
+std::optional<dht::query_key> dht::get_query_key(const std::string_view transaction, const sockaddr& address)
 {
-	const auto now = std::chrono::system_clock::now();
+	query_key key{};
+	if (transaction.size() > key.transaction.size())
+	{
+		return {};
+	}
+
+	memcpy(key.transaction.data(), transaction.data(), transaction.size());
+	key.transaction_size = static_cast<uint8_t>(transaction.size());
 
-	for (auto& entry : this->searches_)
+	if (address.sa_family == AF_INET)
 	{
-		if ((now - entry.second.last_query) > 1min)
-		{
-			entry.second.last_query = now;
-			dht_search(entry.first.data(), entry.second.port, AF_INET, &dht::callback_static, this);
-			dht_search(entry.first.data(), entry.second.port, AF_INET6, &dht::callback_static, this);
-		}
+		const auto& in = reinterpret_cast<const sockaddr_in&>(address);
+		key.family = 4;
+		key.port = in.sin_port;
+		memcpy(key.address.data(), &in.sin_addr, sizeof(in.sin_addr));
+	}
+	else if (address.sa_family == AF_INET6)
+	{
+		const auto& in6 = reinterpret_cast<const sockaddr_in6&>(address);
+		key.family = 6;
+		key.port = in6.sin6_port;
+		memcpy(key.address.data(), &in6.sin6_addr, sizeof(in6.sin6_addr));
+	}
+	else
+	{
+		return {};
 	}
 
-	time_t tosleep = 0;
-	dht_periodic(nullptr, 0, nullptr, 0, &tosleep, &dht::callback_static, this);
-	return std::min(std::chrono::seconds{tosleep}, 3s);
+	return key;
 }
 
-std::chrono::high_resolution_clock::time_point dht::run_frame_time_point()
+void dht::track_query(const network::endpoint& destination, const std::string_view data)
 {
-	return this->run_frame() + std::chrono::high_resolution_clock::now();
+	if (utils::bencode::find_string(data, "y") != "q" || this->pending_queries_.size() >= max_pending_queries)
+	{
+		return;
+	}
+
+	const auto transaction = utils::bencode::find_string(data, "t");
+	const auto key = transaction ? get_query_key(*transaction, destination.get_addr()) : std::nullopt;
+	if (key)
+	{
+		auto& query = this->pending_queries_[*key];
+		query.sent = latency_clock::now();
+		query.destination.set_address(&destination.get_addr(), destination.get_size());
+	}
 }
 
-void dht::handle_result_v4(const id& id, const std::string_view& data)
+bool dht::track_response(const network::address& source, const std::string_view data,
+                         const std::optional<std::string_view> type, const latency_clock::time_point received)
 {
-	std::vector<network::address> addresses{};
-	addresses.reserve((data.size() / 6) + 1);
+	if (type != "r" && type != "e")
+	{
+		return false;
+	}
 
-	size_t offset = 0;
-	while ((data.size() - offset) >= 6)
+	const auto transaction = utils::bencode::find_string(data, "t");
+	const auto key = transaction ? get_query_key(*transaction, source.get_addr()) : std::nullopt;
+	if (!key)
 	{
-		in_addr ip{};
-		uint16_t port;
-		memcpy(&ip.s_addr, data.data() + offset, 4);
-		memcpy(&port, data.data() + offset + 4, 2);
-		offset += 6;
+		return false;
+	}
 
-		network::address address{};
-		address.set_ipv4(ip);
-		address.set_port(ntohs(port));
+	const auto query = this->pending_queries_.find(*key);
+	if (query == this->pending_queries_.end())
+	{
+		return false;
+	}
 
-		addresses.emplace_back(address);
+	const auto sent = query->second.sent;
+	this->pending_queries_.erase(query);
+	this->record_response(source, received);
+
+	if (received < sent)
+	{
+		return true;
 	}
 
-	console::info("Received %zu IPv4 addresses", addresses.size());
+	const auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(received - sent);
+	this->latency_statistics_.round_trip.add(static_cast<uint64_t>(rtt.count()));
 
-	const auto entry = this->searches_.find(id);
-	if (entry != this->searches_.end())
+	auto estimate = this->rtt_estimates_.find(source);
+	if (estimate == this->rtt_estimates_.end())
+	{
+		if (this->rtt_estimates_.size() >= max_rtt_estimates)
+		{
+			return true;
+		}
+
+		estimate = this->rtt_estimates_.emplace(source, rtt_estimate{}).first;
+	}
+
+	auto& entry = estimate->second;
+	if (!entry.samples)
+	{
+		entry.smoothed = rtt;
+		entry.variance = rtt / 2;
+	}
+	else
 	{
-		entry->second.callback(addresses);
+		const auto delta = entry.smoothed > rtt ? entry.smoothed - rtt : rtt - entry.smoothed;
+		entry.variance = (entry.variance * 3 + delta) / 4;
+		entry.smoothed = (entry.smoothed * 7 + rtt) / 8;
 	}
+
+	++entry.samples;
+	entry.last_update = received;
+	return true;
 }
 
-void dht::handle_result_v6(const id& id, const std::string_view& data)
+void dht::learn_node(const network::address& source, const std::string_view data,
+                     const std::optional<std::string_view> type)
 {
-	std::vector<network::address> addresses{};
-	addresses.reserve((data.size() / 18) + 1);
+	// Only responses prove the node is reachable, queries may come from behind a NAT
+	if (type != "r")
+	{
+		return;
+	}
 
-	size_t offset = 0;
-	while ((data.size() - offset) >= 18)
+	const auto response = utils::bencode::find_value(data, "r");
+	const auto node_id = response ? utils::bencode::find_string(*response, "id") : std::nullopt;
+	if (!node_id || node_id->size() != id{}.size())
 	{
-		in6_addr ip{};
-		uint16_t port;
-		memcpy(&ip.s6_addr, data.data() + offset, 16);
-		memcpy(&port, data.data() + offset + 16, 2);
-		offset += 18;
+		return;
+	}
 
-		network::address address{};
-		address.set_ipv6(ip);
-		address.set_port(ntohs(port));
+	id value{};
+	memcpy(value.data(), node_id->data(), value.size());
+	this->add_route(value, source);
+}
 
-		addresses.emplace_back(address);
+bool dht::answer_query(const protocol protocol, const network::address& source, const std::string_view data)
+{
+	const auto query = utils::bencode::find_string(data, "q");
+	const auto announce = query == "announce_peer";
+	if (!announce && query != "get_peers")
+	{
+		return false;
 	}
 
-	console::info("Received %zu IPv6 addresses", addresses.size());
+	// Malformed queries are left to the library, which answers them with a protocol error
+	const auto transaction = utils::bencode::find_string(data, "t");
+	const auto arguments = utils::bencode::find_value(data, "a");
+	const auto info_hash = arguments ? utils::bencode::find_string(*arguments, "info_hash") : std::nullopt;
+	if (!transaction || !info_hash || info_hash->size() != id{}.size())
+	{
+		return false;
+	}
 
-	const auto entry = this->searches_.find(id);
-	if (entry != this->searches_.end())
+	const auto now = search_clock::now();
+	if (!this->take_answer_budget(now))
 	{
-		entry->second.callback(addresses);
+		return true;
 	}
-}
 
-void dht::callback_static(void* closure, const int event, const unsigned char* info_hash, const void* data,
-                          const size_t data_len)
-{
-	static_cast<dht*>(closure)->callback(event, info_hash, data, data_len);
-}
+	this->rotate_token_secret(now);
 
-void dht::callback(const int event, const unsigned char* info_hash, const void* data, const size_t data_len)
-{
-	console::log("Event: %d (%zu)", event, data_len);
+	id hash{};
+	memcpy(hash.data(), info_hash->data(), hash.size());
 
-	if (event == DHT_EVENT_VALUES)
+	auto& message = this->answer_buffer_;
+	message.clear();
+
+	const auto send_error = [&](const std::string_view text)
 	{
-		id hash{};
-		memcpy(hash.data(), info_hash, hash.size());
+		message.append("d1:eli203e");
+		append_string(message, text);
+		message.append("e1:t");
+		append_string(message, *transaction);
+		message.append("1:y1:ee");
 
-		const std::string_view data_view{static_cast<const char*>(data), data_len};
-		this->handle_result_v4(hash, data_view);
+		this->transmitter_(protocol, network::endpoint{source}, message);
+	};
+
+	if (announce)
+	{
+		const auto token = utils::bencode::find_string(*arguments, "token");
+		const auto current = get_token(source, this->token_secret_);
+		const auto previous = get_token(source, this->previous_token_secret_);
+
+		if (!token || (*token != std::string_view{current.data(), current.size()}
+			&& *token != std::string_view{previous.data(), previous.size()}))
+		{
+			send_error("Announce_peer with wrong token");
+			return true;
+		}
+
+		auto peer = source;
+		if (utils::bencode::find_integer(*arguments, "implied_port").value_or(0) == 0)
+		{
+			const auto port = utils::bencode::find_integer(*arguments, "port");
+			if (!port || *port <= 0 || *port > 0xFFFF)
+			{
+				send_error("Announce_peer with forbidden port number");
+				return true;
+			}
+
+			peer.set_port(static_cast<uint16_t>(*port));
+		}
+
+		this->peer_storage_->store(hash, peer, peer_storage::clock::now());
+
+		message.append("d1:rd2:id");
+		append_string(message, to_view(this->id_));
+		message.append("e1:t");
+		append_string(message, *transaction);
+		message.append("1:y1:re");
+
+		this->transmitter_(protocol, network::endpoint{source}, message);
+		return true;
 	}
-	else if (event == DHT_EVENT_VALUES6)
+
+	// BEP 32, without a want list only the nodes of the querying family are returned
+	auto want_v4 = protocol == protocol::v4;
+	auto want_v6 = protocol == protocol::v6;
+
+	this->answer_want_.clear();
+	if (utils::bencode::find_strings(*arguments, "want", this->answer_want_) && !this->answer_want_.empty())
 	{
-		id hash{};
-		memcpy(hash.data(), info_hash, hash.size());
+		const auto wants = [this](const std::string_view family)
+		{
+			return std::find(this->answer_want_.begin(), this->answer_want_.end(), family) != this->answer_want_.end();
+		};
 
-		const std::string_view data_view{static_cast<const char*>(data), data_len};
-		this->handle_result_v6(hash, data_view);
+		want_v4 = wants("n4");
+		want_v6 = wants("n6");
 	}
-}
 
-void dht::save_state() const
-{
-	dht_store store{};
-	store.id = this->id_;
+	message.append("d1:rd2:id");
+	append_string(message, to_view(this->id_));
+
+	if (want_v4)
+	{
+		this->append_nodes(this->routes_v4_, hash, "nodes", message);
+	}
+
+	if (want_v6)
+	{
+		this->append_nodes(this->routes_v6_, hash, "nodes6", message);
+	}
+
+	const auto token = get_token(source, this->token_secret_);
+	message.append("5:token");
+	append_string(message, std::string_view{token.data(), token.size()});
+
+	const auto family = source.is_ipv4() ? AF_INET : AF_INET6;
+	const auto record_size = family == AF_INET ? size_t{6} : size_t{18};
 
-	int num = 0;
-	int num6 = 0;
+	this->answer_peers_.clear();
+	const auto count = this->peer_storage_->encode(hash, family,
+	                                               family == AF_INET ? max_answer_peers_v4 : max_answer_peers_v6,
+	                                               this->answer_peers_);
 
-	int good_nodes{};
-	int dubious_nodes{};
-	int cached_nodes{};
-	int incoming_nodes{};
+	if (count)
+	{
+		message.append("6:valuesl");
 
-	dht_nodes(AF_INET, &good_nodes, &dubious_nodes, &cached_nodes, &incoming_nodes);
-	num = good_nodes + dubious_nodes + cached_nodes + incoming_nodes;
+		for (size_t i = 0; i < count; ++i)
+		{
+			append_string(message, std::string_view{this->answer_peers_}.substr(i * record_size, record_size));
+		}
 
-	dht_nodes(AF_INET6, &good_nodes, &dubious_nodes, &cached_nodes, &incoming_nodes);
-	num6 = good_nodes + dubious_nodes + cached_nodes + incoming_nodes;
+		message.push_back('e');
+	}
 
-	constexpr auto id_size = id{}.size();
+	message.append("e1:t");
+	append_string(message, *transaction);
+	message.append("1:y1:re");
 
-	std::vector<uint8_t> ids{};
-	std::vector<sockaddr_in> addresses{};
-	ids.resize(num * id_size);
-	addresses.resize(num);
+	this->transmitter_(protocol, network::endpoint{source}, message);
+	return true;
+}
 
-	std::vector<uint8_t> ids6{};
-	std::vector<sockaddr_in6> addresses6{};
-	ids6.resize(num6 * id_size);
-	addresses6.resize(num6);
+bool dht::take_answer_budget(const search_clock::time_point now)
+{
+	const auto elapsed = std::chrono::duration<double>(now - this->answer_budget_update_).count();
+	this->answer_budget_update_ = now;
+	this->answer_budget_ = std::min(max_answers_per_second, this->answer_budget_ + elapsed * max_answers_per_second);
 
-	dht_get_nodes(addresses.data(), ids.data(), &num, addresses6.data(), ids6.data(), &num6);
+	if (this->answer_budget_ < 1.0)
+	{
+		return false;
+	}
 
-	const auto ipv4_nodes = std::min(addresses.size(), static_cast<size_t>(num));
-	const auto ipv6_nodes = std::min(addresses6.size(), static_cast<size_t>(num6));
-	store.nodes.reserve(ipv4_nodes + ipv6_nodes);
+	this->answer_budget_ -= 1.0;
+	return true;
+}
 
-	for (size_t i = 0; i < ipv4_nodes; ++i)
+void dht::rotate_token_secret(const search_clock::time_point now)
+{
+	if (now < this->next_token_rotation_)
 	{
-		node node{};
-		memcpy(node.id_.data(), ids.data() + i * id_size, node.id_.size());
-		memcpy(&node.address.get_in_addr(), &addresses.at(i), sizeof(sockaddr_in));
-		store.nodes.emplace_back(std::move(node));
+		return;
 	}
 
-	for (size_t i = 0; i < ipv6_nodes; ++i)
+	this->previous_token_secret_ = this->token_secret_;
+	dht_random_bytes(this->token_secret_.data(), this->token_secret_.size());
+	this->next_token_rotation_ = now + token_rotation_interval;
+}
+
+dht::token dht::get_token(const network::address& address, const token_secret& secret)
+{
+	utils::sha256::hasher hasher{};
+	hasher.update(secret.data(), secret.size());
+
+	if (address.is_ipv4())
+	{
+		hasher.update(&address.get_in_addr().sin_addr, sizeof(in_addr));
+	}
+	else
 	{
-		node node{};
-		memcpy(node.id_.data(), ids6.data() + i * id_size, node.id_.size());
-		memcpy(&node.address.get_in6_addr(), &addresses6.at(i), sizeof(sockaddr_in6));
-		store.nodes.emplace_back(std::move(node));
+		hasher.update(&address.get_in6_addr().sin6_addr, sizeof(in6_addr));
 	}
 
-	save_dht_store(store);
+	const auto digest = hasher.finish();
+
+	token result{};
+	memcpy(result.data(), digest.data(), result.size());
+	return result;
 }
+
+void dht::append_nodes(const routing_table& table, const id& target, const std::string_view key,
+                       std::string& message)
+{
+	table.find_closest(target, answer_node_count, this->answer_nodes_);
+
+	const auto address_size = key == "nodes" ? sizeof(in_addr) : sizeof(in6_addr);
+	const auto entry_size = id{}.size() + address_size + sizeof(uint16_t);
+
+	append_string(message, key);
+	message.append(std::to_string(this->answer_nodes_.size() * entry_size));
+	message.push_back(':');
+
+	for (const auto& node : this->answer_nodes_)
+	{
+		message.append(to_view(node.id_));
+
+		if (node.address.is_ipv4())
+		{
+			const auto& in = node.address.get_in_addr();
+			message.append(reinterpret_cast<const char*>(&in.sin_addr), sizeof(in.sin_addr));
+			message.append(reinterpret_cast<const char*>(&in.sin_port), sizeof(in.sin_port));
+		}
+		else
+		{
+			const auto& in6 = node.address.get_in6_addr();
+			message.append(reinterpret_cast<const char*>(&in6.sin6_addr), sizeof(in6.sin6_addr));
+			message.append(reinterpret_cast<const char*>(&in6.sin6_port), sizeof(in6.sin6_port));
+		}
+	}
+}
+
+routing_table& dht::get_routing_table(const network::address& address)
+{
+	return address.is_ipv4() ? this->routes_v4_ : this->routes_v6_;
+}
+
+void dht::cleanup_latency_tracking(const latency_clock::time_point now)
+{
+	if ((now - this->last_latency_cleanup_) < 10s)
+	{
+		return;
+	}
+
+	this->last_latency_cleanup_ = now;
+
+	for (auto i = this->pending_queries_.begin(); i != this->pending_queries_.end();)
+	{
+		if ((now - i->second.sent) > 30s)
+		{
+			if (this->record_failure(i->second.destination) >= max_unanswered_queries)
+			{
+				this->remove_route(i->second.destination);
+			}
+
+			i = this->pending_queries_.erase(i);
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	for (auto i = this->rtt_estimates_.begin(); i != this->rtt_estimates_.end();)
+	{
+		if ((now - i->second.last_update) > 30min)
+		{
+			i = this->rtt_estimates_.erase(i);
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	for (auto i = this->node_health_.begin(); i != this->node_health_.end();)
+	{
+		if ((now - std::max(i->second.last_seen, i->second.last_failure)) > node_health_lifetime)
+		{
+			i = this->node_health_.erase(i);
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
+
+void dht::record_response(const network::address& source, const latency_clock::time_point received)
+{
+	auto entry = this->node_health_.find(source);
+	if (entry == this->node_health_.end())
+	{
+		if (this->node_health_.size() >= max_node_health)
+		{
+			return;
+		}
+
+		entry = this->node_health_.emplace(source, node_health{}).first;
+	}
+
+	++entry->second.responses;
+	entry->second.unanswered = 0;
+	entry->second.last_seen = received;
+}
+
+uint32_t dht::record_failure(const network::address& destination)
+{
+	auto entry = this->node_health_.find(destination);
+	if (entry == this->node_health_.end())
+	{
+		// Nodes from the store or the library never answered this run, they still have to be tracked
+		if (this->node_health_.size() >= max_node_health)
+		{
+			return 0;
+		}
+
+		entry = this->node_health_.emplace(destination, node_health{}).first;
+	}
+
+	++entry->second.failures;
+	entry->second.last_failure = latency_clock::now();
+	return ++entry->second.unanswered;
+}
+
+std::optional<dht::node_health> dht::get_node_health(const network::address& address) const
+{
+	const auto entry = this->node_health_.find(address);
+	if (entry == this->node_health_.end())
+	{
+		return {};
+	}
+
+	return entry->second;
+}
+
+void dht::add_route(const id& node_id, const network::address& address)
+{
+	auto& table = this->get_routing_table(address);
+	const auto previous = table.get_address(node_id);
+
+	std::optional<node> evicted{};
+	if (!table.insert(node_id, address, routing_table::clock::now(), &evicted))
+	{
+		return;
+	}
+
+	if (evicted)
+	{
+		this->journal_refreshed_.erase(evicted->address);
+		this->journal_change(node_store::change::evict, evicted->id_, evicted->address);
+	}
+
+	if (!previous)
+	{
+		this->journal_change(node_store::change::insert, node_id, address);
+		return;
+	}
+
+	if (*previous != address)
+	{
+		this->journal_refreshed_.erase(*previous);
+		this->journal_change(node_store::change::update, node_id, address);
+		return;
+	}
+
+	const auto refreshed = this->journal_refreshed_.find(address);
+	if (refreshed == this->journal_refreshed_.end()
+		|| (search_clock::now() - refreshed->second) >= journal_refresh_interval)
+	{
+		this->journal_change(node_store::change::update, node_id, address);
+	}
+}
+
+void dht::remove_route(const network::address& address)
+{
+	auto& table = this->get_routing_table(address);
+	const auto node_id = table.find_id(address);
+	if (!node_id || !table.remove(*node_id))
+	{
+		return;
+	}
+
+	this->journal_refreshed_.erase(address);
+	this->journal_change(node_store::change::evict, *node_id, address);
+}
+
+void dht::journal_change(const node_store::change type, const id& node_id, const network::address& address)
+{
+	if (this->journal_changes_.empty())
+	{
+		this->next_journal_commit_ = search_clock::now() + journal_commit_interval;
+	}
+
+	if (type != node_store::change::evict)
+	{
+		this->journal_refreshed_[address] = search_clock::now();
+	}
+
+	node_store::change_record record{};
+	record.type = type;
+	record.value.node = node{node_id, address};
+	this->journal_changes_.emplace_back(std::move(record));
+}
+
+void dht::commit_journal()
+{
+	if (this->journal_changes_.empty())
+	{
+		return;
+	}
+
+	// Health and round trip are taken now, so every record carries the latest values
+	for (auto& record : this->journal_changes_)
+	{
+		if (record.type != node_store::change::evict)
+		{
+			record.value = this->get_store_entry(std::move(record.value.node));
+		}
+	}
+
+	this->journal_size_ += this->journal_changes_.size() * sizeof(node_store::journal_record);
+	this->journal_->append(std::move(this->journal_changes_));
+	this->journal_changes_ = {};
+}
+
+void dht::start_warm_start(const std::vector<node_store::entry>& nodes, const bool ping)
+{
+	this->warm_start_begin_ = search_clock::now();
+
+	std::vector<std::pair<double, size_t>> order{};
+	order.reserve(nodes.size());
+
+	const auto now = latency_clock::now();
+
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		const auto& stored = nodes[i];
+		const auto& address = stored.node.address;
+
+		node_health health{};
+		health.last_seen = stored.last_seen;
+		health.responses = stored.responses;
+		health.failures = stored.failures;
+
+		order.emplace_back(get_warm_start_score(health, now), i);
+
+		if (!address.is_supported())
+		{
+			continue;
+		}
+
+		if ((health.responses || health.failures) && this->node_health_.size() < max_node_health)
+		{
+			this->node_health_[address] = health;
+		}
+
+		// Lookups get a sensible timeout for these nodes before the first new sample
+		if (stored.rtt.count() && this->rtt_estimates_.size() < max_rtt_estimates)
+		{
+			auto& estimate = this->rtt_estimates_[address];
+			estimate.smoothed = stored.rtt;
+			estimate.variance = stored.rtt / 2;
+			estimate.last_update = now;
+		}
+	}
+
+	std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b)
+	{
+		return a.first > b.first;
+	});
+
+	for (const auto& entry : order)
+	{
+		const auto& node = nodes[entry.second].node;
+		this->insert_node(node);
+
+		if (ping && this->warm_start_queue_.size() < max_warm_start_pings && node.address.is_supported())
+		{
+			this->warm_start_queue_.push_back(node.address);
+		}
+	}
+
+	// These nodes are on disk already
+	this->journal_changes_.clear();
+	this->journal_refreshed_.clear();
+
+	this->next_warm_start_wave_ = this->warm_start_begin_;
+}
+
+dht::search_clock::time_point dht::run_warm_start(const search_clock::time_point now)
+{
+	if (this->warm_start_next_ >= this->warm_start_queue_.size())
+	{
+		return search_clock::time_point::max();
+	}
+
+	if (now < this->next_warm_start_wave_)
+	{
+		return this->next_warm_start_wave_;
+	}
+
+	const auto end = std::min(this->warm_start_next_ + warm_start_wave_size, this->warm_start_queue_.size());
+	for (; this->warm_start_next_ < end; ++this->warm_start_next_)
+	{
+		this->ping(this->warm_start_queue_[this->warm_start_next_]);
+	}
+
+	if (this->warm_start_next_ >= this->warm_start_queue_.size())
+	{
+		this->warm_start_queue_ = {};
+		this->warm_start_next_ = 0;
+		return search_clock::time_point::max();
+	}
+
+	this->next_warm_start_wave_ = now + warm_start_wave_interval;
+	return this->next_warm_start_wave_;
+}
+
+void dht::check_good_bucket()
+{
+	if (this->first_good_bucket_)
+	{
+		return;
+	}
+
+	int good_v4 = 0;
+	int good_v6 = 0;
+	int dubious = 0;
+	int cached = 0;
+	int incoming = 0;
+	dht_nodes(AF_INET, &good_v4, &dubious, &cached, &incoming);
+	dht_nodes(AF_INET6, &good_v6, &dubious, &cached, &incoming);
+
+	if (good_v4 < good_bucket_size && good_v6 < good_bucket_size)
+	{
+		return;
+	}
+
+	this->first_good_bucket_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+		search_clock::now() - this->warm_start_begin_);
+
+	console::log("First good bucket after %lld ms (%d IPv4, %d IPv6 good nodes)",
+	             static_cast<long long>(this->first_good_bucket_->count()), good_v4, good_v6);
+}
+
+std::optional<std::chrono::milliseconds> dht::get_time_to_first_good_bucket() const
+{
+	return this->first_good_bucket_;
+}
+
+void dht::insert_node(const node& node)
+{
+	auto address = node.address;
+	dht_insert_node(node.id_.data(), &address.get_addr(), address.get_size());
+
+	if (address.is_supported())
+	{
+		this->add_route(node.id_, address);
+	}
+}
+
+size_t dht::find_closest(const protocol protocol, const id& target, const size_t count,
+                         std::vector<node>& results) const
+{
+	const auto& table = protocol == protocol::v4 ? this->routes_v4_ : this->routes_v6_;
+	return table.find_closest(target, count, results);
+}
+
+size_t dht::get_routing_table_size(const protocol protocol) const
+{
+	return protocol == protocol::v4 ? this->routes_v4_.size() : this->routes_v6_.size();
+}
+
+bool dht::try_ping(const std::string& hostname, const uint16_t port)
+{
+	bool pinged = false;
+	auto addresses = network::address::resolve_multiple(hostname);
+
+	for (auto& address : addresses)
+	{
+		if (address.is_supported())
+		{
+			address.set_port(port);
+			this->ping(address);
+			pinged = true;
+		}
+	}
+
+	return pinged;
+}
+
+void dht::start_bootstrap()
+{
+	this->load_bootstrap_cache();
+
+	// Routers resolved by an earlier run are contacted right away, DNS only refreshes them
+	for (const auto& entry : this->bootstrap_cache_)
+	{
+		for (const auto& address : entry.second)
+		{
+			this->ping(address);
+		}
+	}
+
+	for (const auto& router : bootstrap_routers)
+	{
+		this->resolver_.resolve(router.hostname, bootstrap_timeout);
+	}
+}
+
+void dht::run_bootstrap()
+{
+	if (!this->resolver_.get_pending())
+	{
+		return;
+	}
+
+	std::vector<network::resolver::result> results{};
+	this->resolver_.poll(results);
+
+	for (auto& result : results)
+	{
+		const auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(result.duration).count();
+
+		if (result.timed_out || result.addresses.empty())
+		{
+			console::warn("Failed to resolve %s after %lld ms%s", result.hostname.data(),
+			              static_cast<long long>(milliseconds),
+			              this->bootstrap_cache_.count(result.hostname) ? ", using cached addresses" : "");
+			continue;
+		}
+
+		const auto router = std::find_if(std::begin(bootstrap_routers), std::end(bootstrap_routers),
+		                                 [&result](const bootstrap_router& entry)
+		                                 {
+			                                 return result.hostname == entry.hostname;
+		                                 });
+
+		const auto port = router != std::end(bootstrap_routers) ? router->port : uint16_t{6881};
+		auto& cached = this->bootstrap_cache_[result.hostname];
+
+		for (auto& address : result.addresses)
+		{
+			address.set_port(port);
+
+			if (std::find(cached.begin(), cached.end(), address) == cached.end())
+			{
+				this->ping(address);
+			}
+		}
+
+		console::info("Resolved %s to %zu addresses in %lld ms", result.hostname.data(), result.addresses.size(),
+		              static_cast<long long>(milliseconds));
+
+		cached = std::move(result.addresses);
+	}
+}
+
+void dht::ping(const network::address& address)
+{
+	dht_ping_node(&address.get_addr(), address.get_size());
+}
+
+void dht::search(const std::string& keyword, results results, const uint16_t port, const result_mode mode)
+{
+	this->search(hash_keyword(keyword), std::move(results), port, mode);
+}
+
+void dht::search(const id& hash, results results, const uint16_t port, const result_mode mode)
+{
+	this->add_search(hash, std::move(results), port, mode, search_clock::now());
+}
+
+void dht::search(const std::vector<std::string>& keywords, const batch_results& results, const uint16_t port,
+                 const result_mode mode)
+{
+	std::vector<id> hashes{};
+	hashes.reserve(keywords.size());
+
+	// Repeated keywords are hashed once, the id overload registers them once
+	std::unordered_map<std::string_view, size_t> hashed{};
+	for (const auto& keyword : keywords)
+	{
+		const auto entry = hashed.emplace(keyword, hashes.size());
+		hashes.push_back(entry.second ? hash_keyword(keyword) : hashes[entry.first->second]);
+	}
+
+	this->search(hashes, results, port, mode);
+}
+
+void dht::search(const std::vector<id>& hashes, const batch_results& results, const uint16_t port,
+                 const result_mode mode)
+{
+	std::vector<size_t> order(hashes.size());
+	std::iota(order.begin(), order.end(), size_t{0});
+	std::sort(order.begin(), order.end(), [&hashes](const size_t a, const size_t b)
+	{
+		return hashes[a] < hashes[b];
+	});
+
+	// Sorted neighbours sharing more bits than random ids would only run once the first of
+	// them found its close nodes, native lookups then start from those instead of the root.
+	// The library starts every search from its routing table, there waiting only adds latency.
+	size_t shared_bits = 0;
+	while ((size_t{1} << shared_bits) < hashes.size())
+	{
+		++shared_bits;
+	}
+
+	const auto now = search_clock::now();
+	const id* previous = nullptr;
+
+	for (size_t i = 0; i < order.size();)
+	{
+		const auto& hash = hashes[order[i]];
+
+		// Searches are keyed by hash, repeated entries share one registration that reports to each index
+		std::vector<size_t> indices{};
+		for (; i < order.size() && hashes[order[i]] == hash; ++i)
+		{
+			indices.push_back(order[i]);
+		}
+
+		const auto follower = this->lookups_ && previous && routing_table::get_bucket(*previous, hash) >= shared_bits;
+		previous = &hash;
+
+		this->add_search(hash, [results, indices = std::move(indices)](const std::vector<network::address>& addresses)
+		{
+			for (const auto index : indices)
+			{
+				results(index, addresses);
+			}
+		}, port, mode, follower ? now + batch_follower_delay : now);
+	}
+}
+
+dht::id dht::hash_keyword(const std::string_view keyword)
+{
+	// Other nodes search and announce under these ids, so they keep the derivation of the old
+	// dht_hash: the same length-prefixed message, run through the legacy digest
+	const int lengths[] = {static_cast<int>(id{}.size()), static_cast<int>(keyword.size()), 0, 0};
+
+	std::string message{};
+	message.reserve(sizeof(lengths) + keyword.size());
+	message.append(reinterpret_cast<const char*>(&lengths[0]), sizeof(lengths[0]) * 2);
+	message.append(keyword);
+	message.append(reinterpret_cast<const char*>(&lengths[2]), sizeof(lengths[0]) * 2);
+
+	id hash{};
+	utils::sha256::compute_legacy(message.data(), message.size(), hash.data(), hash.size());
+	return hash;
+}
+
+void dht::add_search(const id& hash, results results, const uint16_t port, const result_mode mode,
+                     const search_clock::time_point due)
+{
+	search_entry entry{};
+	entry.callback = std::move(results);
+	entry.port = port;
+	entry.mode = mode;
+	entry.generation = ++this->search_generation_;
+
+	// Peers found by a replaced search count as delivered
+	const auto existing = this->searches_.find(hash);
+	if (existing != this->searches_.end())
+	{
+		entry.peers = std::move(existing->second.peers);
+	}
+
+	// The network lookup still goes out and refreshes the cache
+	this->search_schedule_.push({due, hash, entry.generation});
+	this->searches_[hash] = std::move(entry);
+
+	if (this->peer_cache_.lookup(hash, this->result_buffer_))
+	{
+		this->deliver_results(hash);
+	}
+	else if (this->segments_->lookup(hash, this->result_buffer_))
+	{
+		// Peers found by an earlier run, the cache keeps them at hand for the next search
+		this->peer_cache_.insert(hash, this->result_buffer_);
+		this->deliver_results(hash);
+	}
+}
+
+const peer_cache::statistics& dht::get_peer_cache_statistics() const
+{
+	return this->peer_cache_.get_statistics();
+}
+
+peer_segments::statistics dht::get_peer_segment_statistics() const
+{
+	return this->segments_->get_statistics();
+}
+
+void dht::use_native_lookups(const lookup_engine::config& config)
+{
+	const auto sender = [this](const network::address& destination, const std::string_view data)
+	{
+		this->send_query(destination, data);
+	};
+
+	const auto timeouts = [this](const network::address& node) -> std::optional<lookup_engine::clock::duration>
+	{
+		const auto rtt = this->get_rtt(node);
+		if (!rtt)
+		{
+			return {};
+		}
+
+		return rtt->smoothed + (rtt->variance * 4);
+	};
+
+	this->lookups_ = std::make_unique<lookup_engine>(this->id_, sender, timeouts, config);
+}
+
+const lookup_engine* dht::get_lookup_engine() const
+{
+	return this->lookups_.get();
+}
+
+void dht::start_lookups(const id& hash, const uint16_t port)
+{
+	const auto handler = [this](const id& target, const std::vector<network::address>& peers)
+	{
+		this->handle_lookup_result(target, peers);
+	};
+
+	const auto k = this->lookups_->get_config().k;
+
+	this->routes_v4_.find_closest(hash, k, this->lookup_seeds_);
+	this->lookups_->start(hash, AF_INET, this->lookup_seeds_, port, handler);
+
+	this->routes_v6_.find_closest(hash, k, this->lookup_seeds_);
+	this->lookups_->start(hash, AF_INET6, this->lookup_seeds_, port, handler);
+}
+
+void dht::send_query(const network::address& destination, const std::string_view data)
+{
+	const network::endpoint target{destination};
+	this->track_query(target, data);
+	this->transmitter_(destination.is_ipv4() ? protocol::v4 : protocol::v6, target, data);
+}
+
+void dht::set_peer_storage(std::unique_ptr<peer_storage> storage)
+{
+	this->peer_storage_ = std::move(storage);
+}
+
+const peer_storage& dht::get_peer_storage() const
+{
+	return *this->peer_storage_;
+}
+
+std::chrono::milliseconds dht::run_frame()
+{
+	const auto now = search_clock::now();
+	auto next_search = this->run_searches(now);
+
+	if (this->lookups_)
+	{
+		next_search = std::min(next_search, this->lookups_->run(now));
+	}
+
+	this->cleanup_latency_tracking(latency_clock::now());
+	this->peer_storage_->expire(peer_storage::clock::now());
+	this->segments_->run();
+
+	time_t tosleep = 0;
+	dht_periodic(nullptr, 0, nullptr, 0, &tosleep, &dht::callback_static, this);
+
+	this->run_bootstrap();
+	next_search = std::min(next_search, this->run_warm_start(now));
+
+	if (!this->journal_changes_.empty())
+	{
+		if (now >= this->next_journal_commit_)
+		{
+			this->commit_journal();
+		}
+		else
+		{
+			next_search = std::min(next_search, this->next_journal_commit_);
+		}
+	}
+
+	if (this->journal_size_ >= max_journal_size)
+	{
+		this->checkpoint();
+	}
+
+	this->check_good_bucket();
+
+	if (this->resolver_.get_pending())
+	{
+		next_search = std::min(next_search, now + bootstrap_poll_interval);
+	}
+
+	const auto search_delay = std::chrono::ceil<std::chrono::milliseconds>(next_search - now);
+	return std::min({std::chrono::milliseconds{std::chrono::seconds{tosleep}}, search_delay,
+	                 std::chrono::milliseconds{3s}});
+}
+
+dht::search_clock::time_point dht::run_searches(const search_clock::time_point now)
+{
+	std::uniform_int_distribution<int64_t> jitter{-max_search_jitter.count(), max_search_jitter.count()};
+	size_t issued = 0;
+
+	while (!this->search_schedule_.empty())
+	{
+		if (this->search_schedule_.top().due > now)
+		{
+			return this->search_schedule_.top().due;
+		}
+
+		if (issued >= max_searches_per_frame)
+		{
+			return now + search_backlog_delay;
+		}
+
+		auto next = this->search_schedule_.top();
+		this->search_schedule_.pop();
+
+		const auto entry = this->searches_.find(next.hash);
+		if (entry == this->searches_.end() || entry->second.generation != next.generation)
+		{
+			continue;
+		}
+
+		if (this->lookups_)
+		{
+			this->start_lookups(next.hash, entry->second.port);
+		}
+		else
+		{
+			dht_search(next.hash.data(), entry->second.port, AF_INET, &dht::callback_static, this);
+			dht_search(next.hash.data(), entry->second.port, AF_INET6, &dht::callback_static, this);
+		}
+
+		++issued;
+
+		// Jitter keeps searches that started together from repeating in lockstep
+		next.due = now + search_interval + std::chrono::milliseconds{jitter(this->search_jitter_)};
+		this->search_schedule_.push(next);
+	}
+
+	return search_clock::time_point::max();
+}
+
+std::chrono::high_resolution_clock::time_point dht::run_frame_time_point()
+{
+	return this->run_frame() + std::chrono::high_resolution_clock::now();
+}
+
+std::vector<network::address> dht::get_peers(const id& hash) const
+{
+	const auto entry = this->searches_.find(hash);
+	if (entry == this->searches_.end())
+	{
+		return {};
+	}
+
+	return entry->second.peers.get_addresses();
+}
+
+void dht::handle_result_v4(const id& id, const std::string_view& data)
+{
+	auto& addresses = this->result_buffer_;
+	addresses.clear();
+	addresses.reserve((data.size() / 6) + 1);
+
+	size_t offset = 0;
+	while ((data.size() - offset) >= 6)
+	{
+		in_addr ip{};
+		uint16_t port;
+		memcpy(&ip.s_addr, data.data() + offset, 4);
+		memcpy(&port, data.data() + offset + 4, 2);
+		offset += 6;
+
+		network::address address{};
+		address.set_ipv4(ip);
+		address.set_port(ntohs(port));
+
+		addresses.emplace_back(address);
+	}
+
+	console::info("Received %zu IPv4 addresses", addresses.size());
+
+	this->add_results(id);
+}
+
+void dht::handle_result_v6(const id& id, const std::string_view& data)
+{
+	auto& addresses = this->result_buffer_;
+	addresses.clear();
+	addresses.reserve((data.size() / 18) + 1);
+
+	size_t offset = 0;
+	while ((data.size() - offset) >= 18)
+	{
+		in6_addr ip{};
+		uint16_t port;
+		memcpy(&ip.s6_addr, data.data() + offset, 16);
+		memcpy(&port, data.data() + offset + 16, 2);
+		offset += 18;
+
+		network::address address{};
+		address.set_ipv6(ip);
+		address.set_port(ntohs(port));
+
+		addresses.emplace_back(address);
+	}
+
+	console::info("Received %zu IPv6 addresses", addresses.size());
+
+	this->add_results(id);
+}
+
+void dht::handle_lookup_result(const id& id, const std::vector<network::address>& peers)
+{
+	this->result_buffer_ = peers;
+
+	console::info("Received %zu addresses", peers.size());
+
+	this->add_results(id);
+}
+
+void dht::add_results(const id& id)
+{
+	this->peer_cache_.insert(id, this->result_buffer_);
+	this->segments_->insert(id, this->result_buffer_);
+	this->deliver_results(id);
+}
+
+void dht::deliver_results(const id& id)
+{
+	const auto entry = this->searches_.find(id);
+	if (entry == this->searches_.end())
+	{
+		return;
+	}
+
+	auto& search = entry->second;
+	auto& addresses = this->result_buffer_;
+
+	if (search.mode == result_mode::new_peers)
+	{
+		addresses.erase(std::remove_if(addresses.begin(), addresses.end(), [&search](const network::address& address)
+		{
+			return !search.peers.insert(address);
+		}), addresses.end());
+
+		if (addresses.empty())
+		{
+			return;
+		}
+	}
+	else
+	{
+		for (const auto& address : addresses)
+		{
+			search.peers.insert(address);
+		}
+	}
+
+	search.callback(addresses);
+}
+
+void dht::callback_static(void* closure, const int event, const unsigned char* info_hash, const void* data,
+                          const size_t data_len)
+{
+	static_cast<dht*>(closure)->callback(event, info_hash, data, data_len);
+}
+
+void dht::callback(const int event, const unsigned char* info_hash, const void* data, const size_t data_len)
+{
+	console::log("Event: %d (%zu)", event, data_len);
+
+	if (event == DHT_EVENT_VALUES)
+	{
+		id hash{};
+		memcpy(hash.data(), info_hash, hash.size());
+
+		const std::string_view data_view{static_cast<const char*>(data), data_len};
+		this->handle_result_v4(hash, data_view);
+	}
+	else if (event == DHT_EVENT_VALUES6)
+	{
+		id hash{};
+		memcpy(hash.data(), info_hash, hash.size());
+
+		const std::string_view data_view{static_cast<const char*>(data), data_len};
+		this->handle_result_v6(hash, data_view);
+	}
+}
+
+node_store::entry dht::get_store_entry(node node) const
+{
+	node_store::entry entry{};
+
+	if (const auto health = this->get_node_health(node.address))
+	{
+		entry.last_seen = health->last_seen;
+		entry.responses = health->responses;
+		entry.failures = health->failures;
+	}
+
+	if (const auto rtt = this->get_rtt(node.address))
+	{
+		entry.rtt = rtt->smoothed;
+	}
+
+	entry.node = std::move(node);
+	return entry;
+}
+
+node_store::snapshot dht::get_snapshot() const
+{
+	node_store::snapshot store{};
+	store.id = this->id_;
+
+	auto nodes = this->routes_v4_.get_nodes();
+	auto nodes6 = this->routes_v6_.get_nodes();
+	nodes.insert(nodes.end(), std::make_move_iterator(nodes6.begin()), std::make_move_iterator(nodes6.end()));
+
+	store.nodes.reserve(nodes.size());
+	for (auto& node : nodes)
+	{
+		store.nodes.emplace_back(this->get_store_entry(std::move(node)));
+	}
+
+	return store;
+}
+
+void dht::checkpoint()
+{
+	// Copying the node list is all the network thread does, serializing and writing happen in the background.
+	// Changes that were not committed yet are part of the snapshot.
+	this->journal_->compact(this->get_snapshot());
+	this->journal_changes_.clear();
+	this->journal_size_ = 0;
+}
+
+void dht::save_state()
+{
+	this->checkpoint();
+	this->save_bootstrap_cache();
+	this->segments_->flush();
+	this->journal_->flush();
+	this->checkpoints_.flush();
+}
+
+node_journal::statistics dht::get_journal_statistics() const
+{
+	return this->journal_->get_statistics();
+}
+
+void dht::load_bootstrap_cache()
+{
+	try
+	{
+		std::string data{};
+		if (utils::io::read_file(this->store_file_ + ".bootstrap", &data))
+		{
+			this->bootstrap_cache_ = deserialize_bootstrap_cache(data);
+		}
+	}
+	catch (std::exception& e)
+	{
+		console::warn("Failed to load bootstrap cache: %s", e.what());
+	}
+}
+
+void dht::save_bootstrap_cache()
+{
+	if (this->bootstrap_cache_.empty())
+	{
+		return;
+	}
+
+	this->checkpoints_.submit(this->store_file_ + ".bootstrap", [cache = this->bootstrap_cache_]()
+	{
+		return serialize_bootstrap_cache(cache);
+	});
+}
+
@@ -1,7 +1,19 @@
 #pragma once
 
+#include "checkpointer.hpp"
+#include "lookup.hpp"
+#include "node_journal.hpp"
+#include "node_store.hpp"
+#include "network/resolver.hpp"
 #include "network/socket.hpp"
+#include "peer_cache.hpp"
+#include "peer_segments.hpp"
+#include "peer_set.hpp"
+#include "peer_storage.hpp"
+#include "routing_table.hpp"
+#include "utils/histogram.hpp"
 #include <array>
+#include <random>
 #include <unordered_map>
 
 namespace std
@@ -34,18 +46,55 @@ public:
 		v6,
 	};
 
-	using id = std::array<unsigned char, 20>;
+	using id = routing_table::id;
+	using node = routing_table::node;
 	using results = std::function<void(const std::vector<network::address>&)>;
-	using data_transmitter = std::function<void(protocol, const network::address& destination, const std::string& data)>
+	// Index of the keyword or id in the batch the peers were found for
+	using batch_results = std::function<void(size_t index, const std::vector<network::address>&)>;
+
+	enum class result_mode
+	{
+		// Every peer of every response, including ones delivered before
+		all,
+		// Only peers this search has not delivered yet
+		new_peers,
+	};
+	using data_transmitter = std::function<void(protocol, const network::endpoint& destination, std::string_view data)>
 	;
 
-	struct node
+	using latency_clock = std::chrono::system_clock;
+
+	struct latency_statistics
+	{
+		// Microseconds between sending a query and the kernel receiving the response
+		utils::histogram round_trip{};
+		// Microseconds a packet waited between the kernel and on_data
+		utils::histogram queueing{};
+	};
+
+	// Smoothed like the TCP retransmission timer (RFC 6298)
+	struct rtt_estimate
 	{
-		id id_{};
-		network::address address{};
+		std::chrono::microseconds smoothed{};
+		std::chrono::microseconds variance{};
+		uint64_t samples{};
+		latency_clock::time_point last_update{};
 	};
 
-	dht(data_transmitter transmitter);
+	// Persisted with every stored node, a restart pings the most reliable recently seen nodes first
+	struct node_health
+	{
+		latency_clock::time_point last_seen{};
+		uint32_t responses{};
+		uint32_t failures{};
+		// Queries that timed out since the last response
+		uint32_t unanswered{};
+		latency_clock::time_point last_failure{};
+	};
+
+	// Without bootstrap the node only knows the nodes from its store, nothing is resolved or pinged.
+	// Bootstrap routers are resolved in the background and cached next to the store.
+	dht(data_transmitter transmitter, std::string store_file = "./dht.store", bool bootstrap = true);
 	~dht();
 
 	dht(const dht&) = delete;
@@ -55,38 +104,214 @@ public:
 	dht& operator=(dht&&) = delete;
 
 	void insert_node(const node& node);
+	size_t find_closest(protocol protocol, const id& target, size_t count, std::vector<node>& results) const;
+	size_t get_routing_table_size(protocol protocol) const;
 
 	bool try_ping(const std::string& hostname, uint16_t port);
 	void ping(const network::address& address);
-	void search(const std::string& keyword, results results, uint16_t port);
-	void search(const id& hash, results results, uint16_t port);
+	void search(const std::string& keyword, results results, uint16_t port, result_mode mode = result_mode::all);
+	void search(const id& hash, results results, uint16_t port, result_mode mode = result_mode::all);
+	void search(const std::vector<std::string>& keywords, const batch_results& results, uint16_t port,
+	            result_mode mode = result_mode::all);
+	void search(const std::vector<id>& hashes, const batch_results& results, uint16_t port,
+	            result_mode mode = result_mode::all);
+
+	static id hash_keyword(std::string_view keyword);
+
+	// Searches run on lookup_engine instead of the library, which limits concurrent searches
+	void use_native_lookups(const lookup_engine::config& config = {});
+	const lookup_engine* get_lookup_engine() const;
+
+	// Every distinct peer found by a search so far
+	std::vector<network::address> get_peers(const id& hash) const;
+	const peer_cache::statistics& get_peer_cache_statistics() const;
+	// Search results of this and earlier runs, kept on disk next to the store
+	peer_segments::statistics get_peer_segment_statistics() const;
+
+	// Peers other nodes announce to us. get_peers and announce_peer queries are answered from it,
+	// the library never sees them and keeps no peers of its own.
+	void set_peer_storage(std::unique_ptr<peer_storage> storage);
+	const peer_storage& get_peer_storage() const;
 
 	std::chrono::milliseconds run_frame();
 	std::chrono::high_resolution_clock::time_point run_frame_time_point();
 
-	void on_data(protocol protocol, const network::address& address, const std::string& data);
+	void on_data(protocol protocol, const network::address& address, std::string_view data,
+	             latency_clock::time_point received = {});
 	int on_send(protocol protocol, const void* buf, int len, int flags,
 	            const struct sockaddr* to, int tolen);
 
+	const latency_statistics& get_latency_statistics() const;
+	std::optional<rtt_estimate> get_rtt(const network::address& address) const;
+	std::optional<node_health> get_node_health(const network::address& address) const;
+
+	// Routing table changes are journaled in the background, the journal is folded into a fresh
+	// snapshot once it grew large and on shutdown
+	node_journal::statistics get_journal_statistics() const;
+
+	// Time from startup until the library had a full bucket of good nodes
+	std::optional<std::chrono::milliseconds> get_time_to_first_good_bucket() const;
+
 private:
 	id id_{};
+	std::string store_file_{};
+
+	using search_clock = std::chrono::steady_clock;
 
 	struct search_entry
 	{
 		results callback{};
 		uint16_t port{};
-		std::chrono::system_clock::time_point last_query{};
+		result_mode mode{};
+		peer_set peers{};
+		// Schedule entries of a replaced search carry an older generation and are skipped
+		uint64_t generation{};
+	};
+
+	struct scheduled_search
+	{
+		search_clock::time_point due{};
+		id hash{};
+		uint64_t generation{};
+
+		bool operator>(const scheduled_search& obj) const
+		{
+			return this->due > obj.due;
+		}
 	};
 
 	data_transmitter transmitter_;
 	std::unordered_map<id, search_entry> searches_;
+	std::priority_queue<scheduled_search, std::vector<scheduled_search>, std::greater<>> search_schedule_;
+	uint64_t search_generation_{};
+	std::minstd_rand search_jitter_{std::random_device{}()};
+	std::vector<network::address> result_buffer_;
+	peer_cache peer_cache_{};
+	std::unique_ptr<peer_segments> segments_{};
+	std::unique_ptr<peer_storage> peer_storage_{std::make_unique<packed_peer_storage>()};
+
+	routing_table routes_v4_{};
+	routing_table routes_v6_{};
+
+	using token_secret = std::array<uint8_t, 16>;
+	using token = std::array<char, 8>;
+
+	// announce_peer tokens are bound to the querying address, the previous secret stays valid for one rotation
+	token_secret token_secret_{};
+	token_secret previous_token_secret_{};
+	search_clock::time_point next_token_rotation_{};
+	// Answers to get_peers and announce_peer, refilled continuously
+	double answer_budget_{};
+	search_clock::time_point answer_budget_update_{};
+	std::string answer_buffer_{};
+	std::string answer_peers_{};
+	std::vector<std::string_view> answer_want_{};
+	std::vector<node> answer_nodes_{};
+
+	network::resolver resolver_{};
+	std::map<std::string, std::vector<network::address>> bootstrap_cache_{};
+
+	std::unique_ptr<lookup_engine> lookups_{};
+	std::vector<node> lookup_seeds_{};
+
+	struct pending_query
+	{
+		latency_clock::time_point sent{};
+		network::address destination{};
+	};
+
+	// Transaction ids are only unique per node, so the key combines both. Fixed size, tracking
+	// a query never allocates.
+	struct query_key
+	{
+		std::array<uint8_t, 8> transaction{};
+		uint8_t transaction_size{};
+		uint8_t family{};
+		uint16_t port{};
+		std::array<uint8_t, 16> address{};
+
+		bool operator==(const query_key& obj) const;
+	};
+
+	struct query_key_hash
+	{
+		size_t operator()(const query_key& key) const;
+	};
+
+	static std::optional<query_key> get_query_key(std::string_view transaction, const sockaddr& address);
+
+	std::unordered_map<query_key, pending_query, query_key_hash> pending_queries_;
+	std::unordered_map<network::address, rtt_estimate> rtt_estimates_;
+	latency_statistics latency_statistics_{};
+	latency_clock::time_point last_latency_cleanup_{};
+
+	std::unordered_map<network::address, node_health> node_health_;
+	std::vector<network::address> warm_start_queue_{};
+	size_t warm_start_next_{};
+	search_clock::time_point warm_start_begin_{};
+	search_clock::time_point next_warm_start_wave_{};
+	std::optional<std::chrono::milliseconds> first_good_bucket_{};
+
+	checkpointer checkpoints_{};
+
+	std::unique_ptr<node_journal> journal_{};
+	std::vector<node_store::change_record> journal_changes_{};
+	// When the last record of a node was journaled, answers refresh its health at most this often
+	std::unordered_map<network::address, search_clock::time_point> journal_refreshed_{};
+	search_clock::time_point next_journal_commit_{};
+	// Bytes journaled since the last compaction
+	size_t journal_size_{};
+
+	void track_query(const network::endpoint& destination, std::string_view data);
+	// Returns true if the response answers a query this node sent
+	bool track_response(const network::address& source, std::string_view data, std::optional<std::string_view> type,
+	                    latency_clock::time_point received);
+	void learn_node(const network::address& source, std::string_view data, std::optional<std::string_view> type);
+
+	// Returns true if the query was answered or dropped and must not reach the library
+	bool answer_query(protocol protocol, const network::address& source, std::string_view data);
+	bool take_answer_budget(search_clock::time_point now);
+	void rotate_token_secret(search_clock::time_point now);
+	static token get_token(const network::address& address, const token_secret& secret);
+	void append_nodes(const routing_table& table, const id& target, std::string_view key, std::string& message);
+
+	routing_table& get_routing_table(const network::address& address);
+	void add_route(const id& node_id, const network::address& address);
+	void remove_route(const network::address& address);
+	void journal_change(node_store::change type, const id& node_id, const network::address& address);
+	void commit_journal();
+	void cleanup_latency_tracking(latency_clock::time_point now);
+
+	void record_response(const network::address& source, latency_clock::time_point received);
+	// Returns the queries in a row the node left unanswered
+	uint32_t record_failure(const network::address& destination);
+
+	void start_warm_start(const std::vector<node_store::entry>& nodes, bool ping);
+	search_clock::time_point run_warm_start(search_clock::time_point now);
+	void check_good_bucket();
+
+	void add_search(const id& hash, results results, uint16_t port, result_mode mode, search_clock::time_point due);
+	search_clock::time_point run_searches(search_clock::time_point now);
+	void start_lookups(const id& hash, uint16_t port);
+	void send_query(const network::address& destination, std::string_view data);
 
 	void handle_result_v4(const id& id, const std::string_view& data);
 	void handle_result_v6(const id& id, const std::string_view& data);
+	void handle_lookup_result(const id& id, const std::vector<network::address>& peers);
+	void add_results(const id& id);
+	void deliver_results(const id& id);
 
 	static void callback_static(void* closure, int event, const unsigned char* info_hash, const void* data,
 	                            size_t data_len);
 	void callback(int event, const unsigned char* info_hash, const void* data, size_t data_len);
 
-	void save_state() const;
+	void start_bootstrap();
+	void run_bootstrap();
+
+	node_store::entry get_store_entry(node node) const;
+	node_store::snapshot get_snapshot() const;
+	void checkpoint();
+	void save_state();
+	void load_bootstrap_cache();
+	void save_bootstrap_cache();
 };
@@ -0,0 +1,621 @@
+#include "std_include.hpp"
+#include "lookup.hpp"
+
+#include "utils/bencode.hpp"
+
+namespace
+{
+	constexpr size_t candidates_per_k = 8;
+	constexpr auto statistics_window = std::chrono::minutes(1);
+
+	constexpr size_t max_recent_lookups = 4096;
+	constexpr auto recent_lookup_lifetime = std::chrono::minutes(10);
+	// Random targets share about this many bits with the closest routing table entry anyway
+	constexpr size_t min_shared_prefix = 8;
+
+	constexpr size_t ipv4_node_size = 26;
+	constexpr size_t ipv6_node_size = 38;
+
+	bool is_closer(const lookup_engine::id& target, const lookup_engine::id& a, const lookup_engine::id& b)
+	{
+		for (size_t i = 0; i < target.size(); ++i)
+		{
+			const auto distance_a = static_cast<uint8_t>(a[i] ^ target[i]);
+			const auto distance_b = static_cast<uint8_t>(b[i] ^ target[i]);
+
+			if (distance_a != distance_b)
+			{
+				return distance_a < distance_b;
+			}
+		}
+
+		return false;
+	}
+
+	void append_string(std::string& message, const std::string_view value)
+	{
+		message.append(std::to_string(value.size()));
+		message.push_back(':');
+		message.append(value);
+	}
+
+	std::string_view to_view(const lookup_engine::id& value)
+	{
+		return {reinterpret_cast<const char*>(value.data()), value.size()};
+	}
+
+	template <size_t Size>
+	std::string_view to_view(const char (&transaction)[Size])
+	{
+		return {transaction, Size};
+	}
+
+	void parse_peers(const std::vector<std::string_view>& values, const int family,
+	                 std::vector<network::address>& peers)
+	{
+		for (const auto& value : values)
+		{
+			network::address peer{};
+			uint16_t port{};
+
+			if (family == AF_INET && value.size() == 6)
+			{
+				in_addr ip{};
+				memcpy(&ip.s_addr, value.data(), 4);
+				memcpy(&port, value.data() + 4, 2);
+				peer.set_ipv4(ip);
+			}
+			else if (family == AF_INET6 && value.size() == 18)
+			{
+				in6_addr ip{};
+				memcpy(&ip.s6_addr, value.data(), 16);
+				memcpy(&port, value.data() + 16, 2);
+				peer.set_ipv6(ip);
+			}
+			else
+			{
+				continue;
+			}
+
+			peer.set_port(ntohs(port));
+			peers.emplace_back(std::move(peer));
+		}
+	}
+}
+
+lookup_engine::lookup_engine(const id& local_id, sender sender, timeout_provider timeouts, config config)
+	: local_id_(local_id)
+	  , sender_(std::move(sender))
+	  , timeouts_(std::move(timeouts))
+	  , config_(config)
+{
+	this->config_.alpha = std::max<size_t>(1, this->config_.alpha);
+	this->config_.k = std::max<size_t>(1, this->config_.k);
+}
+
+bool lookup_engine::start(const id& target, const int family, const std::vector<node>& seeds,
+                          const uint16_t announce_port, peer_handler handler)
+{
+	if (!this->get_running(family).insert(target).second)
+	{
+		return false;
+	}
+
+	const auto number = this->next_lookup_++;
+	auto& lookup = this->lookups_[number];
+	lookup.target = target;
+	lookup.family = family;
+	lookup.port = announce_port;
+	lookup.handler = std::move(handler);
+
+	for (const auto& seed : seeds)
+	{
+		this->add_candidate(lookup, seed.id_, seed.address, 0);
+	}
+
+	const auto now = clock::now();
+	this->add_recent_nodes(lookup, now);
+
+	++this->statistics_.started;
+	this->statistics_.active = this->lookups_.size();
+
+	if (!this->advance(number, lookup, now))
+	{
+		this->finish(lookup, now);
+		this->lookups_.erase(number);
+		this->statistics_.active = this->lookups_.size();
+	}
+
+	return true;
+}
+
+bool lookup_engine::on_response(const network::address& source, const std::string_view data,
+                                const clock::time_point now)
+{
+	const auto tid = utils::bencode::find_string(data, "t");
+	if (!tid || tid->size() < 2 || (*tid)[0] != 'l')
+	{
+		return false;
+	}
+
+	// Nothing is waiting for announce confirmations
+	if ((*tid)[1] == 'a' && tid->size() == 4)
+	{
+		return true;
+	}
+
+	uint32_t number{};
+	if ((*tid)[1] != 'k' || tid->size() != 2 + sizeof(number))
+	{
+		return false;
+	}
+
+	memcpy(&number, tid->data() + 2, sizeof(number));
+
+	const auto transaction = this->transactions_.find(number);
+	if (transaction == this->transactions_.end())
+	{
+		return true;
+	}
+
+	const auto lookup_number = transaction->second.lookup;
+	const auto node_id = transaction->second.node;
+
+	const auto entry = this->lookups_.find(lookup_number);
+	if (entry == this->lookups_.end())
+	{
+		this->transactions_.erase(transaction);
+		return true;
+	}
+
+	auto& lookup = entry->second;
+	const auto candidate = std::find_if(lookup.candidates.begin(), lookup.candidates.end(),
+	                                    [&node_id](const lookup_engine::candidate& c)
+	                                    {
+		                                    return c.id_ == node_id;
+	                                    });
+
+	// The query timed out, the answer is too late to count
+	if (candidate == lookup.candidates.end() || candidate->state_ != state::pending)
+	{
+		this->transactions_.erase(transaction);
+		return true;
+	}
+
+	// Answers have to come from the address that was asked
+	if (candidate->address != source)
+	{
+		return true;
+	}
+
+	this->transactions_.erase(transaction);
+	--lookup.in_flight;
+
+	const auto response = utils::bencode::find_string(data, "y") == "r"
+		                      ? utils::bencode::find_value(data, "r")
+		                      : std::nullopt;
+
+	if (!response)
+	{
+		candidate->state_ = state::failed;
+	}
+	else
+	{
+		++this->statistics_.responses;
+		candidate->state_ = state::responded;
+		candidate->token = std::string{utils::bencode::find_string(*response, "token").value_or("")};
+
+		const auto depth = static_cast<uint8_t>(std::min(candidate->depth + 1, 0xFF));
+
+		this->values_.clear();
+		utils::bencode::find_strings(*response, "values", this->values_);
+
+		this->peers_.clear();
+		parse_peers(this->values_, lookup.family, this->peers_);
+
+		// candidate is invalidated once new nodes are added
+		const auto nodes = utils::bencode::find_string(*response, lookup.family == AF_INET ? "nodes" : "nodes6");
+		if (nodes)
+		{
+			this->add_nodes(lookup, *nodes, depth);
+		}
+
+		if (!this->peers_.empty() && lookup.handler)
+		{
+			lookup.handler(lookup.target, this->peers_);
+		}
+	}
+
+	if (!this->advance(lookup_number, lookup, now))
+	{
+		this->finish(lookup, now);
+		this->lookups_.erase(lookup_number);
+		this->statistics_.active = this->lookups_.size();
+	}
+
+	return true;
+}
+
+lookup_engine::clock::time_point lookup_engine::run(const clock::time_point now)
+{
+	auto next = clock::time_point::max();
+
+	for (auto i = this->lookups_.begin(); i != this->lookups_.end();)
+	{
+		auto& lookup = i->second;
+
+		for (auto& candidate : lookup.candidates)
+		{
+			if (candidate.state_ == state::pending && candidate.deadline <= now)
+			{
+				candidate.state_ = state::failed;
+				--lookup.in_flight;
+				++this->statistics_.timeouts;
+			}
+		}
+
+		if (!this->advance(i->first, lookup, now))
+		{
+			this->finish(lookup, now);
+			i = this->lookups_.erase(i);
+			continue;
+		}
+
+		for (const auto& candidate : lookup.candidates)
+		{
+			if (candidate.state_ == state::pending)
+			{
+				next = std::min(next, candidate.deadline);
+			}
+		}
+
+		++i;
+	}
+
+	// Timed out transactions may still be answered, drop them once their lookup is gone
+	for (auto i = this->transactions_.begin(); this->finished_ && i != this->transactions_.end();)
+	{
+		if (!this->lookups_.count(i->second.lookup))
+		{
+			i = this->transactions_.erase(i);
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	this->finished_ = false;
+	this->statistics_.active = this->lookups_.size();
+	return next;
+}
+
+const lookup_engine::statistics& lookup_engine::get_statistics() const
+{
+	return this->statistics_;
+}
+
+const lookup_engine::config& lookup_engine::get_config() const
+{
+	return this->config_;
+}
+
+void lookup_engine::add_candidate(lookup& lookup, const id& node_id, const network::address& address,
+                                  const uint8_t depth)
+{
+	if (node_id == this->local_id_ || !address.get_port())
+	{
+		return;
+	}
+
+	auto& candidates = lookup.candidates;
+	for (const auto& candidate : candidates)
+	{
+		if (candidate.id_ == node_id)
+		{
+			return;
+		}
+	}
+
+	const auto position = std::find_if(candidates.begin(), candidates.end(),
+	                                   [&](const candidate& c)
+	                                   {
+		                                   return is_closer(lookup.target, node_id, c.id_);
+	                                   });
+
+	const auto max_candidates = this->config_.k * candidates_per_k;
+	if (candidates.size() >= max_candidates && position == candidates.end())
+	{
+		return;
+	}
+
+	candidate entry{};
+	entry.id_ = node_id;
+	entry.address = address;
+	entry.depth = depth;
+	candidates.insert(position, std::move(entry));
+
+	// Queries in flight keep their entry, the list only shrinks from the far end
+	while (candidates.size() > max_candidates && candidates.back().state_ != state::pending)
+	{
+		candidates.pop_back();
+	}
+}
+
+void lookup_engine::add_recent_nodes(lookup& lookup, const clock::time_point now)
+{
+	const auto& recent = this->get_recent(lookup.family);
+	if (recent.empty())
+	{
+		return;
+	}
+
+	// XOR distance orders like the big-endian bytes, the longest shared prefix is a direct neighbour
+	const close_nodes* best{};
+	size_t best_prefix = min_shared_prefix;
+
+	const auto consider = [&](const std::map<id, close_nodes>::const_iterator& entry)
+	{
+		const auto prefix = routing_table::get_bucket(lookup.target, entry->first);
+		if (prefix >= best_prefix && (now - entry->second.found) < recent_lookup_lifetime)
+		{
+			best_prefix = prefix;
+			best = &entry->second;
+		}
+	};
+
+	const auto next = recent.lower_bound(lookup.target);
+	if (next != recent.end())
+	{
+		consider(next);
+	}
+
+	if (next != recent.begin())
+	{
+		consider(std::prev(next));
+	}
+
+	if (!best)
+	{
+		return;
+	}
+
+	for (const auto& node : best->nodes)
+	{
+		this->add_candidate(lookup, node.id_, node.address, 0);
+	}
+
+	++this->statistics_.shared_seeds;
+}
+
+void lookup_engine::remember(const lookup& lookup, const clock::time_point now)
+{
+	close_nodes entry{};
+	entry.found = now;
+
+	for (const auto& candidate : lookup.candidates)
+	{
+		if (entry.nodes.size() >= this->config_.k)
+		{
+			break;
+		}
+
+		if (candidate.state_ == state::responded)
+		{
+			entry.nodes.push_back({candidate.id_, candidate.address});
+		}
+	}
+
+	if (entry.nodes.empty())
+	{
+		return;
+	}
+
+	auto& recent = this->get_recent(lookup.family);
+	if (recent.insert_or_assign(lookup.target, std::move(entry)).second)
+	{
+		this->recent_order_.emplace_back(lookup.family, lookup.target);
+	}
+
+	while (this->recent_order_.size() > max_recent_lookups)
+	{
+		const auto& oldest = this->recent_order_.front();
+		this->get_recent(oldest.first).erase(oldest.second);
+		this->recent_order_.pop_front();
+	}
+}
+
+void lookup_engine::add_nodes(lookup& lookup, const std::string_view nodes, const uint8_t depth)
+{
+	const auto node_size = lookup.family == AF_INET ? ipv4_node_size : ipv6_node_size;
+
+	for (size_t offset = 0; (nodes.size() - offset) >= node_size; offset += node_size)
+	{
+		const auto* entry = nodes.data() + offset;
+
+		id node_id{};
+		memcpy(node_id.data(), entry, node_id.size());
+		entry += node_id.size();
+
+		network::address address{};
+		uint16_t port{};
+
+		if (lookup.family == AF_INET)
+		{
+			in_addr ip{};
+			memcpy(&ip.s_addr, entry, 4);
+			memcpy(&port, entry + 4, 2);
+			address.set_ipv4(ip);
+		}
+		else
+		{
+			in6_addr ip{};
+			memcpy(&ip.s6_addr, entry, 16);
+			memcpy(&port, entry + 16, 2);
+			address.set_ipv6(ip);
+		}
+
+		address.set_port(ntohs(port));
+		this->add_candidate(lookup, node_id, address, depth);
+	}
+}
+
+bool lookup_engine::advance(const uint64_t number, lookup& lookup, const clock::time_point now)
+{
+	size_t considered = 0;
+
+	for (auto& candidate : lookup.candidates)
+	{
+		if (lookup.in_flight >= this->config_.alpha || considered >= this->config_.k)
+		{
+			break;
+		}
+
+		if (candidate.state_ == state::failed)
+		{
+			continue;
+		}
+
+		++considered;
+
+		if (candidate.state_ == state::fresh)
+		{
+			this->query(number, lookup, candidate, now);
+		}
+	}
+
+	// Nothing in flight means every one of the k closest live nodes answered
+	return lookup.in_flight != 0;
+}
+
+void lookup_engine::query(const uint64_t number, lookup& lookup, candidate& candidate, const clock::time_point now)
+{
+	const auto transaction = this->allocate_transaction();
+	this->transactions_[transaction] = {number, candidate.id_};
+
+	char tid[2 + sizeof(transaction)] = {'l', 'k'};
+	memcpy(tid + 2, &transaction, sizeof(transaction));
+
+	auto& message = this->message_;
+	message.clear();
+	message.append("d1:ad2:id");
+	append_string(message, to_view(this->local_id_));
+	message.append("9:info_hash");
+	append_string(message, to_view(lookup.target));
+	message.append("e1:q9:get_peers1:t");
+	append_string(message, to_view(tid));
+	message.append("1:y1:qe");
+
+	candidate.state_ = state::pending;
+	candidate.deadline = now + this->get_timeout(candidate.address);
+	++lookup.in_flight;
+	++this->statistics_.queries;
+
+	this->sender_(candidate.address, message);
+}
+
+void lookup_engine::finish(const lookup& lookup, const clock::time_point now)
+{
+	++this->statistics_.completed;
+	++this->window_completed_;
+
+	this->finished_ = true;
+	this->get_running(lookup.family).erase(lookup.target);
+	this->remember(lookup, now);
+
+	for (const auto& candidate : lookup.candidates)
+	{
+		if (candidate.state_ == state::responded)
+		{
+			this->statistics_.hops += candidate.depth + 1;
+			break;
+		}
+	}
+
+	const auto elapsed = now - this->window_start_;
+	if (elapsed >= statistics_window)
+	{
+		this->statistics_.lookups_per_second = static_cast<double>(this->window_completed_)
+			/ std::chrono::duration<double>(elapsed).count();
+		this->window_completed_ = 0;
+		this->window_start_ = now;
+	}
+
+	if (lookup.port)
+	{
+		this->announce(lookup);
+	}
+}
+
+void lookup_engine::announce(const lookup& lookup)
+{
+	size_t announced = 0;
+	uint16_t sequence = 0;
+
+	for (const auto& candidate : lookup.candidates)
+	{
+		if (announced >= this->config_.k)
+		{
+			break;
+		}
+
+		if (candidate.state_ != state::responded || candidate.token.empty())
+		{
+			continue;
+		}
+
+		char tid[4] = {'l', 'a'};
+		memcpy(tid + 2, &sequence, sizeof(sequence));
+		++sequence;
+
+		auto& message = this->message_;
+		message.clear();
+		message.append("d1:ad2:id");
+		append_string(message, to_view(this->local_id_));
+		message.append("9:info_hash");
+		append_string(message, to_view(lookup.target));
+		message.append("4:porti");
+		message.append(std::to_string(lookup.port));
+		message.append("e5:token");
+		append_string(message, candidate.token);
+		message.append("e1:q13:announce_peer1:t");
+		append_string(message, to_view(tid));
+		message.append("1:y1:qe");
+
+		this->sender_(candidate.address, message);
+		++announced;
+	}
+}
+
+uint32_t lookup_engine::allocate_transaction()
+{
+	// Only a transaction that stayed open for four billion queries can be in the way
+	auto transaction = this->next_transaction_++;
+	while (this->transactions_.count(transaction))
+	{
+		transaction = this->next_transaction_++;
+	}
+
+	return transaction;
+}
+
+std::unordered_set<lookup_engine::id, routing_table::id_hash>& lookup_engine::get_running(const int family)
+{
+	return family == AF_INET ? this->running_v4_ : this->running_v6_;
+}
+
+std::map<lookup_engine::id, lookup_engine::close_nodes>& lookup_engine::get_recent(const int family)
+{
+	return family == AF_INET ? this->recent_v4_ : this->recent_v6_;
+}
+
+lookup_engine::clock::duration lookup_engine::get_timeout(const network::address& address) const
+{
+	const auto expected = this->timeouts_ ? this->timeouts_(address) : std::nullopt;
+	if (!expected)
+	{
+		return this->config_.default_timeout;
+	}
+
+	return std::clamp(*expected, this->config_.min_timeout, this->config_.max_timeout);
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "routing_table.hpp"
+#include <deque>
+#include <map>
+#include <unordered_set>
+
+// Iterative get_peers lookups (BEP 5) that run next to the dht library instead of inside it.
+// Every lookup keeps alpha queries in flight towards the k closest nodes it knows, waits for
+// each node as long as its measured round trip suggests and announces once it converged.
+// Any number of lookups can run at the same time. The closest nodes of finished lookups are
+// kept for a while, a lookup whose target shares a prefix with one of them starts from there.
+class lookup_engine
+{
+public:
+	using id = routing_table::id;
+	using node = routing_table::node;
+	using clock = std::chrono::steady_clock;
+
+	using sender = std::function<void(const network::address& destination, std::string_view data)>;
+	// Expected time until a node answers, empty if it was never measured
+	using timeout_provider = std::function<std::optional<clock::duration>(const network::address& node)>;
+	using peer_handler = std::function<void(const id& target, const std::vector<network::address>& peers)>;
+
+	struct config
+	{
+		size_t alpha{3};
+		size_t k{8};
+		clock::duration default_timeout{std::chrono::seconds(1)};
+		clock::duration min_timeout{std::chrono::milliseconds(150)};
+		clock::duration max_timeout{std::chrono::seconds(3)};
+	};
+
+	struct statistics
+	{
+		uint64_t started{};
+		uint64_t completed{};
+		uint64_t queries{};
+		uint64_t responses{};
+		uint64_t timeouts{};
+		uint64_t hops{};
+		// Lookups seeded with the close nodes of an earlier lookup for a nearby target
+		uint64_t shared_seeds{};
+		size_t active{};
+		// Completed lookups per second over the last full minute
+		double lookups_per_second{};
+	};
+
+	lookup_engine(const id& local_id, sender sender, timeout_provider timeouts, config config);
+
+	// Returns false if a lookup for the same target and family is still running
+	bool start(const id& target, int family, const std::vector<node>& seeds, uint16_t announce_port,
+	           peer_handler handler);
+
+	// Returns true if the message answered a query of this engine, the library must not see those
+	bool on_response(const network::address& source, std::string_view data, clock::time_point now = clock::now());
+
+	// Expires queries and sends new ones, returns when it wants to run again
+	clock::time_point run(clock::time_point now = clock::now());
+
+	const statistics& get_statistics() const;
+	const config& get_config() const;
+
+private:
+	enum class state : uint8_t
+	{
+		fresh,
+		pending,
+		responded,
+		failed,
+	};
+
+	struct candidate
+	{
+		id id_{};
+		network::address address{};
+		state state_{state::fresh};
+		uint8_t depth{};
+		clock::time_point deadline{};
+		std::string token{};
+	};
+
+	struct lookup
+	{
+		id target{};
+		int family{};
+		uint16_t port{};
+		peer_handler handler{};
+		std::vector<candidate> candidates{};
+		size_t in_flight{};
+	};
+
+	struct close_nodes
+	{
+		std::vector<node> nodes{};
+		clock::time_point found{};
+	};
+
+	struct transaction
+	{
+		uint64_t lookup{};
+		id node{};
+	};
+
+	id local_id_{};
+	sender sender_{};
+	timeout_provider timeouts_{};
+	config config_{};
+
+	uint64_t next_lookup_{};
+	uint32_t next_transaction_{};
+	std::unordered_map<uint64_t, lookup> lookups_{};
+	std::unordered_map<uint32_t, transaction> transactions_{};
+	std::unordered_set<id, routing_table::id_hash> running_v4_{};
+	std::unordered_set<id, routing_table::id_hash> running_v6_{};
+	bool finished_{};
+
+	std::map<id, close_nodes> recent_v4_{};
+	std::map<id, close_nodes> recent_v6_{};
+	std::deque<std::pair<int, id>> recent_order_{};
+
+	statistics statistics_{};
+	uint64_t window_completed_{};
+	clock::time_point window_start_{clock::now()};
+
+	std::string message_{};
+	std::vector<network::address> peers_{};
+	std::vector<std::string_view> values_{};
+
+	void add_candidate(lookup& lookup, const id& node_id, const network::address& address, uint8_t depth);
+	void add_nodes(lookup& lookup, std::string_view nodes, uint8_t depth);
+	void add_recent_nodes(lookup& lookup, clock::time_point now);
+	void remember(const lookup& lookup, clock::time_point now);
+
+	// Sends queries until alpha are in flight, returns false once the lookup converged
+	bool advance(uint64_t number, lookup& lookup, clock::time_point now);
+	void query(uint64_t number, lookup& lookup, candidate& candidate, clock::time_point now);
+	void finish(const lookup& lookup, clock::time_point now);
+	void announce(const lookup& lookup);
+
+	uint32_t allocate_transaction();
+	std::unordered_set<id, routing_table::id_hash>& get_running(int family);
+	std::map<id, close_nodes>& get_recent(int family);
+	clock::duration get_timeout(const network::address& address) const;
+};
@@ -1,15 +1,408 @@
 #include <std_include.hpp>
 
+#include "capture.hpp"
 #include "console.hpp"
 #include "dht.hpp"
 #include "network/address.hpp"
+#include "network/buffer_tuner.hpp"
+#include "network/io_backend.hpp"
+#include "network/reactor.hpp"
 #include "network/socket.hpp"
+#include "pipeline.hpp"
 
 namespace
 {
-	void unsafe_main(const uint16_t port)
+	struct options
 	{
-		console::log("Creating socket on port %hu", port);
+		uint16_t port{6881};
+		network::io_backend_type io_backend{network::io_backend_type::socket};
+		bool pipelined{false};
+		size_t identities{1};
+		std::string store{"./dht.store"};
+		int receive_buffer{0};
+		int send_buffer{0};
+		// Enables adaptive receive buffer growth up to this size
+		int max_receive_buffer{0};
+		// Records every inbound datagram for the replay tool
+		std::string capture{};
+		bool native_lookups{false};
+		lookup_engine::config lookup{};
+	};
+
+	struct socket_monitor
+	{
+		network::buffer_tuner v4;
+		network::buffer_tuner v6;
+
+		socket_monitor(network::socket& socket, network::socket& socket6, const int max_receive_buffer)
+			: v4(socket, max_receive_buffer)
+			  , v6(socket6, max_receive_buffer)
+		{
+		}
+
+		void update()
+		{
+			update("IPv4", this->v4);
+			update("IPv6", this->v6);
+		}
+
+		void log() const
+		{
+			log("IPv4", this->v4);
+			log("IPv6", this->v6);
+		}
+
+	private:
+		static void update(const char* name, network::buffer_tuner& tuner)
+		{
+			const auto dropped = tuner.update();
+			if (dropped)
+			{
+				console::warn("%s socket dropped %u packets, receive buffer is %d bytes", name, dropped,
+				              tuner.get_receive_buffer_size());
+			}
+		}
+
+		static void log(const char* name, const network::buffer_tuner& tuner)
+		{
+			console::log("%s socket: %llu packets dropped by the kernel, receive buffer %d bytes", name,
+			             static_cast<unsigned long long>(tuner.get_dropped()), tuner.get_receive_buffer_size());
+		}
+	};
+
+	struct identity
+	{
+		size_t index{0};
+		uint16_t port{};
+		std::string store{};
+	};
+
+	identity get_identity(const options& options, const size_t index)
+	{
+		identity identity{};
+		identity.index = index;
+		// Sharing a port would hand replies to whichever identity the kernel picks, and show
+		// remote nodes several ids behind one endpoint
+		identity.port = static_cast<uint16_t>(options.port + index);
+		identity.store = options.store;
+
+		if (index > 0)
+		{
+			identity.store += "." + std::to_string(index);
+		}
+
+		return identity;
+	}
+
+#ifdef _WIN32
+	using process_id = int;
+#else
+	using process_id = pid_t;
+#endif
+
+	// The dht library is a process wide singleton, so every additional identity gets its own process
+	size_t spawn_identities(const options& options, std::vector<process_id>& children)
+	{
+		if (options.identities <= 1)
+		{
+			return 0;
+		}
+
+#ifdef _WIN32
+		(void)children;
+		console::warn("Multiple identities are not supported on this platform, running a single one");
+		return 0;
+#else
+		for (size_t i = 1; i < options.identities; ++i)
+		{
+			const auto pid = fork();
+			if (pid == 0)
+			{
+				children.clear();
+				return i;
+			}
+
+			if (pid < 0)
+			{
+				console::error("Failed to spawn identity %zu", i);
+				break;
+			}
+
+			children.push_back(pid);
+		}
+
+		return 0;
+#endif
+	}
+
+	// Asks the other identities to shut down like on Ctrl+C
+	void stop_identities(const std::vector<process_id>& children)
+	{
+#ifndef _WIN32
+		for (const auto child : children)
+		{
+			kill(child, SIGINT);
+		}
+#else
+		(void)children;
+#endif
+	}
+
+	void wait_for_identities(const std::vector<process_id>& children)
+	{
+#ifndef _WIN32
+		for (const auto child : children)
+		{
+			waitpid(child, nullptr, 0);
+		}
+#else
+		(void)children;
+#endif
+	}
+
+	void log_statistics(const char* name, const network::send_queue::statistics& statistics)
+	{
+		const auto average = statistics.batches
+			                     ? static_cast<double>(statistics.packets) / static_cast<double>(statistics.batches)
+			                     : 0.0;
+
+		console::log("%s: %llu packets sent in %llu batches (%.2f per batch)", name,
+		             static_cast<unsigned long long>(statistics.packets),
+		             static_cast<unsigned long long>(statistics.batches), average);
+	}
+
+	void log_statistics(const char* name, const pipeline::stage_statistics& statistics)
+	{
+		console::log("%s stage: %llu packets, %llu dropped, queue depth %zu (max %zu)", name,
+		             static_cast<unsigned long long>(statistics.packets),
+		             static_cast<unsigned long long>(statistics.dropped), statistics.depth, statistics.max_depth);
+	}
+
+	void log_statistics(const pipeline::statistics& statistics)
+	{
+		log_statistics("Receive IPv4", statistics.receive_v4);
+		log_statistics("Receive IPv6", statistics.receive_v6);
+		log_statistics("Send", statistics.send);
+		log_statistics("IPv4", statistics.send_v4);
+		log_statistics("IPv6", statistics.send_v6);
+	}
+
+	void log_statistics(const char* name, const utils::histogram& histogram)
+	{
+		console::log("%s: %llu samples, p50 %llu us, p90 %llu us, p99 %llu us, max %llu us", name,
+		             static_cast<unsigned long long>(histogram.count()),
+		             static_cast<unsigned long long>(histogram.percentile(50)),
+		             static_cast<unsigned long long>(histogram.percentile(90)),
+		             static_cast<unsigned long long>(histogram.percentile(99)),
+		             static_cast<unsigned long long>(histogram.max()));
+	}
+
+	void log_statistics(const dht::latency_statistics& statistics)
+	{
+		log_statistics("Round trip time", statistics.round_trip);
+		log_statistics("Queueing delay", statistics.queueing);
+	}
+
+	void log_statistics(const peer_cache::statistics& statistics)
+	{
+		console::log("Peer cache: %zu entries, %llu hits, %llu misses, %llu evictions", statistics.entries,
+		             static_cast<unsigned long long>(statistics.hits),
+		             static_cast<unsigned long long>(statistics.misses),
+		             static_cast<unsigned long long>(statistics.evictions));
+	}
+
+	void log_statistics(const peer_storage::statistics& statistics)
+	{
+		console::log("Announced peers: %zu peers in %zu hashes (%zu KiB), %llu rejected, %llu expired",
+		             statistics.peers, statistics.hashes, statistics.memory / 1024,
+		             static_cast<unsigned long long>(statistics.rejected),
+		             static_cast<unsigned long long>(statistics.expired));
+	}
+
+	void log_statistics(const peer_segments::statistics& statistics)
+	{
+		console::log("Peer segments: %zu segments (%llu peers in %llu hashes, %zu KiB mapped), %zu in memory, "
+		             "%llu hits, %llu misses, %llu flushes, %llu merges, %llu failed",
+		             statistics.segments, static_cast<unsigned long long>(statistics.segment_peers),
+		             static_cast<unsigned long long>(statistics.segment_hashes), statistics.mapped_bytes / 1024,
+		             statistics.memory_peers, static_cast<unsigned long long>(statistics.hits),
+		             static_cast<unsigned long long>(statistics.misses),
+		             static_cast<unsigned long long>(statistics.flushes),
+		             static_cast<unsigned long long>(statistics.merges),
+		             static_cast<unsigned long long>(statistics.failed));
+	}
+
+	void log_statistics(const node_journal::statistics& statistics)
+	{
+		console::log("Journal: %llu records in %llu commits (%llu KiB), %llu compactions, %llu failed, "
+		             "last commit took %lld us",
+		             static_cast<unsigned long long>(statistics.records),
+		             static_cast<unsigned long long>(statistics.commits),
+		             static_cast<unsigned long long>(statistics.bytes / 1024),
+		             static_cast<unsigned long long>(statistics.compactions),
+		             static_cast<unsigned long long>(statistics.failed),
+		             static_cast<long long>(statistics.last_commit.count()));
+	}
+
+	void log_statistics(const lookup_engine& lookups)
+	{
+		const auto& statistics = lookups.get_statistics();
+		const auto completed = std::max<uint64_t>(1, statistics.completed);
+
+		console::log("Lookups: %zu active, %llu completed, %.2f/s, %.2f hops, %llu queries, %llu timeouts",
+		             statistics.active, static_cast<unsigned long long>(statistics.completed),
+		             statistics.lookups_per_second,
+		             static_cast<double>(statistics.hops) / static_cast<double>(completed),
+		             static_cast<unsigned long long>(statistics.queries),
+		             static_cast<unsigned long long>(statistics.timeouts));
+	}
+
+	void run_reactor(dht& dht, const pipeline::packet_handler& handler, network::io_backend& io,
+	                 network::io_backend& io6, network::send_queue& queue, network::send_queue& queue6,
+	                 socket_monitor& monitor, const std::atomic_bool& kill)
+	{
+		network::packet_batch batch{};
+		network::reactor reactor{};
+
+		const auto receive = [&handler, &batch](network::io_backend& io, network::send_queue& queue,
+		                                        const dht::protocol protocol)
+		{
+			while (io.receive_batch(batch))
+			{
+				for (const auto& packet : batch)
+				{
+					handler(protocol, packet);
+				}
+
+				queue.flush();
+			}
+		};
+
+		reactor.add_socket(io.get_descriptor(), [&]()
+		{
+			receive(io, queue, dht::protocol::v4);
+		});
+
+		reactor.add_socket(io6.get_descriptor(), [&]()
+		{
+			receive(io6, queue6, dht::protocol::v6);
+		});
+
+		std::function<void()> run_frame{};
+		run_frame = [&]()
+		{
+			const auto time = dht.run_frame();
+			queue.flush();
+			queue6.flush();
+
+			reactor.add_timer(time, run_frame);
+		};
+
+		std::function<void()> print_statistics{};
+		print_statistics = [&]()
+		{
+			log_statistics("IPv4", queue.get_statistics());
+			log_statistics("IPv6", queue6.get_statistics());
+			log_statistics(dht.get_latency_statistics());
+			log_statistics(dht.get_peer_cache_statistics());
+			log_statistics(dht.get_peer_segment_statistics());
+			log_statistics(dht.get_peer_storage().get_statistics());
+			log_statistics(dht.get_journal_statistics());
+
+			if (const auto* lookups = dht.get_lookup_engine())
+			{
+				log_statistics(*lookups);
+			}
+
+			monitor.log();
+
+			reactor.add_timer(1min, print_statistics);
+		};
+
+		std::function<void()> update_sockets{};
+		update_sockets = [&]()
+		{
+			monitor.update();
+			reactor.add_timer(1s, update_sockets);
+		};
+
+		run_frame();
+		reactor.add_timer(1min, print_statistics);
+		reactor.add_timer(1s, update_sockets);
+
+		while (!kill)
+		{
+			reactor.run_once();
+		}
+	}
+
+	void run_pipelined(dht& dht, const pipeline::packet_handler& handler, pipeline& stages, socket_monitor& monitor,
+	                   const std::atomic_bool& kill)
+	{
+		auto next_frame = pipeline::clock::now();
+		auto next_statistics = next_frame + 1min;
+		auto next_socket_update = next_frame + 1s;
+
+		while (!kill)
+		{
+			const auto now = pipeline::clock::now();
+			if (now >= next_frame)
+			{
+				next_frame = now + dht.run_frame();
+				stages.flush();
+			}
+
+			if (now >= next_statistics)
+			{
+				next_statistics = now + 1min;
+				log_statistics(stages.get_statistics());
+				log_statistics(dht.get_latency_statistics());
+				log_statistics(dht.get_peer_cache_statistics());
+				log_statistics(dht.get_peer_segment_statistics());
+				log_statistics(dht.get_peer_storage().get_statistics());
+				log_statistics(dht.get_journal_statistics());
+
+				if (const auto* lookups = dht.get_lookup_engine())
+				{
+					log_statistics(*lookups);
+				}
+
+				monitor.log();
+			}
+
+			if (now >= next_socket_update)
+			{
+				next_socket_update = now + 1s;
+				monitor.update();
+			}
+
+			stages.wait_until(std::min({next_frame, next_statistics, next_socket_update}));
+			stages.receive(handler);
+		}
+	}
+
+	void configure_socket(network::socket& socket, const options& options)
+	{
+		socket.set_blocking(false);
+		socket.set_timestamping(true);
+		socket.set_drop_accounting(true);
+
+		if (options.receive_buffer && !socket.set_receive_buffer_size(options.receive_buffer))
+		{
+			console::warn("Failed to set receive buffer size to %d bytes", options.receive_buffer);
+		}
+
+		if (options.send_buffer && !socket.set_send_buffer_size(options.send_buffer))
+		{
+			console::warn("Failed to set send buffer size to %d bytes", options.send_buffer);
+		}
+	}
+
+	void unsafe_main(const options& options, const identity& identity)
+	{
+		const auto port = identity.port;
+		console::log("Creating socket on port %hu for identity %zu (%s)", port, identity.index,
+		             identity.store.data());
 
 		network::address a{};
 		a.set_ipv4(in_addr{INADDR_ANY});
@@ -20,33 +413,63 @@ namespace
 		a6.set_port(port);
 
 		network::socket s{AF_INET};
-		s.set_blocking(false);
+		configure_socket(s, options);
 		if (!s.bind(a))
 		{
 			throw std::runtime_error("Failed to bind socket!");
 		}
 
 		network::socket s6{AF_INET6};
-		s6.set_blocking(false);
+		configure_socket(s6, options);
 		if (!s6.bind(a6))
 		{
 			throw std::runtime_error("Failed to bind socket!");
 		}
 
+		socket_monitor monitor{s, s6, options.max_receive_buffer};
+		console::log("Socket buffers: %d bytes receive, %d bytes send", s.get_receive_buffer_size(),
+		             s.get_send_buffer_size());
+
+		const auto io = network::create_io_backend(s, options.io_backend);
+		const auto io6 = network::create_io_backend(s6, options.io_backend);
+		console::log("Using %s backend", network::get_io_backend_name(io->get_type()));
+
+		network::send_queue queue{*io};
+		network::send_queue queue6{*io6};
+
+		std::unique_ptr<pipeline> stages{};
+		if (options.pipelined)
+		{
+			console::log("Running pipelined receive, protocol and send threads");
+			stages = std::make_unique<pipeline>(*io, *io6);
+		}
+
 		dht dht{
-			[&s, &s6](const dht::protocol protocol, const network::address& destination, const std::string& data)
+			[&queue, &queue6, &stages](const dht::protocol protocol, const network::endpoint& destination,
+			                           const std::string_view data)
 			{
-				if (protocol == dht::protocol::v4)
+				if (stages)
+				{
+					stages->send(protocol, destination, data);
+				}
+				else if (protocol == dht::protocol::v4)
 				{
-					s.send(destination, data);
+					queue.queue(destination, data);
 				}
 				else if (protocol == dht::protocol::v6)
 				{
-					s6.send(destination, data);
+					queue6.queue(destination, data);
 				}
-			}
+			},
+			identity.store,
 		};
 
+		if (options.native_lookups)
+		{
+			console::log("Running native lookups (alpha %zu, k %zu)", options.lookup.alpha, options.lookup.k);
+			dht.use_native_lookups(options.lookup);
+		}
+
 		std::atomic_bool kill{false};
 		console::signal_handler handler([&]()
 		{
@@ -71,45 +494,112 @@ namespace
 				console::info("Terminating server, as running in a CI instance ('CI' environment variable is set)");
 				kill = true;
 			}
-		}, s.get_port());
+		}, s.get_port(), dht::result_mode::new_peers);
 
-		std::string data{};
-		network::address address{};
-
-		std::vector<const network::socket*> sockets{};
-		sockets.push_back(&s);
-		sockets.push_back(&s6);
-
-		while (!kill)
+		std::unique_ptr<capture::writer> recorder{};
+		if (!options.capture.empty())
 		{
-			const auto time = dht.run_frame();
-			network::socket::sleep_sockets(sockets, time);
+			const auto file = identity.index ? options.capture + "." + std::to_string(identity.index) : options.capture;
+			console::log("Capturing inbound packets to %s", file.data());
+			recorder = std::make_unique<capture::writer>(file);
+		}
 
-			while (s.receive(address, data))
+		const pipeline::packet_handler deliver = [&dht, &recorder](const dht::protocol protocol,
+		                                                           const network::packet& packet)
+		{
+			if (recorder)
 			{
-				dht.on_data(dht::protocol::v4, address, data);
-				data.clear();
+				recorder->write(packet.timestamp, packet.address, packet.data);
 			}
 
-			while (s6.receive(address, data))
-			{
-				dht.on_data(dht::protocol::v6, address, data);
-				data.clear();
-			}
+			dht.on_data(protocol, packet.address, packet.data, packet.timestamp);
+		};
+
+		if (stages)
+		{
+			run_pipelined(dht, deliver, *stages, monitor, kill);
+		}
+		else
+		{
+			run_reactor(dht, deliver, *io, *io6, queue, queue6, monitor, kill);
 		}
 	}
 }
 
-uint16_t parse_port(const int argc, const char** argv)
+options parse_options(const int argc, const char** argv)
 {
-	if (argc <= 1)
+	options options{};
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string_view argument{argv[i]};
+
+		if (argument == "--io-uring")
+		{
+			options.io_backend = network::io_backend_type::io_uring;
+		}
+		else if (argument == "--pipelined")
+		{
+			options.pipelined = true;
+		}
+		else if (argument == "--identities" && (i + 1) < argc)
+		{
+			options.identities = std::max(1, atoi(argv[++i]));
+		}
+		else if (argument == "--store" && (i + 1) < argc)
+		{
+			options.store = argv[++i];
+		}
+		else if (argument == "--receive-buffer" && (i + 1) < argc)
+		{
+			options.receive_buffer = atoi(argv[++i]);
+		}
+		else if (argument == "--send-buffer" && (i + 1) < argc)
+		{
+			options.send_buffer = atoi(argv[++i]);
+		}
+		else if (argument == "--max-receive-buffer" && (i + 1) < argc)
+		{
+			options.max_receive_buffer = atoi(argv[++i]);
+		}
+		else if (argument == "--capture" && (i + 1) < argc)
+		{
+			options.capture = argv[++i];
+		}
+		else if (argument == "--native-lookups")
+		{
+			options.native_lookups = true;
+		}
+		else if (argument == "--lookup-alpha" && (i + 1) < argc)
+		{
+			options.lookup.alpha = static_cast<size_t>(std::max(1, atoi(argv[++i])));
+		}
+		else if (argument == "--lookup-k" && (i + 1) < argc)
+		{
+			options.lookup.k = static_cast<size_t>(std::max(1, atoi(argv[++i])));
+		}
+		else
+		{
+			options.port = static_cast<uint16_t>(atoi(argv[i]));
+		}
+	}
+
+	// Identity i binds port + i, every one of them needs a fixed port to find its store again
+	if (options.identities > 1)
 	{
-		return 6881;
+		if (!options.port)
+		{
+			throw std::runtime_error("Multiple identities need a fixed port");
+		}
+
+		if (options.port + (options.identities - 1) > UINT16_MAX)
+		{
+			throw std::runtime_error("Port " + std::to_string(options.port) + " leaves no room for " +
+				std::to_string(options.identities) + " identities");
+		}
 	}
 
-	const auto port_string = argv[1];
-	const auto port_num = atoi(port_string);
-	return static_cast<uint16_t>(port_num);
+	return options;
 }
 
 int main(const int argc, const char** argv)
@@ -117,16 +607,25 @@ int main(const int argc, const char** argv)
 	console::set_title("ANoN Node");
 	console::log("Starting ANoN Node");
 
+	std::vector<process_id> children{};
+	auto result = 0;
+
 	try
 	{
-		const auto port = parse_port(argc, argv);
-		unsafe_main(port);
+		const auto options = parse_options(argc, argv);
+		const auto index = spawn_identities(options, children);
+
+		unsafe_main(options, get_identity(options, index));
 	}
 	catch (std::exception& e)
 	{
 		console::error("Fatal error: %s\n", e.what());
-		return -1;
+		result = -1;
+
+		// Nothing else would make them exit
+		stop_identities(children);
 	}
 
-	return 0;
+	wait_for_identities(children);
+	return result;
 }
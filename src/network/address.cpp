@@ -356,6 +356,42 @@ namespace network
 
 		return results;
 	}
+
+	endpoint::endpoint(const sockaddr* addr, const int length)
+		: address_(addr)
+		  , length_(length)
+	{
+	}
+
+	endpoint::endpoint(const address& address)
+		: endpoint(&address.get_addr(), address.get_size())
+	{
+	}
+
+	const sockaddr& endpoint::get_addr() const
+	{
+		return *this->address_;
+	}
+
+	int endpoint::get_size() const
+	{
+		return this->length_;
+	}
+
+	bool endpoint::is_ipv4() const
+	{
+		return this->address_->sa_family == AF_INET;
+	}
+
+	bool endpoint::is_ipv6() const
+	{
+		return this->address_->sa_family == AF_INET6;
+	}
+
+	address endpoint::to_address() const
+	{
+		return {this->address_, this->length_};
+	}
 }
 
 std::size_t std::hash<network::address>::operator()(const network::address& a) const noexcept
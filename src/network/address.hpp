@@ -60,6 +60,26 @@ namespace network
 		void parse(std::string addr);
 		void resolve(const std::string& hostname);
 	};
+
+	// Non-owning view of a socket address, the referenced address must outlive it
+	class endpoint
+	{
+	public:
+		endpoint(const sockaddr* addr, int length);
+		endpoint(const address& address);
+
+		const sockaddr& get_addr() const;
+		int get_size() const;
+
+		bool is_ipv4() const;
+		bool is_ipv6() const;
+
+		[[nodiscard]] address to_address() const;
+
+	private:
+		const sockaddr* address_{};
+		int length_{};
+	};
 }
 
 namespace std
@@ -0,0 +1,73 @@
+#include "std_include.hpp"
+
+#include "network/buffer_tuner.hpp"
+
+#include "console.hpp"
+
+namespace network
+{
+	namespace
+	{
+		// Linux reports twice the size that was set, the kernel's bookkeeping overhead included.
+		// Everything here is kept in the unit setsockopt takes.
+		int get_requested_size(const socket& socket)
+		{
+			const auto size = socket.get_receive_buffer_size();
+#ifdef __linux__
+			return size / 2;
+#else
+			return size;
+#endif
+		}
+	}
+
+	buffer_tuner::buffer_tuner(socket& socket, const int max_size)
+		: socket_(&socket)
+		  , max_size_(max_size)
+		  , size_(get_requested_size(socket))
+		  , last_counter_(socket.get_dropped())
+	{
+	}
+
+	uint32_t buffer_tuner::update()
+	{
+		const auto counter = this->socket_->get_dropped();
+		const auto dropped = counter - this->last_counter_;
+		this->last_counter_ = counter;
+
+		if (!dropped)
+		{
+			return 0;
+		}
+
+		this->dropped_ += dropped;
+
+		if (this->size_ < this->max_size_)
+		{
+			const auto requested = this->size_ > this->max_size_ / 2 ? this->max_size_ : this->size_ * 2;
+			this->socket_->set_receive_buffer_size(requested);
+
+			// The kernel may clamp the request (rmem_max) or round it up
+			const auto size = get_requested_size(*this->socket_);
+			if (size <= this->size_)
+			{
+				console::warn("Receive buffer stuck at %d bytes, raise net.core.rmem_max to grow it further", size);
+				this->max_size_ = 0;
+			}
+
+			this->size_ = size;
+		}
+
+		return dropped;
+	}
+
+	uint64_t buffer_tuner::get_dropped() const
+	{
+		return this->dropped_;
+	}
+
+	int buffer_tuner::get_receive_buffer_size() const
+	{
+		return this->size_;
+	}
+}
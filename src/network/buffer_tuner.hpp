@@ -0,0 +1,29 @@
+#pragma once
+
+#include "network/socket.hpp"
+
+namespace network
+{
+	// Watches the kernel drop counter of a socket and doubles its receive buffer,
+	// up to max_size, whenever new drops show up. A max_size of 0 only counts drops.
+	class buffer_tuner
+	{
+	public:
+		buffer_tuner(socket& socket, int max_size = 0);
+
+		// Returns the packets dropped since the previous call
+		uint32_t update();
+
+		uint64_t get_dropped() const;
+		// In the unit setsockopt takes, Linux reports twice as much through getsockopt
+		int get_receive_buffer_size() const;
+
+	private:
+		socket* socket_{};
+		int max_size_{};
+		int size_{};
+
+		uint32_t last_counter_{};
+		uint64_t dropped_{};
+	};
+}
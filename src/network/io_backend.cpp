@@ -0,0 +1,109 @@
+#include "std_include.hpp"
+
+#include "network/io_backend.hpp"
+#include "network/uring_backend.hpp"
+
+#include "console.hpp"
+
+namespace network
+{
+	socket_backend::socket_backend(const socket& socket)
+		: socket_(&socket)
+	{
+	}
+
+	bool socket_backend::receive_batch(packet_batch& batch)
+	{
+		return this->socket_->receive_batch(batch);
+	}
+
+	size_t socket_backend::send_batch(packet_batch& batch)
+	{
+		return this->socket_->send_batch(batch);
+	}
+
+	bool socket_backend::send(const endpoint& target, const std::string_view data)
+	{
+		return this->socket_->send(target, data);
+	}
+
+	SOCKET socket_backend::get_descriptor() const
+	{
+		return this->socket_->get_socket();
+	}
+
+	io_backend_type socket_backend::get_type() const
+	{
+		return io_backend_type::socket;
+	}
+
+	std::unique_ptr<io_backend> create_io_backend(const socket& socket, const io_backend_type type)
+	{
+		if (type == io_backend_type::io_uring)
+		{
+			try
+			{
+				return std::make_unique<uring_backend>(socket);
+			}
+			catch (std::exception& e)
+			{
+				console::warn("io_uring backend unavailable, falling back to sockets: %s", e.what());
+			}
+		}
+
+		return std::make_unique<socket_backend>(socket);
+	}
+
+	const char* get_io_backend_name(const io_backend_type type)
+	{
+		switch (type)
+		{
+		case io_backend_type::io_uring:
+			return "io_uring";
+		case io_backend_type::socket:
+		default:
+			return "socket";
+		}
+	}
+
+	send_queue::send_queue(io_backend& backend, const size_t capacity)
+		: backend_(&backend)
+		  , batch_(capacity)
+	{
+	}
+
+	void send_queue::queue(const endpoint& target, const std::string_view data)
+	{
+		if (this->batch_.push(target, data))
+		{
+			return;
+		}
+
+		if (data.size() > this->batch_.packet_size())
+		{
+			this->backend_->send(target, data);
+			return;
+		}
+
+		this->flush();
+		this->batch_.push(target, data);
+	}
+
+	size_t send_queue::flush()
+	{
+		if (this->batch_.empty())
+		{
+			return 0;
+		}
+
+		++this->statistics_.batches;
+		this->statistics_.packets += this->batch_.size();
+
+		return this->backend_->send_batch(this->batch_);
+	}
+
+	const send_queue::statistics& send_queue::get_statistics() const
+	{
+		return this->statistics_;
+	}
+}
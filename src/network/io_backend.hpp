@@ -0,0 +1,69 @@
+#pragma once
+
+#include "network/socket.hpp"
+#include <memory>
+
+namespace network
+{
+	enum class io_backend_type
+	{
+		socket,
+		io_uring,
+	};
+
+	class io_backend
+	{
+	public:
+		virtual ~io_backend() = default;
+
+		// Packets returned by receive_batch stay valid until the next call
+		virtual bool receive_batch(packet_batch& batch) = 0;
+		virtual size_t send_batch(packet_batch& batch) = 0;
+		virtual bool send(const endpoint& target, std::string_view data) = 0;
+
+		// Descriptor that becomes readable once receive_batch has data to return
+		virtual SOCKET get_descriptor() const = 0;
+		virtual io_backend_type get_type() const = 0;
+	};
+
+	class socket_backend : public io_backend
+	{
+	public:
+		socket_backend(const socket& socket);
+
+		bool receive_batch(packet_batch& batch) override;
+		size_t send_batch(packet_batch& batch) override;
+		bool send(const endpoint& target, std::string_view data) override;
+
+		SOCKET get_descriptor() const override;
+		io_backend_type get_type() const override;
+
+	private:
+		const socket* socket_{};
+	};
+
+	std::unique_ptr<io_backend> create_io_backend(const socket& socket, io_backend_type type);
+	const char* get_io_backend_name(io_backend_type type);
+
+	class send_queue
+	{
+	public:
+		struct statistics
+		{
+			uint64_t packets{};
+			uint64_t batches{};
+		};
+
+		send_queue(io_backend& backend, size_t capacity = 64);
+
+		void queue(const endpoint& target, std::string_view data);
+		size_t flush();
+
+		const statistics& get_statistics() const;
+
+	private:
+		io_backend* backend_{};
+		packet_batch batch_;
+		statistics statistics_{};
+	};
+}
@@ -0,0 +1,267 @@
+#include "std_include.hpp"
+
+#include "network/reactor.hpp"
+
+#include "console.hpp"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+#ifdef _WIN32
+#define poll WSAPoll
+#endif
+
+namespace network
+{
+	reactor::reactor()
+	{
+#ifdef __linux__
+		this->epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+		if (this->epoll_fd_ < 0)
+		{
+			throw std::runtime_error("Failed to create epoll instance");
+		}
+
+		this->timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (this->timer_fd_ < 0)
+		{
+			close(this->epoll_fd_);
+			throw std::runtime_error("Failed to create timer");
+		}
+
+		epoll_event event{};
+		event.events = EPOLLIN;
+		event.data.fd = this->timer_fd_;
+		epoll_ctl(this->epoll_fd_, EPOLL_CTL_ADD, this->timer_fd_, &event);
+#endif
+	}
+
+	reactor::~reactor()
+	{
+#ifdef __linux__
+		close(this->timer_fd_);
+		close(this->epoll_fd_);
+#endif
+	}
+
+	void reactor::add_socket(const socket& socket, handler on_readable)
+	{
+		this->add_socket(socket.get_socket(), std::move(on_readable));
+	}
+
+	void reactor::add_socket(const SOCKET fd, handler on_readable)
+	{
+		this->socket_handlers_[fd] = std::move(on_readable);
+
+#ifdef __linux__
+		epoll_event event{};
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+
+		if (epoll_ctl(this->epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0)
+		{
+			epoll_ctl(this->epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+		}
+#else
+		for (const auto& poll_fd : this->poll_fds_)
+		{
+			if (poll_fd.fd == fd)
+			{
+				return;
+			}
+		}
+
+		pollfd poll_fd{};
+		poll_fd.fd = fd;
+		poll_fd.events = POLLIN;
+		this->poll_fds_.push_back(poll_fd);
+#endif
+	}
+
+	void reactor::remove_socket(const socket& socket)
+	{
+		this->remove_socket(socket.get_socket());
+	}
+
+	void reactor::remove_socket(const SOCKET fd)
+	{
+		this->socket_handlers_.erase(fd);
+
+#ifdef __linux__
+		epoll_ctl(this->epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+#else
+		for (auto i = this->poll_fds_.begin(); i != this->poll_fds_.end(); ++i)
+		{
+			if (i->fd == fd)
+			{
+				this->poll_fds_.erase(i);
+				break;
+			}
+		}
+#endif
+	}
+
+	reactor::timer_id reactor::add_timer(const clock::time_point due, handler callback)
+	{
+		const auto id = ++this->next_timer_id_;
+		this->timer_handlers_[id] = std::move(callback);
+		this->timers_.push({due, id});
+
+		return id;
+	}
+
+	reactor::timer_id reactor::add_timer(const clock::duration delay, handler callback)
+	{
+		return this->add_timer(clock::now() + delay, std::move(callback));
+	}
+
+	void reactor::cancel_timer(const timer_id id)
+	{
+		// The heap entry is dropped lazily once it reaches the top
+		this->timer_handlers_.erase(id);
+	}
+
+	void reactor::run_once()
+	{
+		const auto next_due = this->get_next_due();
+
+#ifdef __linux__
+		if (next_due)
+		{
+			this->arm_timer(*next_due);
+		}
+
+		epoll_event events[16];
+		const auto count = epoll_wait(this->epoll_fd_, events, static_cast<int>(std::size(events)), -1);
+
+		for (int i = 0; i < count; ++i)
+		{
+			const auto fd = events[i].data.fd;
+			if (fd != this->timer_fd_)
+			{
+				this->dispatch(fd);
+				continue;
+			}
+
+			uint64_t expirations{};
+			if (read(this->timer_fd_, &expirations, sizeof(expirations)) == sizeof(expirations))
+			{
+				this->armed_time_ = clock::time_point::max();
+			}
+		}
+#else
+		int timeout = -1;
+		if (next_due)
+		{
+			// Round up, truncating would turn sub-millisecond deadlines into busy spins
+			const auto delay = std::chrono::ceil<std::chrono::milliseconds>(*next_due - clock::now());
+			timeout = static_cast<int>(std::max(delay.count(), static_cast<std::chrono::milliseconds::rep>(0)));
+		}
+
+		const auto count = poll(this->poll_fds_.data(), static_cast<uint32_t>(this->poll_fds_.size()), timeout);
+
+		if (count == SOCKET_ERROR)
+		{
+			std::this_thread::sleep_for(1ms);
+		}
+		else if (count > 0)
+		{
+			for (size_t i = 0; i < this->poll_fds_.size(); ++i)
+			{
+				const auto& poll_fd = this->poll_fds_.at(i);
+				if (poll_fd.revents & (POLLIN | POLLERR | POLLHUP))
+				{
+					this->dispatch(poll_fd.fd);
+				}
+			}
+		}
+#endif
+
+		this->run_timers();
+	}
+
+#ifdef __linux__
+	void reactor::arm_timer(const clock::time_point due)
+	{
+		if (due == this->armed_time_)
+		{
+			return;
+		}
+
+		const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(due.time_since_epoch()).count();
+
+		itimerspec spec{};
+		spec.it_value.tv_sec = static_cast<time_t>(nanoseconds / 1'000'000'000);
+		spec.it_value.tv_nsec = static_cast<long>(nanoseconds % 1'000'000'000);
+
+		// A zero value would disarm the timer instead of firing it
+		if (nanoseconds <= 0)
+		{
+			spec.it_value.tv_sec = 0;
+			spec.it_value.tv_nsec = 1;
+		}
+
+		if (timerfd_settime(this->timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) != 0)
+		{
+			console::warn("Failed to arm reactor timer: %d", errno);
+			return;
+		}
+
+		this->armed_time_ = due;
+	}
+#endif
+
+	std::optional<reactor::clock::time_point> reactor::get_next_due()
+	{
+		while (!this->timers_.empty())
+		{
+			const auto& next = this->timers_.top();
+			if (this->timer_handlers_.find(next.id) != this->timer_handlers_.end())
+			{
+				return next.due;
+			}
+
+			this->timers_.pop();
+		}
+
+		return {};
+	}
+
+	void reactor::run_timers()
+	{
+		const auto now = clock::now();
+
+		while (!this->timers_.empty())
+		{
+			const auto next = this->timers_.top();
+			if (next.due > now)
+			{
+				break;
+			}
+
+			this->timers_.pop();
+
+			const auto entry = this->timer_handlers_.find(next.id);
+			if (entry == this->timer_handlers_.end())
+			{
+				continue;
+			}
+
+			auto callback = std::move(entry->second);
+			this->timer_handlers_.erase(entry);
+
+			callback();
+		}
+	}
+
+	void reactor::dispatch(const SOCKET socket)
+	{
+		const auto entry = this->socket_handlers_.find(socket);
+		if (entry != this->socket_handlers_.end())
+		{
+			entry->second();
+		}
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "network/socket.hpp"
+#include <unordered_map>
+
+namespace network
+{
+	class reactor
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+		using handler = std::function<void()>;
+		using timer_id = uint64_t;
+
+		reactor();
+		~reactor();
+
+		reactor(const reactor& obj) = delete;
+		reactor& operator=(const reactor& obj) = delete;
+
+		reactor(reactor&& obj) = delete;
+		reactor& operator=(reactor&& obj) = delete;
+
+		// Handlers must not remove their own registration while being executed
+		void add_socket(const socket& socket, handler on_readable);
+		void add_socket(SOCKET socket, handler on_readable);
+		void remove_socket(const socket& socket);
+		void remove_socket(SOCKET socket);
+
+		timer_id add_timer(clock::time_point due, handler callback);
+		timer_id add_timer(clock::duration delay, handler callback);
+		void cancel_timer(timer_id id);
+
+		// Waits for the next readable socket or due timer and dispatches all pending events
+		void run_once();
+
+	private:
+		struct timer
+		{
+			clock::time_point due{};
+			timer_id id{};
+
+			bool operator>(const timer& obj) const
+			{
+				return this->due > obj.due;
+			}
+		};
+
+		timer_id next_timer_id_{0};
+		std::priority_queue<timer, std::vector<timer>, std::greater<>> timers_{};
+		std::unordered_map<timer_id, handler> timer_handlers_{};
+		std::unordered_map<SOCKET, handler> socket_handlers_{};
+
+#ifdef __linux__
+		int epoll_fd_{-1};
+		int timer_fd_{-1};
+		clock::time_point armed_time_{clock::time_point::max()};
+
+		void arm_timer(clock::time_point due);
+#else
+		std::vector<pollfd> poll_fds_{};
+#endif
+
+		std::optional<clock::time_point> get_next_due();
+		void run_timers();
+		void dispatch(SOCKET socket);
+	};
+}
@@ -0,0 +1,72 @@
+#include "std_include.hpp"
+
+#include "network/resolver.hpp"
+
+namespace network
+{
+	void resolver::resolve(const std::string& hostname, const clock::duration timeout)
+	{
+		auto entry = std::make_shared<request>();
+		entry->hostname = hostname;
+		entry->start = clock::now();
+		entry->deadline = entry->start + timeout;
+
+		// The thread owns a reference, a lookup that outlives the resolver writes into its own request
+		std::thread([entry]()
+		{
+			auto addresses = address::resolve_multiple(entry->hostname);
+
+			// getaddrinfo returns one entry per socket type
+			std::vector<address> unique{};
+			for (auto& address : addresses)
+			{
+				if (address.is_supported() && std::find(unique.begin(), unique.end(), address) == unique.end())
+				{
+					unique.emplace_back(std::move(address));
+				}
+			}
+
+			entry->addresses = std::move(unique);
+			entry->done.store(true, std::memory_order_release);
+		}).detach();
+
+		this->pending_.emplace_back(std::move(entry));
+	}
+
+	size_t resolver::poll(std::vector<result>& results, const clock::time_point now)
+	{
+		const auto previous = results.size();
+
+		for (auto i = this->pending_.begin(); i != this->pending_.end();)
+		{
+			auto& entry = **i;
+			const auto done = entry.done.load(std::memory_order_acquire);
+
+			if (!done && now < entry.deadline)
+			{
+				++i;
+				continue;
+			}
+
+			result value{};
+			value.hostname = entry.hostname;
+			value.duration = now - entry.start;
+			value.timed_out = !done;
+
+			if (done)
+			{
+				value.addresses = std::move(entry.addresses);
+			}
+
+			results.emplace_back(std::move(value));
+			i = this->pending_.erase(i);
+		}
+
+		return results.size() - previous;
+	}
+
+	size_t resolver::get_pending() const
+	{
+		return this->pending_.size();
+	}
+}
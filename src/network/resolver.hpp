@@ -0,0 +1,50 @@
+#pragma once
+
+#include "network/address.hpp"
+
+namespace network
+{
+	// Resolves hostnames on background threads, so a slow or missing DNS server never blocks the caller.
+	// getaddrinfo can't be cancelled: a lookup that misses its deadline is reported as timed out and
+	// its thread finishes on its own.
+	class resolver
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+		struct result
+		{
+			std::string hostname{};
+			std::vector<address> addresses{};
+			clock::duration duration{};
+			bool timed_out{};
+		};
+
+		resolver() = default;
+		~resolver() = default;
+
+		resolver(const resolver&) = delete;
+		resolver& operator=(const resolver&) = delete;
+
+		resolver(resolver&&) = delete;
+		resolver& operator=(resolver&&) = delete;
+
+		void resolve(const std::string& hostname, clock::duration timeout = std::chrono::seconds(5));
+
+		// Moves finished and timed out lookups into results, returns how many were added
+		size_t poll(std::vector<result>& results, clock::time_point now = clock::now());
+		size_t get_pending() const;
+
+	private:
+		struct request
+		{
+			std::string hostname{};
+			clock::time_point start{};
+			clock::time_point deadline{};
+			std::vector<address> addresses{};
+			std::atomic_bool done{false};
+		};
+
+		std::vector<std::shared_ptr<request>> pending_{};
+	};
+}
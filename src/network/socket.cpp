@@ -11,6 +11,114 @@
 
 namespace network
 {
+#ifdef __linux__
+	receive_metadata get_receive_metadata(const msghdr& header)
+	{
+		receive_metadata metadata{};
+
+		for (auto* message = CMSG_FIRSTHDR(&header); message; message = CMSG_NXTHDR(const_cast<msghdr*>(&header), message))
+		{
+			if (message->cmsg_level != SOL_SOCKET)
+			{
+				continue;
+			}
+
+			if (message->cmsg_type == SCM_TIMESTAMPNS)
+			{
+				timespec time{};
+				memcpy(&time, CMSG_DATA(message), sizeof(time));
+
+				const auto duration = std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+				metadata.timestamp = std::chrono::system_clock::time_point(
+					std::chrono::duration_cast<std::chrono::system_clock::duration>(duration));
+			}
+			else if (message->cmsg_type == SO_RXQ_OVFL)
+			{
+				uint32_t dropped{};
+				memcpy(&dropped, CMSG_DATA(message), sizeof(dropped));
+				metadata.dropped = dropped;
+			}
+		}
+
+		return metadata;
+	}
+#endif
+
+	packet_batch::packet_batch(const size_t capacity, const size_t packet_size)
+		: packet_size_(packet_size)
+	{
+		this->buffer_.resize(capacity * packet_size);
+		this->packets_.resize(capacity);
+
+#ifdef __linux__
+		this->vectors_.resize(capacity);
+		this->headers_.resize(capacity);
+		this->control_.resize(capacity * receive_control_size);
+#endif
+	}
+
+	bool packet_batch::push(const endpoint& target, const std::string_view data)
+	{
+		if (this->full() || data.size() > this->packet_size_)
+		{
+			return false;
+		}
+
+		auto* buffer = this->get_packet_buffer(this->size_);
+		memcpy(buffer, data.data(), data.size());
+
+		auto& packet = this->packets_.at(this->size_++);
+		packet.address.set_address(&target.get_addr(), target.get_size());
+		packet.data = std::string_view{buffer, data.size()};
+
+		return true;
+	}
+
+	void packet_batch::clear()
+	{
+		this->size_ = 0;
+	}
+
+	size_t packet_batch::size() const
+	{
+		return this->size_;
+	}
+
+	size_t packet_batch::capacity() const
+	{
+		return this->packets_.size();
+	}
+
+	size_t packet_batch::packet_size() const
+	{
+		return this->packet_size_;
+	}
+
+	bool packet_batch::empty() const
+	{
+		return this->size_ == 0;
+	}
+
+	bool packet_batch::full() const
+	{
+		return this->size_ >= this->capacity();
+	}
+
+	const packet* packet_batch::begin() const
+	{
+		return this->packets_.data();
+	}
+
+	const packet* packet_batch::end() const
+	{
+		return this->packets_.data() + this->size_;
+	}
+
+	char* packet_batch::get_packet_buffer(const size_t index)
+	{
+		return this->buffer_.data() + (index * this->packet_size_);
+	}
+
 	socket::socket(const int af)
 	{
 		initialize_wsa();
@@ -46,6 +154,7 @@ namespace network
 		{
 			this->~socket();
 			this->socket_ = obj.socket_;
+			this->dropped_ = obj.dropped_.load();
 			obj.socket_ = INVALID_SOCKET;
 		}
 
@@ -63,19 +172,75 @@ namespace network
 		return result;
 	}
 
-	bool socket::send(const address& target, const std::string& data) const
+	bool socket::send(const endpoint& target, const std::string_view data) const
 	{
 		const int res = sendto(this->socket_, data.data(), static_cast<int>(data.size()), 0, &target.get_addr(),
 		                       target.get_size());
 		if (res == SOCKET_ERROR)
 		{
 			const int error = GET_SOCKET_ERROR();
-			console::warn("Sendto error: %s %d (%d)", target.to_string().data(), error, target.get_addr().sa_family);
+			console::warn("Sendto error: %s %d (%d)", target.to_address().to_string().data(), error,
+			              target.get_addr().sa_family);
 		}
 
 		return res == static_cast<int>(data.size());
 	}
 
+	size_t socket::send_batch(packet_batch& batch) const
+	{
+		size_t sent = 0;
+
+#ifdef __linux__
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			auto& packet = batch.packets_.at(i);
+			auto& vector = batch.vectors_.at(i);
+			auto& header = batch.headers_.at(i).msg_hdr;
+
+			vector.iov_base = const_cast<char*>(packet.data.data());
+			vector.iov_len = packet.data.size();
+
+			header = {};
+			header.msg_name = &packet.address.get_addr();
+			header.msg_namelen = static_cast<socklen_t>(packet.address.get_size());
+			header.msg_iov = &vector;
+			header.msg_iovlen = 1;
+		}
+
+		size_t offset = 0;
+		while (offset < batch.size())
+		{
+			const auto result = sendmmsg(this->socket_, batch.headers_.data() + offset,
+			                             static_cast<unsigned int>(batch.size() - offset), 0);
+			if (result == SOCKET_ERROR)
+			{
+				// Skip the packet that failed, just like a failed sendto would drop it
+				const auto& target = batch.packets_.at(offset).address;
+				const int error = GET_SOCKET_ERROR();
+				console::warn("Sendmmsg error: %s %d (%d)", target.to_string().data(), error,
+				              target.get_addr().sa_family);
+
+				++offset;
+				continue;
+			}
+
+			offset += static_cast<size_t>(result);
+			sent += static_cast<size_t>(result);
+		}
+#else
+		for (const auto& packet : batch)
+		{
+			if (this->send(packet.address, packet.data))
+			{
+				++sent;
+			}
+		}
+#endif
+
+		batch.clear();
+		return sent;
+	}
+
 	bool socket::receive(address& source, std::string& data) const
 	{
 		char buffer[0x2000];
@@ -99,6 +264,92 @@ namespace network
 		return true;
 	}
 
+	bool socket::receive_batch(packet_batch& batch) const
+	{
+		batch.size_ = 0;
+
+#ifdef __linux__
+		for (size_t i = 0; i < batch.capacity(); ++i)
+		{
+			auto& source = batch.packets_.at(i).address;
+			auto& vector = batch.vectors_.at(i);
+			auto& header = batch.headers_.at(i).msg_hdr;
+
+			vector.iov_base = batch.get_packet_buffer(i);
+			vector.iov_len = batch.packet_size_;
+
+			header = {};
+			header.msg_name = &source.get_addr();
+			header.msg_namelen = static_cast<socklen_t>(source.get_max_size());
+			header.msg_iov = &vector;
+			header.msg_iovlen = 1;
+			header.msg_control = batch.control_.data() + (i * receive_control_size);
+			header.msg_controllen = receive_control_size;
+		}
+
+		const auto result = recvmmsg(this->socket_, batch.headers_.data(), static_cast<unsigned int>(batch.capacity()),
+		                             0, nullptr);
+		if (result == SOCKET_ERROR)
+		{
+#ifndef NDEBUG
+			const auto error = GET_SOCKET_ERROR();
+			if (error != EWOULDBLOCK)
+			{
+				console::warn("Receive failed with error: %d", error);
+			}
+#endif
+
+			return false;
+		}
+
+		batch.size_ = static_cast<size_t>(result);
+		const auto now = std::chrono::system_clock::now();
+
+		for (size_t i = 0; i < batch.size_; ++i)
+		{
+			const auto& header = batch.headers_.at(i);
+			const auto metadata = get_receive_metadata(header.msg_hdr);
+
+			auto& packet = batch.packets_.at(i);
+			packet.data = std::string_view{batch.get_packet_buffer(i), header.msg_len};
+			packet.timestamp = metadata.timestamp.time_since_epoch().count() ? metadata.timestamp : now;
+
+			if (metadata.dropped)
+			{
+				this->update_dropped(*metadata.dropped);
+			}
+		}
+#else
+		while (batch.size_ < batch.capacity())
+		{
+			auto& packet = batch.packets_.at(batch.size_);
+			auto* buffer = batch.get_packet_buffer(batch.size_);
+			socklen_t len = packet.address.get_max_size();
+
+			const auto result = recvfrom(this->socket_, buffer, static_cast<int>(batch.packet_size_), 0,
+			                             &packet.address.get_addr(), &len);
+			if (result == SOCKET_ERROR)
+			{
+#ifndef NDEBUG
+				const auto error = GET_SOCKET_ERROR();
+				if (error != EWOULDBLOCK)
+				{
+					console::warn("Receive failed with error: %d", error);
+				}
+#endif
+
+				break;
+			}
+
+			packet.data = std::string_view{buffer, static_cast<size_t>(result)};
+			packet.timestamp = std::chrono::system_clock::now();
+			++batch.size_;
+		}
+#endif
+
+		return !batch.empty();
+	}
+
 	bool socket::set_blocking(const bool blocking)
 	{
 #ifdef _WIN32
@@ -112,6 +363,62 @@ namespace network
 #endif
 	}
 
+	bool socket::set_timestamping(const bool enabled)
+	{
+#ifdef SO_TIMESTAMPNS
+		int value = enabled ? 1 : 0;
+		return setsockopt(this->socket_, SOL_SOCKET, SO_TIMESTAMPNS, reinterpret_cast<char*>(&value), sizeof(value)) == 0;
+#else
+		return !enabled;
+#endif
+	}
+
+	bool socket::set_drop_accounting(const bool enabled)
+	{
+#ifdef SO_RXQ_OVFL
+		int value = enabled ? 1 : 0;
+		return setsockopt(this->socket_, SOL_SOCKET, SO_RXQ_OVFL, reinterpret_cast<char*>(&value), sizeof(value)) == 0;
+#else
+		return !enabled;
+#endif
+	}
+
+	bool socket::set_receive_buffer_size(const int size)
+	{
+		return setsockopt(this->socket_, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&size), sizeof(size)) == 0;
+	}
+
+	bool socket::set_send_buffer_size(const int size)
+	{
+		return setsockopt(this->socket_, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&size), sizeof(size)) == 0;
+	}
+
+	int socket::get_receive_buffer_size() const
+	{
+		int size = 0;
+		socklen_t length = sizeof(size);
+		getsockopt(this->socket_, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<char*>(&size), &length);
+		return size;
+	}
+
+	int socket::get_send_buffer_size() const
+	{
+		int size = 0;
+		socklen_t length = sizeof(size);
+		getsockopt(this->socket_, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<char*>(&size), &length);
+		return size;
+	}
+
+	uint32_t socket::get_dropped() const
+	{
+		return this->dropped_.load(std::memory_order_relaxed);
+	}
+
+	void socket::update_dropped(const uint32_t dropped) const
+	{
+		this->dropped_.store(dropped, std::memory_order_relaxed);
+	}
+
 	bool socket::sleep(const std::chrono::milliseconds timeout) const
 	{
 		/*fd_set fdr;
@@ -147,7 +454,7 @@ namespace network
 	bool socket::sleep_until(const std::chrono::high_resolution_clock::time_point time_point) const
 	{
 		const auto duration = time_point - std::chrono::high_resolution_clock::now();
-		return this->sleep(std::chrono::duration_cast<std::chrono::milliseconds>(duration));
+		return this->sleep(std::chrono::ceil<std::chrono::milliseconds>(duration));
 	}
 
 	SOCKET socket::get_socket() const
@@ -195,6 +502,6 @@ namespace network
 	                                 const std::chrono::high_resolution_clock::time_point time_point)
 	{
 		const auto duration = time_point - std::chrono::high_resolution_clock::now();
-		return sleep_sockets(sockets, std::chrono::duration_cast<std::chrono::milliseconds>(duration));
+		return sleep_sockets(sockets, std::chrono::ceil<std::chrono::milliseconds>(duration));
 	}
 }
@@ -14,6 +14,67 @@ using socklen_t = int;
 
 namespace network
 {
+	struct packet
+	{
+		network::address address{};
+		std::string_view data{};
+		// Kernel receive time if timestamping is enabled, otherwise the time the batch was read
+		std::chrono::system_clock::time_point timestamp{};
+	};
+
+#ifdef __linux__
+	constexpr size_t receive_control_size = CMSG_SPACE(sizeof(timespec)) + CMSG_SPACE(sizeof(uint32_t));
+
+	struct receive_metadata
+	{
+		// Empty if the SO_TIMESTAMPNS control message is missing
+		std::chrono::system_clock::time_point timestamp{};
+		// Total packets the kernel dropped on the socket, from SO_RXQ_OVFL
+		std::optional<uint32_t> dropped{};
+	};
+
+	receive_metadata get_receive_metadata(const msghdr& header);
+#endif
+
+	class packet_batch
+	{
+	public:
+		packet_batch(size_t capacity = 64, size_t packet_size = 0x2000);
+
+		packet_batch(const packet_batch& obj) = delete;
+		packet_batch& operator=(const packet_batch& obj) = delete;
+
+		bool push(const endpoint& target, std::string_view data);
+		void clear();
+
+		size_t size() const;
+		size_t capacity() const;
+		size_t packet_size() const;
+		bool empty() const;
+		bool full() const;
+
+		const packet* begin() const;
+		const packet* end() const;
+
+	private:
+		friend class socket;
+		friend class uring_backend;
+
+		size_t size_ = 0;
+		size_t packet_size_ = 0;
+
+		std::vector<char> buffer_{};
+		std::vector<packet> packets_{};
+
+#ifdef __linux__
+		std::vector<iovec> vectors_{};
+		std::vector<mmsghdr> headers_{};
+		std::vector<char> control_{};
+#endif
+
+		char* get_packet_buffer(size_t index);
+	};
+
 	class socket
 	{
 	public:
@@ -28,10 +89,24 @@ namespace network
 
 		bool bind(const address& target);
 
-		[[maybe_unused]] bool send(const address& target, const std::string& data) const;
+		[[maybe_unused]] bool send(const endpoint& target, std::string_view data) const;
+		size_t send_batch(packet_batch& batch) const;
 		bool receive(address& source, std::string& data) const;
+		bool receive_batch(packet_batch& batch) const;
 
 		bool set_blocking(bool blocking);
+		// Attaches kernel receive timestamps to received packets (Linux only)
+		bool set_timestamping(bool enabled);
+		// Tracks packets the kernel dropped because the receive buffer was full (Linux only)
+		bool set_drop_accounting(bool enabled);
+
+		bool set_receive_buffer_size(int size);
+		bool set_send_buffer_size(int size);
+		int get_receive_buffer_size() const;
+		int get_send_buffer_size() const;
+
+		// Last drop counter reported by the kernel
+		uint32_t get_dropped() const;
 
 		static const bool socket_is_ready = true;
 		bool sleep(std::chrono::milliseconds timeout) const;
@@ -45,7 +120,12 @@ namespace network
 		                                std::chrono::high_resolution_clock::time_point time_point);
 
 	private:
+		friend class uring_backend;
+
 		uint16_t port_ = 0;
 		SOCKET socket_ = INVALID_SOCKET;
+		mutable std::atomic<uint32_t> dropped_{0};
+
+		void update_dropped(uint32_t dropped) const;
 	};
 }
@@ -0,0 +1,672 @@
+#include "std_include.hpp"
+
+#include "network/uring_backend.hpp"
+
+#include "console.hpp"
+#include "utils/finally.hpp"
+
+#ifdef __linux__
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef IORING_RECV_MULTISHOT
+#define HAS_IO_URING
+#endif
+#endif
+#endif
+
+namespace network
+{
+#ifdef HAS_IO_URING
+	namespace
+	{
+		constexpr uint16_t buffer_group = 0;
+
+		int io_uring_setup(const uint32_t entries, io_uring_params* params)
+		{
+			return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+		}
+
+		int io_uring_enter(const int fd, const uint32_t to_submit, const uint32_t min_complete, const uint32_t flags)
+		{
+			return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+		}
+
+		int io_uring_register(const int fd, const uint32_t opcode, const void* arg, const uint32_t count)
+		{
+			return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+		}
+
+		class ring
+		{
+		public:
+			ring(const uint32_t entries, const uint32_t completion_entries)
+			{
+				auto cleanup = utils::finally([this]()
+				{
+					this->destroy();
+				});
+
+				io_uring_params params{};
+				params.flags = IORING_SETUP_CQSIZE;
+				params.cq_entries = completion_entries;
+
+				this->fd_ = io_uring_setup(entries, &params);
+				if (this->fd_ < 0)
+				{
+					throw std::runtime_error("io_uring_setup failed with error " + std::to_string(errno));
+				}
+
+				this->sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+				this->cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+				const auto single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+				if (single_mmap)
+				{
+					this->sq_ring_size_ = std::max(this->sq_ring_size_, this->cq_ring_size_);
+					this->cq_ring_size_ = 0;
+				}
+
+				this->sq_ring_ = this->map(this->sq_ring_size_, IORING_OFF_SQ_RING);
+				this->cq_ring_ = single_mmap ? this->sq_ring_ : this->map(this->cq_ring_size_, IORING_OFF_CQ_RING);
+
+				this->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+				this->sqes_ = static_cast<io_uring_sqe*>(this->map(this->sqes_size_, IORING_OFF_SQES));
+
+				auto* sq = static_cast<uint8_t*>(this->sq_ring_);
+				this->sq_head_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+				this->sq_tail_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+				this->sq_flags_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.flags);
+				this->sq_mask_ = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+				this->sq_entries_ = params.sq_entries;
+
+				// Submission slots map 1:1 to the sqe array, so the indirection table never changes
+				auto* array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+				for (uint32_t i = 0; i < params.sq_entries; ++i)
+				{
+					array[i] = i;
+				}
+
+				auto* cq = static_cast<uint8_t*>(this->cq_ring_);
+				this->cq_head_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+				this->cq_tail_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+				this->cq_mask_ = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+				this->cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+				this->local_tail_ = *this->sq_tail_;
+
+				cleanup.cancel();
+			}
+
+			~ring()
+			{
+				this->destroy();
+			}
+
+			ring(const ring& obj) = delete;
+			ring& operator=(const ring& obj) = delete;
+
+			int get_fd() const
+			{
+				return this->fd_;
+			}
+
+			io_uring_sqe* get_sqe()
+			{
+				const auto head = __atomic_load_n(this->sq_head_, __ATOMIC_ACQUIRE);
+				if ((this->local_tail_ - head) >= this->sq_entries_)
+				{
+					return nullptr;
+				}
+
+				auto* sqe = &this->sqes_[this->local_tail_ & this->sq_mask_];
+				memset(sqe, 0, sizeof(*sqe));
+
+				++this->local_tail_;
+				return sqe;
+			}
+
+			bool submit(const uint32_t wait_for = 0)
+			{
+				__atomic_store_n(this->sq_tail_, this->local_tail_, __ATOMIC_RELEASE);
+
+				const auto pending = this->local_tail_ - __atomic_load_n(this->sq_head_, __ATOMIC_ACQUIRE);
+				if (!pending && !wait_for)
+				{
+					return true;
+				}
+
+				while (true)
+				{
+					const auto result = io_uring_enter(this->fd_, pending, wait_for,
+					                                   wait_for ? IORING_ENTER_GETEVENTS : 0);
+					if (result >= 0)
+					{
+						return true;
+					}
+
+					if (errno != EINTR)
+					{
+						return false;
+					}
+				}
+			}
+
+			// Takes back submissions the kernel has not consumed yet. Without SQPOLL the kernel
+			// only reads the queue inside io_uring_enter, so rewinding the tail is safe.
+			uint32_t withdraw()
+			{
+				const auto head = __atomic_load_n(this->sq_head_, __ATOMIC_ACQUIRE);
+				const auto withdrawn = this->local_tail_ - head;
+
+				this->local_tail_ = head;
+				__atomic_store_n(this->sq_tail_, head, __ATOMIC_RELEASE);
+
+				return withdrawn;
+			}
+
+			const io_uring_cqe* peek_completion() const
+			{
+				const auto head = *this->cq_head_;
+				auto tail = __atomic_load_n(this->cq_tail_, __ATOMIC_ACQUIRE);
+
+				// Completions that did not fit into the ring are only moved over by entering the kernel
+				if (head == tail && (__atomic_load_n(this->sq_flags_, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW))
+				{
+					io_uring_enter(this->fd_, 0, 0, IORING_ENTER_GETEVENTS);
+					tail = __atomic_load_n(this->cq_tail_, __ATOMIC_ACQUIRE);
+				}
+
+				if (head == tail)
+				{
+					return nullptr;
+				}
+
+				return &this->cqes_[head & this->cq_mask_];
+			}
+
+			bool pop_completion(io_uring_cqe& cqe)
+			{
+				const auto* entry = this->peek_completion();
+				if (!entry)
+				{
+					return false;
+				}
+
+				cqe.user_data = entry->user_data;
+				cqe.res = entry->res;
+				cqe.flags = entry->flags;
+
+				__atomic_store_n(this->cq_head_, *this->cq_head_ + 1, __ATOMIC_RELEASE);
+				return true;
+			}
+
+		private:
+			int fd_{-1};
+
+			void* sq_ring_{};
+			void* cq_ring_{};
+			size_t sq_ring_size_{};
+			size_t cq_ring_size_{};
+
+			io_uring_sqe* sqes_{};
+			size_t sqes_size_{};
+
+			uint32_t* sq_head_{};
+			uint32_t* sq_tail_{};
+			uint32_t* sq_flags_{};
+			uint32_t sq_mask_{};
+			uint32_t sq_entries_{};
+			uint32_t local_tail_{};
+
+			uint32_t* cq_head_{};
+			uint32_t* cq_tail_{};
+			uint32_t cq_mask_{};
+			io_uring_cqe* cqes_{};
+
+			void* map(const size_t size, const uint64_t offset) const
+			{
+				auto* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd_,
+				                  static_cast<off_t>(offset));
+				if (data == MAP_FAILED)
+				{
+					throw std::runtime_error("Failed to map io_uring memory");
+				}
+
+				return data;
+			}
+
+			void destroy()
+			{
+				if (this->sqes_)
+				{
+					munmap(this->sqes_, this->sqes_size_);
+					this->sqes_ = nullptr;
+				}
+
+				if (this->cq_ring_ && this->cq_ring_ != this->sq_ring_)
+				{
+					munmap(this->cq_ring_, this->cq_ring_size_);
+				}
+
+				this->cq_ring_ = nullptr;
+
+				if (this->sq_ring_)
+				{
+					munmap(this->sq_ring_, this->sq_ring_size_);
+					this->sq_ring_ = nullptr;
+				}
+
+				if (this->fd_ >= 0)
+				{
+					close(this->fd_);
+					this->fd_ = -1;
+				}
+			}
+		};
+	}
+
+	struct uring_backend::state
+	{
+		ring receive_ring;
+		ring send_ring{256, 1024};
+
+		io_uring_buf_ring* buffer_ring{};
+		size_t buffer_ring_size{};
+		uint32_t buffer_count{};
+		size_t slot_size{};
+		uint16_t buffer_tail{};
+
+		std::vector<char> buffers{};
+		std::vector<uint16_t> lent_buffers{};
+
+		msghdr receive_header{};
+		bool receive_armed{false};
+
+		std::vector<msghdr> send_headers{};
+		std::vector<iovec> send_vectors{};
+		// Tags the user data of every send, completions of an earlier batch never index the current one
+		uint32_t send_generation{};
+
+		// Every buffer produces one completion, size the queue so that none of them overflow
+		state(const uint32_t count, const uint32_t buffer_size)
+			: receive_ring(16, count * 2)
+			  , buffer_count(count)
+		{
+			if (!count || count > 0x8000 || (count & (count - 1)) != 0)
+			{
+				throw std::runtime_error("io_uring buffer count must be a power of two");
+			}
+
+			this->receive_header.msg_namelen = sizeof(sockaddr_storage);
+			this->receive_header.msg_controllen = receive_control_size;
+
+			// Multishot recvmsg prefixes every buffer with a header, the source address and control messages
+			this->slot_size = sizeof(io_uring_recvmsg_out) + this->receive_header.msg_namelen +
+				this->receive_header.msg_controllen + buffer_size;
+			this->buffers.resize(this->slot_size * count);
+			this->lent_buffers.reserve(count);
+
+			this->buffer_ring_size = count * sizeof(io_uring_buf);
+			auto* memory = mmap(nullptr, this->buffer_ring_size, PROT_READ | PROT_WRITE,
+			                    MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+			if (memory == MAP_FAILED)
+			{
+				throw std::runtime_error("Failed to allocate io_uring buffer ring");
+			}
+
+			this->buffer_ring = static_cast<io_uring_buf_ring*>(memory);
+
+			io_uring_buf_reg registration{};
+			registration.ring_addr = reinterpret_cast<uint64_t>(this->buffer_ring);
+			registration.ring_entries = count;
+			registration.bgid = buffer_group;
+
+			if (io_uring_register(this->receive_ring.get_fd(), IORING_REGISTER_PBUF_RING, &registration, 1) != 0)
+			{
+				munmap(this->buffer_ring, this->buffer_ring_size);
+				throw std::runtime_error("Kernel does not support io_uring buffer rings");
+			}
+
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				this->add_buffer(static_cast<uint16_t>(i));
+			}
+
+			this->publish_buffers();
+		}
+
+		~state()
+		{
+			io_uring_buf_reg registration{};
+			registration.bgid = buffer_group;
+			io_uring_register(this->receive_ring.get_fd(), IORING_UNREGISTER_PBUF_RING, &registration, 1);
+
+			munmap(this->buffer_ring, this->buffer_ring_size);
+		}
+
+		state(const state& obj) = delete;
+		state& operator=(const state& obj) = delete;
+
+		char* get_buffer(const uint16_t id)
+		{
+			return this->buffers.data() + (static_cast<size_t>(id) * this->slot_size);
+		}
+
+		void add_buffer(const uint16_t id)
+		{
+			// The flexible bufs member of io_uring_buf_ring has a different offset in C++, index the entries directly
+			auto* entries = reinterpret_cast<io_uring_buf*>(this->buffer_ring);
+			auto& buffer = entries[this->buffer_tail & (this->buffer_count - 1)];
+			buffer.addr = reinterpret_cast<uint64_t>(this->get_buffer(id));
+			buffer.len = static_cast<uint32_t>(this->slot_size);
+			buffer.bid = id;
+
+			++this->buffer_tail;
+		}
+
+		void publish_buffers()
+		{
+			__atomic_store_n(&this->buffer_ring->tail, this->buffer_tail, __ATOMIC_RELEASE);
+		}
+
+		void recycle_buffers()
+		{
+			if (this->lent_buffers.empty())
+			{
+				return;
+			}
+
+			for (const auto id : this->lent_buffers)
+			{
+				this->add_buffer(id);
+			}
+
+			this->lent_buffers.clear();
+			this->publish_buffers();
+		}
+
+		bool arm_receive(const SOCKET socket)
+		{
+			auto* sqe = this->receive_ring.get_sqe();
+			if (!sqe)
+			{
+				return false;
+			}
+
+			sqe->opcode = IORING_OP_RECVMSG;
+			sqe->fd = socket;
+			sqe->addr = reinterpret_cast<uint64_t>(&this->receive_header);
+			sqe->len = 1;
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = buffer_group;
+
+			this->receive_armed = true;
+			return true;
+		}
+	};
+
+	uring_backend::uring_backend(const socket& socket, const uint32_t buffer_count, const uint32_t buffer_size)
+		: socket_(&socket)
+		  , state_(std::make_unique<state>(buffer_count, buffer_size))
+	{
+		auto& state = *this->state_;
+		if (!state.arm_receive(socket.get_socket()) || !state.receive_ring.submit())
+		{
+			throw std::runtime_error("Failed to submit io_uring receive");
+		}
+
+		// Kernels without multishot recvmsg reject the request right away
+		const auto* completion = state.receive_ring.peek_completion();
+		if (completion && completion->res == -EINVAL)
+		{
+			throw std::runtime_error("Kernel does not support multishot recvmsg");
+		}
+	}
+
+	uring_backend::~uring_backend() = default;
+
+	bool uring_backend::receive_batch(packet_batch& batch)
+	{
+		auto& state = *this->state_;
+
+		batch.size_ = 0;
+		state.recycle_buffers();
+
+		const auto now = std::chrono::system_clock::now();
+
+		io_uring_cqe cqe{};
+		while (!batch.full() && state.receive_ring.pop_completion(cqe))
+		{
+			if (!(cqe.flags & IORING_CQE_F_MORE))
+			{
+				state.receive_armed = false;
+			}
+
+			if (cqe.res < 0)
+			{
+				if (cqe.res != -ENOBUFS)
+				{
+					console::warn("io_uring receive failed with error: %d", -cqe.res);
+				}
+
+				continue;
+			}
+
+			if (!(cqe.flags & IORING_CQE_F_BUFFER))
+			{
+				continue;
+			}
+
+			const auto id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+			state.lent_buffers.push_back(id);
+
+			auto* buffer = state.get_buffer(id);
+			const auto* out = reinterpret_cast<const io_uring_recvmsg_out*>(buffer);
+			if (out->namelen > state.receive_header.msg_namelen)
+			{
+				continue;
+			}
+
+			const auto* name = reinterpret_cast<const sockaddr*>(buffer + sizeof(*out));
+			auto* payload = buffer + sizeof(*out) + state.receive_header.msg_namelen + state.receive_header.
+				msg_controllen;
+
+			const auto available = state.slot_size - static_cast<size_t>(payload - buffer);
+			const auto length = std::min(static_cast<size_t>(out->payloadlen), available);
+
+			msghdr control{};
+			control.msg_control = buffer + sizeof(*out) + state.receive_header.msg_namelen;
+			control.msg_controllen = std::min(static_cast<size_t>(out->controllen), receive_control_size);
+			const auto metadata = get_receive_metadata(control);
+
+			auto& packet = batch.packets_.at(batch.size_++);
+			packet.address.set_address(name, static_cast<int>(out->namelen));
+			packet.data = std::string_view{payload, length};
+			packet.timestamp = metadata.timestamp.time_since_epoch().count() ? metadata.timestamp : now;
+
+			if (metadata.dropped)
+			{
+				this->socket_->update_dropped(*metadata.dropped);
+			}
+		}
+
+		if (!state.receive_armed)
+		{
+			state.arm_receive(this->socket_->get_socket());
+		}
+
+		state.receive_ring.submit();
+		return !batch.empty();
+	}
+
+	size_t uring_backend::send_batch(packet_batch& batch)
+	{
+		auto& state = *this->state_;
+
+		if (state.send_headers.size() < batch.size())
+		{
+			state.send_headers.resize(batch.capacity());
+			state.send_vectors.resize(batch.capacity());
+		}
+
+		size_t sent = 0;
+		uint32_t in_flight = 0;
+		const auto generation = ++state.send_generation;
+
+		// Payloads live in the batch, so every submission has to complete before it is cleared
+		const auto complete = [&]()
+		{
+			if (!in_flight)
+			{
+				return;
+			}
+
+			if (!state.send_ring.submit(in_flight))
+			{
+				// What the kernel did not pick up must not be picked up once the batch is gone
+				in_flight -= state.send_ring.withdraw();
+			}
+
+			io_uring_cqe cqe{};
+			auto reported = false;
+			while (in_flight > 0)
+			{
+				if (!state.send_ring.pop_completion(cqe))
+				{
+					if (state.send_ring.submit(1))
+					{
+						continue;
+					}
+
+					const auto error = errno;
+					in_flight -= state.send_ring.withdraw();
+
+					// Consumed sends may still read the batch, so failing to wait only means waiting again
+					if (in_flight)
+					{
+						if (!reported)
+						{
+							console::error("Failed to wait for io_uring sends, retrying: %d", error);
+							reported = true;
+						}
+
+						std::this_thread::sleep_for(1ms);
+					}
+
+					continue;
+				}
+
+				if (static_cast<uint32_t>(cqe.user_data >> 32) != generation)
+				{
+					continue;
+				}
+
+				--in_flight;
+
+				if (cqe.res >= 0)
+				{
+					++sent;
+					continue;
+				}
+
+				const auto index = static_cast<uint32_t>(cqe.user_data);
+				if (index >= batch.size())
+				{
+					continue;
+				}
+
+				const auto& target = batch.packets_[index].address;
+				console::warn("Sendmsg error: %s %d (%d)", target.to_string().data(), -cqe.res,
+				              target.get_addr().sa_family);
+			}
+		};
+
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			auto* sqe = state.send_ring.get_sqe();
+			if (!sqe)
+			{
+				complete();
+				sqe = state.send_ring.get_sqe();
+			}
+
+			if (!sqe)
+			{
+				break;
+			}
+
+			auto& packet = batch.packets_.at(i);
+			auto& vector = state.send_vectors.at(i);
+			auto& header = state.send_headers.at(i);
+
+			vector.iov_base = const_cast<char*>(packet.data.data());
+			vector.iov_len = packet.data.size();
+
+			header = {};
+			header.msg_name = &packet.address.get_addr();
+			header.msg_namelen = static_cast<socklen_t>(packet.address.get_size());
+			header.msg_iov = &vector;
+			header.msg_iovlen = 1;
+
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = this->socket_->get_socket();
+			sqe->addr = reinterpret_cast<uint64_t>(&header);
+			sqe->len = 1;
+			sqe->user_data = (static_cast<uint64_t>(generation) << 32) | i;
+
+			++in_flight;
+		}
+
+		complete();
+
+		batch.clear();
+		return sent;
+	}
+
+	SOCKET uring_backend::get_descriptor() const
+	{
+		return this->state_->receive_ring.get_fd();
+	}
+#else
+	struct uring_backend::state
+	{
+	};
+
+	uring_backend::uring_backend(const socket& socket, const uint32_t /*buffer_count*/,
+	                             const uint32_t /*buffer_size*/)
+		: socket_(&socket)
+	{
+		throw std::runtime_error("io_uring is not supported on this platform");
+	}
+
+	uring_backend::~uring_backend() = default;
+
+	bool uring_backend::receive_batch(packet_batch& batch)
+	{
+		return this->socket_->receive_batch(batch);
+	}
+
+	size_t uring_backend::send_batch(packet_batch& batch)
+	{
+		return this->socket_->send_batch(batch);
+	}
+
+	SOCKET uring_backend::get_descriptor() const
+	{
+		return this->socket_->get_socket();
+	}
+#endif
+
+	bool uring_backend::send(const endpoint& target, const std::string_view data)
+	{
+		return this->socket_->send(target, data);
+	}
+
+	io_backend_type uring_backend::get_type() const
+	{
+		return io_backend_type::io_uring;
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "network/io_backend.hpp"
+
+namespace network
+{
+	// Linux only, the constructor throws if the kernel lacks
+	// buffer rings or multishot recvmsg (Linux 6.0 and later)
+	class uring_backend : public io_backend
+	{
+	public:
+		uring_backend(const socket& socket, uint32_t buffer_count = 256, uint32_t buffer_size = 0x2000);
+		~uring_backend() override;
+
+		uring_backend(const uring_backend& obj) = delete;
+		uring_backend& operator=(const uring_backend& obj) = delete;
+
+		uring_backend(uring_backend&& obj) = delete;
+		uring_backend& operator=(uring_backend&& obj) = delete;
+
+		bool receive_batch(packet_batch& batch) override;
+		size_t send_batch(packet_batch& batch) override;
+		bool send(const endpoint& target, std::string_view data) override;
+
+		SOCKET get_descriptor() const override;
+		io_backend_type get_type() const override;
+
+	private:
+		struct state;
+
+		const socket* socket_{};
+		std::unique_ptr<state> state_{};
+	};
+}
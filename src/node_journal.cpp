@@ -0,0 +1,257 @@
+#include "std_include.hpp"
+#include "node_journal.hpp"
+
+#include "console.hpp"
+#include "utils/io.hpp"
+
+node_journal::node_journal(std::string store_file, const routing_table::id& id, const uint64_t generation,
+                           const size_t valid_size)
+	: store_file_(std::move(store_file))
+	  , file_(get_file(this->store_file_))
+	  , id_(id)
+	  , generation_(generation)
+{
+	if (!valid_size)
+	{
+		this->reset();
+	}
+	else if (utils::io::file_size(this->file_) != valid_size)
+	{
+		// Appending behind a torn record would hide everything written afterwards
+		std::error_code error{};
+		std::filesystem::resize_file(this->file_, valid_size, error);
+
+		if (error)
+		{
+			console::warn("Failed to truncate journal %s: %s", this->file_.data(), error.message().data());
+			this->reset();
+		}
+	}
+
+	this->thread_ = std::thread([this]()
+	{
+		this->run();
+	});
+}
+
+node_journal::~node_journal()
+{
+	this->state_.access([](state& state)
+	{
+		state.stop = true;
+	});
+
+	this->work_.notify_all();
+
+	if (this->thread_.joinable())
+	{
+		this->thread_.join();
+	}
+}
+
+std::string node_journal::get_file(const std::string& store_file)
+{
+	return store_file + ".journal";
+}
+
+void node_journal::append(std::vector<node_store::change_record> records)
+{
+	if (records.empty())
+	{
+		return;
+	}
+
+	this->state_.access([&](state& state)
+	{
+		state.pending.push_back({std::move(records), std::nullopt});
+	});
+
+	this->work_.notify_one();
+}
+
+void node_journal::compact(node_store::snapshot snapshot)
+{
+	this->state_.access([&](state& state)
+	{
+		state.pending.push_back({{}, std::move(snapshot)});
+	});
+
+	this->work_.notify_one();
+}
+
+void node_journal::flush()
+{
+	this->state_.access_with_lock([this](state& state, std::unique_lock<std::mutex>& lock)
+	{
+		this->idle_.wait(lock, [&state]()
+		{
+			return state.pending.empty() && !state.writing;
+		});
+	});
+}
+
+node_journal::statistics node_journal::get_statistics() const
+{
+	return this->state_.access<statistics>([](const state& state)
+	{
+		return state.totals;
+	});
+}
+
+void node_journal::run()
+{
+	while (true)
+	{
+		std::vector<job> jobs{};
+
+		const auto stop = this->state_.access_with_lock<bool>(
+			[this, &jobs](state& state, std::unique_lock<std::mutex>& lock)
+			{
+				this->work_.wait(lock, [&state]()
+				{
+					return state.stop || !state.pending.empty();
+				});
+
+				jobs.assign(std::make_move_iterator(state.pending.begin()),
+				            std::make_move_iterator(state.pending.end()));
+				state.pending.clear();
+				state.writing = !jobs.empty();
+
+				return state.stop && jobs.empty();
+			});
+
+		if (stop)
+		{
+			return;
+		}
+
+		this->commit(jobs);
+
+		this->state_.access([](state& state)
+		{
+			state.writing = false;
+		});
+
+		this->idle_.notify_all();
+	}
+}
+
+void node_journal::commit(std::vector<job>& jobs)
+{
+	// Everything that queued up while the last batch was written goes out together
+	std::vector<node_store::change_record> batch{};
+
+	for (auto& job : jobs)
+	{
+		batch.insert(batch.end(), std::make_move_iterator(job.records.begin()),
+		             std::make_move_iterator(job.records.end()));
+
+		if (!job.compaction)
+		{
+			continue;
+		}
+
+		// The snapshot was taken after these changes, they are only needed if it can't be written
+		const auto compacted = [&]()
+		{
+			try
+			{
+				this->compact_store(*job.compaction);
+				return true;
+			}
+			catch (std::exception& e)
+			{
+				console::error("Failed to compact %s: %s", this->store_file_.data(), e.what());
+				return false;
+			}
+		}();
+
+		if (!compacted)
+		{
+			this->commit_records(batch);
+		}
+
+		batch.clear();
+	}
+
+	this->commit_records(batch);
+}
+
+void node_journal::commit_records(const std::vector<node_store::change_record>& records)
+{
+	if (records.empty())
+	{
+		return;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto data = node_store::serialize_journal(records);
+
+	// Records behind the header of an older generation would be ignored by replay
+	const auto written = (!this->reset_pending_ || this->reset())
+		&& utils::io::append_file_sync(this->file_, data.data(), data.size());
+
+	if (!written)
+	{
+		console::warn("Failed to append to journal %s", this->file_.data());
+	}
+
+	const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start);
+
+	this->state_.access([&](state& state)
+	{
+		if (written)
+		{
+			state.totals.records += records.size();
+			++state.totals.commits;
+			state.totals.bytes += data.size();
+		}
+		else
+		{
+			++state.totals.failed;
+		}
+
+		state.totals.last_commit = duration;
+	});
+}
+
+void node_journal::compact_store(node_store::snapshot& snapshot)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	snapshot.generation = this->generation_ + 1;
+	const auto data = node_store::serialize(snapshot);
+
+	if (!utils::io::write_file_atomic(this->store_file_, data.data(), data.size()))
+	{
+		throw std::runtime_error{"Failed to write the snapshot"};
+	}
+
+	// The new snapshot is durable, from here on the old journal is ignored anyway
+	this->generation_ = snapshot.generation;
+	this->reset();
+
+	const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start);
+
+	this->state_.access([&](state& state)
+	{
+		++state.totals.compactions;
+		state.totals.bytes += data.size();
+		state.totals.last_compaction = duration;
+	});
+}
+
+bool node_journal::reset()
+{
+	const auto data = node_store::serialize_journal_header(this->id_, this->generation_);
+	this->reset_pending_ = !utils::io::write_file_atomic(this->file_, data.data(), data.size());
+
+	if (this->reset_pending_)
+	{
+		console::warn("Failed to reset journal %s", this->file_.data());
+	}
+
+	return !this->reset_pending_;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "node_store.hpp"
+#include "utils/concurrency.hpp"
+#include <deque>
+
+// Appends routing table changes to <store>.journal on a background thread. Every batch is written
+// with a single write and one sync, however many changes it carries (group commit).
+// A compaction writes a fresh snapshot and only then starts an empty journal for the next generation.
+// A crash in between leaves a journal of the previous generation, which replay ignores.
+class node_journal
+{
+public:
+	struct statistics
+	{
+		uint64_t records{};
+		uint64_t commits{};
+		uint64_t bytes{};
+		uint64_t compactions{};
+		uint64_t failed{};
+		std::chrono::microseconds last_commit{};
+		std::chrono::microseconds last_compaction{};
+	};
+
+	// valid_size is the intact length of the existing journal, anything behind it is cut off.
+	// A journal that is missing, torn in its header or belongs to another snapshot is started over.
+	node_journal(std::string store_file, const routing_table::id& id, uint64_t generation, size_t valid_size);
+	// Writes everything that is still pending
+	~node_journal();
+
+	node_journal(const node_journal&) = delete;
+	node_journal& operator=(const node_journal&) = delete;
+
+	node_journal(node_journal&&) = delete;
+	node_journal& operator=(node_journal&&) = delete;
+
+	void append(std::vector<node_store::change_record> records);
+
+	// The generation of the snapshot is assigned by the journal
+	void compact(node_store::snapshot snapshot);
+
+	// Blocks until everything submitted so far is written
+	void flush();
+
+	statistics get_statistics() const;
+
+	static std::string get_file(const std::string& store_file);
+
+private:
+	struct job
+	{
+		std::vector<node_store::change_record> records{};
+		std::optional<node_store::snapshot> compaction{};
+	};
+
+	struct state
+	{
+		std::deque<job> pending{};
+		bool writing{false};
+		bool stop{false};
+		statistics totals{};
+	};
+
+	std::string store_file_{};
+	std::string file_{};
+	routing_table::id id_{};
+	// Only touched by the writer thread once it runs
+	uint64_t generation_{};
+	bool reset_pending_{};
+
+	utils::concurrency::container<state> state_{};
+	std::condition_variable work_{};
+	std::condition_variable idle_{};
+	std::thread thread_{};
+
+	void run();
+	void commit(std::vector<job>& jobs);
+	void commit_records(const std::vector<node_store::change_record>& records);
+	void compact_store(node_store::snapshot& snapshot);
+	// Starts an empty journal for the current generation
+	bool reset();
+};
@@ -0,0 +1,423 @@
+#include "std_include.hpp"
+#include "node_store.hpp"
+
+#include "utils/checksum.hpp"
+
+namespace node_store
+{
+	namespace
+	{
+		constexpr char magic[8] = {'A', 'N', 'O', 'N', 'D', 'H', 'T', '\0'};
+		constexpr char journal_magic[8] = {'A', 'N', 'O', 'N', 'J', 'N', 'L', '\0'};
+		constexpr uint32_t journal_version = 1;
+
+		size_t align(const size_t value)
+		{
+			return (value + section_alignment - 1) & ~(section_alignment - 1);
+		}
+
+		uint32_t get_header_checksum(const header& value, const section* sections)
+		{
+			auto copy = value;
+			copy.checksum = 0;
+
+			const auto crc = utils::checksum::crc32(&copy, sizeof(copy));
+			return utils::checksum::crc32(sections, sizeof(section) * value.section_count, crc);
+		}
+
+		uint32_t get_journal_header_checksum(journal_header value)
+		{
+			value.checksum = 0;
+			return utils::checksum::crc32(&value, sizeof(value));
+		}
+
+		uint32_t get_journal_record_checksum(journal_record value)
+		{
+			value.checksum = 0;
+			return utils::checksum::crc32(&value, sizeof(value));
+		}
+
+		node_record to_record(const entry& entry)
+		{
+			node_record record{};
+			memcpy(record.id, entry.node.id_.data(), sizeof(record.id));
+
+			const auto& address = entry.node.address;
+			if (address.is_ipv4())
+			{
+				memcpy(record.address, &address.get_in_addr().sin_addr, 4);
+				record.family = 4;
+			}
+			else
+			{
+				memcpy(record.address, &address.get_in6_addr().sin6_addr, 16);
+				record.family = 6;
+			}
+
+			record.port = address.get_port();
+			record.last_seen = std::chrono::duration_cast<std::chrono::seconds>(
+				entry.last_seen.time_since_epoch()).count();
+			record.responses = entry.responses;
+			record.failures = entry.failures;
+			record.rtt = static_cast<uint32_t>(std::min<int64_t>(entry.rtt.count(), UINT32_MAX));
+
+			return record;
+		}
+
+		snapshot deserialize_legacy(const std::string_view data)
+		{
+			snapshot result{};
+			uint32_t ipv4_node_count{};
+			uint32_t ipv6_node_count{};
+
+			size_t offset = 0;
+			const auto read_data = [&data, &offset](void* destination, const size_t size)
+			{
+				if ((offset + size) > data.size())
+				{
+					throw std::runtime_error{"Serialized dht store is corrupted"};
+				}
+
+				memcpy(destination, data.data() + offset, size);
+				offset += size;
+			};
+
+			read_data(result.id.data(), result.id.size());
+			read_data(&ipv4_node_count, sizeof(ipv4_node_count));
+			read_data(&ipv6_node_count, sizeof(ipv6_node_count));
+
+			const auto node_count = static_cast<size_t>(ipv4_node_count) + ipv6_node_count;
+			if (node_count * 26 > data.size())
+			{
+				throw std::runtime_error{"Serialized dht store is corrupted"};
+			}
+
+			result.nodes.reserve(node_count);
+
+			for (size_t i = 0; i < node_count; ++i)
+			{
+				entry entry{};
+				read_data(entry.node.id_.data(), entry.node.id_.size());
+
+				if (i < ipv4_node_count)
+				{
+					in_addr address{};
+					read_data(&address, sizeof(address));
+					entry.node.address.set_ipv4(address);
+				}
+				else
+				{
+					in6_addr address{};
+					read_data(&address, sizeof(address));
+					entry.node.address.set_ipv6(address);
+				}
+
+				uint16_t port{};
+				read_data(&port, sizeof(port));
+				entry.node.address.set_port(port);
+
+				result.nodes.emplace_back(std::move(entry));
+			}
+
+			return result;
+		}
+	}
+
+	std::string serialize(const snapshot& snapshot)
+	{
+		std::vector<node_record> records{};
+		records.reserve(snapshot.nodes.size());
+
+		for (const auto& entry : snapshot.nodes)
+		{
+			if (entry.node.address.is_supported())
+			{
+				records.emplace_back(to_record(entry));
+			}
+		}
+
+		header file_header{};
+		memcpy(file_header.magic, magic, sizeof(magic));
+		memcpy(file_header.id, snapshot.id.data(), sizeof(file_header.id));
+		file_header.version = current_version;
+		file_header.generation = snapshot.generation;
+		file_header.header_size = sizeof(header);
+		file_header.section_count = 1;
+
+		section nodes{};
+		nodes.type = static_cast<uint32_t>(section_type::nodes);
+		nodes.record_size = sizeof(node_record);
+		nodes.offset = align(sizeof(header) + sizeof(section) * file_header.section_count);
+		nodes.count = records.size();
+		nodes.checksum = utils::checksum::crc32(records.data(), records.size() * sizeof(node_record));
+
+		file_header.checksum = get_header_checksum(file_header, &nodes);
+
+		std::string data{};
+		data.reserve(nodes.offset + records.size() * sizeof(node_record));
+		data.append(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+		data.append(reinterpret_cast<const char*>(&nodes), sizeof(nodes));
+		data.resize(nodes.offset, '\0');
+		data.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(node_record));
+
+		return data;
+	}
+
+	snapshot deserialize(const std::string_view data)
+	{
+		if (is_legacy(data))
+		{
+			return deserialize_legacy(data);
+		}
+
+		const view store{data};
+
+		snapshot result{};
+		result.id = store.get_id();
+		result.generation = store.get_generation();
+		result.nodes.reserve(store.get_node_count());
+
+		for (size_t i = 0; i < store.get_node_count(); ++i)
+		{
+			result.nodes.emplace_back(view::to_entry(store.get_nodes()[i]));
+		}
+
+		return result;
+	}
+
+	bool is_legacy(const std::string_view data)
+	{
+		return data.size() < sizeof(magic) || memcmp(data.data(), magic, sizeof(magic)) != 0;
+	}
+
+	std::string serialize_journal_header(const routing_table::id& id, const uint64_t generation)
+	{
+		journal_header file_header{};
+		memcpy(file_header.magic, journal_magic, sizeof(journal_magic));
+		memcpy(file_header.id, id.data(), sizeof(file_header.id));
+		file_header.version = journal_version;
+		file_header.record_size = sizeof(journal_record);
+		file_header.generation = generation;
+		file_header.checksum = get_journal_header_checksum(file_header);
+
+		return {reinterpret_cast<const char*>(&file_header), sizeof(file_header)};
+	}
+
+	std::string serialize_journal(const std::vector<change_record>& records)
+	{
+		std::string data{};
+		data.reserve(records.size() * sizeof(journal_record));
+
+		for (const auto& record : records)
+		{
+			if (!record.value.node.address.is_supported())
+			{
+				continue;
+			}
+
+			journal_record entry{};
+			entry.type = static_cast<uint32_t>(record.type);
+			entry.node = to_record(record.value);
+			entry.checksum = get_journal_record_checksum(entry);
+
+			data.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		}
+
+		return data;
+	}
+
+	replay_result replay_journal(snapshot& snapshot, const std::string_view data)
+	{
+		journal_header file_header{};
+		if (data.size() < sizeof(file_header))
+		{
+			return {};
+		}
+
+		memcpy(&file_header, data.data(), sizeof(file_header));
+
+		if (memcmp(file_header.magic, journal_magic, sizeof(journal_magic)) != 0
+			|| file_header.checksum != get_journal_header_checksum(file_header)
+			|| file_header.version != journal_version || file_header.record_size != sizeof(journal_record)
+			|| file_header.generation != snapshot.generation
+			|| memcmp(file_header.id, snapshot.id.data(), snapshot.id.size()) != 0)
+		{
+			return {};
+		}
+
+		// The same id can be known over IPv4 and IPv6, both are separate routing table entries
+		using key = std::pair<routing_table::id, bool>;
+		std::map<key, size_t> indices{};
+
+		for (size_t i = 0; i < snapshot.nodes.size(); ++i)
+		{
+			const auto& node = snapshot.nodes[i].node;
+			indices[{node.id_, node.address.is_ipv6()}] = i;
+		}
+
+		replay_result result{};
+		result.valid_size = sizeof(file_header);
+
+		while (data.size() - result.valid_size >= sizeof(journal_record))
+		{
+			journal_record record{};
+			memcpy(&record, data.data() + result.valid_size, sizeof(record));
+
+			if (record.checksum != get_journal_record_checksum(record)
+				|| record.type < static_cast<uint32_t>(change::insert) || record.type > static_cast<uint32_t>(change::evict)
+				|| (record.node.family != 4 && record.node.family != 6))
+			{
+				break;
+			}
+
+			result.valid_size += sizeof(record);
+			++result.applied;
+
+			auto value = view::to_entry(record.node);
+			const key node_key{value.node.id_, value.node.address.is_ipv6()};
+			const auto existing = indices.find(node_key);
+
+			if (static_cast<change>(record.type) == change::evict)
+			{
+				if (existing == indices.end())
+				{
+					continue;
+				}
+
+				const auto index = existing->second;
+				indices.erase(existing);
+
+				if (index != snapshot.nodes.size() - 1)
+				{
+					snapshot.nodes[index] = std::move(snapshot.nodes.back());
+					const auto& moved = snapshot.nodes[index].node;
+					indices[{moved.id_, moved.address.is_ipv6()}] = index;
+				}
+
+				snapshot.nodes.pop_back();
+			}
+			else if (existing != indices.end())
+			{
+				snapshot.nodes[existing->second] = std::move(value);
+			}
+			else
+			{
+				indices[node_key] = snapshot.nodes.size();
+				snapshot.nodes.emplace_back(std::move(value));
+			}
+		}
+
+		return result;
+	}
+
+	view::view(const std::string_view data)
+	{
+		if (data.size() < sizeof(header) || is_legacy(data))
+		{
+			throw std::runtime_error{"Not a dht store"};
+		}
+
+		if (reinterpret_cast<uintptr_t>(data.data()) % alignof(node_record))
+		{
+			throw std::runtime_error{"Dht store is not aligned"};
+		}
+
+		this->header_ = reinterpret_cast<const header*>(data.data());
+		const auto& file_header = *this->header_;
+
+		if (file_header.version != current_version || file_header.header_size != sizeof(header))
+		{
+			throw std::runtime_error{"Unsupported dht store version " + std::to_string(file_header.version)};
+		}
+
+		const auto table_size = static_cast<uint64_t>(file_header.section_count) * sizeof(section);
+		if (table_size > data.size() - sizeof(header))
+		{
+			throw std::runtime_error{"Dht store is truncated"};
+		}
+
+		const auto* sections = reinterpret_cast<const section*>(data.data() + sizeof(header));
+		if (get_header_checksum(file_header, sections) != file_header.checksum)
+		{
+			throw std::runtime_error{"Dht store header checksum mismatch"};
+		}
+
+		for (uint32_t i = 0; i < file_header.section_count; ++i)
+		{
+			const auto& entry = sections[i];
+			if (entry.offset % section_alignment || entry.offset > data.size()
+				|| (entry.record_size && entry.count > (data.size() - entry.offset) / entry.record_size))
+			{
+				throw std::runtime_error{"Dht store is truncated"};
+			}
+
+			const auto* records = data.data() + entry.offset;
+			const auto size = static_cast<size_t>(entry.count * entry.record_size);
+
+			if (utils::checksum::crc32(records, size) != entry.checksum)
+			{
+				throw std::runtime_error{"Dht store section checksum mismatch"};
+			}
+
+			if (entry.type == static_cast<uint32_t>(section_type::nodes))
+			{
+				if (entry.record_size != sizeof(node_record))
+				{
+					throw std::runtime_error{"Dht store node records have an unexpected size"};
+				}
+
+				this->nodes_ = reinterpret_cast<const node_record*>(records);
+				this->node_count_ = static_cast<size_t>(entry.count);
+			}
+		}
+	}
+
+	routing_table::id view::get_id() const
+	{
+		routing_table::id id{};
+		memcpy(id.data(), this->header_->id, id.size());
+		return id;
+	}
+
+	uint64_t view::get_generation() const
+	{
+		return this->header_->generation;
+	}
+
+	const node_record* view::get_nodes() const
+	{
+		return this->nodes_;
+	}
+
+	size_t view::get_node_count() const
+	{
+		return this->node_count_;
+	}
+
+	entry view::to_entry(const node_record& record)
+	{
+		entry result{};
+		memcpy(result.node.id_.data(), record.id, result.node.id_.size());
+
+		if (record.family == 4)
+		{
+			in_addr address{};
+			memcpy(&address, record.address, sizeof(address));
+			result.node.address.set_ipv4(address);
+		}
+		else
+		{
+			in6_addr address{};
+			memcpy(&address, record.address, sizeof(address));
+			result.node.address.set_ipv6(address);
+		}
+
+		result.node.address.set_port(record.port);
+		result.last_seen = clock::time_point{std::chrono::seconds{record.last_seen}};
+		result.responses = record.responses;
+		result.failures = record.failures;
+		result.rtt = std::chrono::microseconds{record.rtt};
+
+		return result;
+	}
+}
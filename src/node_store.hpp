@@ -0,0 +1,158 @@
+#pragma once
+
+#include "routing_table.hpp"
+
+// On-disk layout of dht.store. A header and a section table are followed by the sections,
+// each starting on a 64 byte boundary and holding fixed-size records, so a mapped file is
+// read in place. Every section has its own checksum. Readers skip section types they don't
+// know, new data goes into new sections instead of changing existing records.
+// Values are stored in host byte order, little-endian on every platform we build for.
+namespace node_store
+{
+	using clock = std::chrono::system_clock;
+
+	constexpr uint32_t current_version = 1;
+	constexpr size_t section_alignment = 64;
+
+	enum class section_type : uint32_t
+	{
+		nodes = 1,
+	};
+
+	struct header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t header_size;
+		uint32_t section_count;
+		// Covers the header, with this field zeroed, and the section table
+		uint32_t checksum;
+		uint8_t id[20];
+		uint8_t reserved0[4];
+		// Incremented by every compaction, a journal only applies to the snapshot of its generation
+		uint64_t generation;
+		uint8_t reserved1[8];
+	};
+
+	struct section
+	{
+		uint32_t type;
+		uint32_t record_size;
+		uint64_t offset;
+		uint64_t count;
+		uint32_t checksum;
+		uint32_t reserved;
+	};
+
+	struct node_record
+	{
+		uint8_t id[20];
+		// IPv4 addresses use the first four bytes
+		uint8_t address[16];
+		uint16_t port;
+		uint8_t family;
+		uint8_t reserved0;
+		// Seconds since the unix epoch, 0 if the node never answered
+		int64_t last_seen;
+		uint32_t responses;
+		uint32_t failures;
+		// Smoothed round trip in microseconds, 0 if never measured
+		uint32_t rtt;
+		uint32_t reserved1;
+	};
+
+	enum class change : uint32_t
+	{
+		insert = 1,
+		update = 2,
+		evict = 3,
+	};
+
+	// <store>.journal holds the routing table changes since the snapshot with the same id and generation.
+	// Records are appended in batches, a torn write at the end only loses the last batch.
+	struct journal_header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t record_size;
+		uint64_t generation;
+		uint8_t id[20];
+		// Covers the header with this field zeroed
+		uint32_t checksum;
+	};
+
+	struct journal_record
+	{
+		uint32_t type;
+		// Covers the record with this field zeroed
+		uint32_t checksum;
+		node_record node;
+	};
+
+	static_assert(sizeof(header) == 64);
+	static_assert(sizeof(section) == 32);
+	static_assert(sizeof(node_record) == 64);
+	static_assert(sizeof(journal_header) == 48);
+	static_assert(sizeof(journal_record) == 72);
+
+	struct entry
+	{
+		routing_table::node node{};
+		clock::time_point last_seen{};
+		uint32_t responses{};
+		uint32_t failures{};
+		std::chrono::microseconds rtt{};
+	};
+
+	struct snapshot
+	{
+		routing_table::id id{};
+		uint64_t generation{};
+		std::vector<entry> nodes{};
+	};
+
+	struct change_record
+	{
+		change type{};
+		// Evictions only carry the node
+		entry value{};
+	};
+
+	struct replay_result
+	{
+		size_t applied{};
+		// Length up to the last intact record, 0 if the journal belongs to another snapshot
+		size_t valid_size{};
+	};
+
+	std::string serialize(const snapshot& snapshot);
+
+	// Accepts the current layout as well as the unversioned legacy one, throws if corrupted
+	snapshot deserialize(std::string_view data);
+	bool is_legacy(std::string_view data);
+
+	std::string serialize_journal_header(const routing_table::id& id, uint64_t generation);
+	std::string serialize_journal(const std::vector<change_record>& records);
+
+	// Applies a journal written for this snapshot, a journal of another snapshot is ignored
+	replay_result replay_journal(snapshot& snapshot, std::string_view data);
+
+	// Validated zero-copy access to a serialized store, the data has to outlive the view
+	class view
+	{
+	public:
+		explicit view(std::string_view data);
+
+		routing_table::id get_id() const;
+		uint64_t get_generation() const;
+		const node_record* get_nodes() const;
+		size_t get_node_count() const;
+
+		static entry to_entry(const node_record& record);
+
+	private:
+		const header* header_{};
+		const node_record* nodes_{};
+		size_t node_count_{};
+	};
+}
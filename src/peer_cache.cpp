@@ -0,0 +1,122 @@
+#include "std_include.hpp"
+#include "peer_cache.hpp"
+
+peer_cache::peer_cache(const size_t max_entries, const size_t max_peers, const clock::duration ttl)
+	: max_entries_(max_entries)
+	  , max_peers_(max_peers)
+	  , ttl_(ttl)
+{
+}
+
+peer_cache::entry& peer_cache::touch(const id& hash)
+{
+	const auto existing = this->index_.find(hash);
+	if (existing != this->index_.end())
+	{
+		this->entries_.splice(this->entries_.begin(), this->entries_, existing->second);
+		return *existing->second;
+	}
+
+	while (!this->entries_.empty() && this->entries_.size() >= this->max_entries_)
+	{
+		this->index_.erase(this->entries_.back().hash);
+		this->entries_.pop_back();
+		++this->statistics_.evictions;
+	}
+
+	this->entries_.push_front(entry{hash, {}});
+	this->index_[hash] = this->entries_.begin();
+	this->statistics_.entries = this->entries_.size();
+
+	return this->entries_.front();
+}
+
+void peer_cache::insert_peer(entry& entry, const network::address& address, const clock::time_point expires)
+{
+	for (auto& peer : entry.peers)
+	{
+		if (peer.address == address)
+		{
+			peer.expires = std::max(peer.expires, expires);
+			return;
+		}
+	}
+
+	if (entry.peers.size() < this->max_peers_)
+	{
+		entry.peers.push_back({address, expires});
+		return;
+	}
+
+	// Replace the peer closest to expiring
+	auto& oldest = *std::min_element(entry.peers.begin(), entry.peers.end(), [](const peer& a, const peer& b)
+	{
+		return a.expires < b.expires;
+	});
+
+	if (oldest.expires < expires)
+	{
+		oldest = {address, expires};
+	}
+}
+
+void peer_cache::insert(const id& hash, const std::vector<network::address>& peers, const clock::time_point now)
+{
+	if (peers.empty() || !this->max_entries_)
+	{
+		return;
+	}
+
+	auto& entry = this->touch(hash);
+	const auto expires = now + this->ttl_;
+
+	for (const auto& address : peers)
+	{
+		this->insert_peer(entry, address, expires);
+	}
+}
+
+bool peer_cache::lookup(const id& hash, std::vector<network::address>& peers, const clock::time_point now)
+{
+	peers.clear();
+
+	const auto existing = this->index_.find(hash);
+	if (existing != this->index_.end())
+	{
+		auto& entry = *existing->second;
+		entry.peers.erase(std::remove_if(entry.peers.begin(), entry.peers.end(), [now](const peer& peer)
+		{
+			return peer.expires <= now;
+		}), entry.peers.end());
+
+		if (entry.peers.empty())
+		{
+			this->entries_.erase(existing->second);
+			this->index_.erase(existing);
+			this->statistics_.entries = this->entries_.size();
+		}
+		else
+		{
+			this->entries_.splice(this->entries_.begin(), this->entries_, existing->second);
+
+			for (const auto& peer : entry.peers)
+			{
+				peers.push_back(peer.address);
+			}
+		}
+	}
+
+	if (peers.empty())
+	{
+		++this->statistics_.misses;
+		return false;
+	}
+
+	++this->statistics_.hits;
+	return true;
+}
+
+const peer_cache::statistics& peer_cache::get_statistics() const
+{
+	return this->statistics_;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "routing_table.hpp"
+#include <list>
+
+// Bounded cache of search results. Every peer expires on its own,
+// whole entries are evicted least recently used first.
+class peer_cache
+{
+public:
+	using id = routing_table::id;
+	// Wall clock time, like the peer segments that keep results across restarts
+	using clock = std::chrono::system_clock;
+
+	struct statistics
+	{
+		uint64_t hits{};
+		uint64_t misses{};
+		uint64_t evictions{};
+		size_t entries{};
+	};
+
+	peer_cache(size_t max_entries = 4096, size_t max_peers = 256, clock::duration ttl = std::chrono::minutes(30));
+
+	void insert(const id& hash, const std::vector<network::address>& peers, clock::time_point now = clock::now());
+
+	// Fills peers with the live peers of the hash, counts a hit or a miss
+	bool lookup(const id& hash, std::vector<network::address>& peers, clock::time_point now = clock::now());
+
+	const statistics& get_statistics() const;
+
+private:
+	struct peer
+	{
+		network::address address{};
+		clock::time_point expires{};
+	};
+
+	struct entry
+	{
+		id hash{};
+		std::vector<peer> peers{};
+	};
+
+	size_t max_entries_{};
+	size_t max_peers_{};
+	clock::duration ttl_{};
+
+	// Most recently used first
+	std::list<entry> entries_{};
+	std::unordered_map<id, std::list<entry>::iterator, routing_table::id_hash> index_{};
+	statistics statistics_{};
+
+	entry& touch(const id& hash);
+	void insert_peer(entry& entry, const network::address& address, clock::time_point expires);
+};
@@ -0,0 +1,875 @@
+#include "std_include.hpp"
+#include "peer_segments.hpp"
+
+#include "console.hpp"
+#include "utils/checksum.hpp"
+#include "utils/io.hpp"
+
+namespace
+{
+	constexpr char magic[8] = {'A', 'N', 'O', 'N', 'S', 'E', 'G', '\0'};
+	constexpr uint32_t segment_version = 1;
+	constexpr auto segment_extension = ".seg";
+
+	// Values are stored in host byte order, like dht.store
+	struct segment_header
+	{
+		char magic[8];
+		uint32_t version;
+		// Covers the header with this field zeroed
+		uint32_t checksum;
+		uint64_t hash_count;
+		uint64_t peer_count;
+		uint64_t index_offset;
+		uint32_t index_checksum;
+		uint32_t reserved0;
+		// Latest expiry of any peer in seconds since the unix epoch, the whole segment is dropped after it
+		int64_t expires;
+		uint8_t reserved1[8];
+	};
+
+	struct index_entry
+	{
+		uint8_t hash[20];
+		uint32_t count;
+		uint64_t offset;
+		// Covers the peer records of this hash
+		uint32_t checksum;
+		uint32_t reserved;
+	};
+
+	struct peer_record
+	{
+		// IPv4 addresses use the first four bytes
+		uint8_t address[16];
+		uint16_t port;
+		uint8_t family;
+		uint8_t reserved0;
+		uint32_t reserved1;
+		int64_t expires;
+	};
+
+	static_assert(sizeof(segment_header) == 64);
+	static_assert(sizeof(index_entry) == 40);
+	static_assert(sizeof(peer_record) == 32);
+
+	uint32_t get_header_checksum(segment_header value)
+	{
+		value.checksum = 0;
+		return utils::checksum::crc32(&value, sizeof(value));
+	}
+
+	int64_t to_seconds(const peer_segments::clock::time_point time)
+	{
+		return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+	}
+
+	peer_record to_record(const network::address& address, const peer_segments::clock::time_point expires)
+	{
+		peer_record record{};
+
+		if (address.is_ipv4())
+		{
+			memcpy(record.address, &address.get_in_addr().sin_addr, 4);
+			record.family = 4;
+		}
+		else
+		{
+			memcpy(record.address, &address.get_in6_addr().sin6_addr, 16);
+			record.family = 6;
+		}
+
+		record.port = address.get_port();
+		record.expires = to_seconds(expires);
+
+		return record;
+	}
+
+	network::address to_address(const peer_record& record)
+	{
+		network::address address{};
+
+		if (record.family == 4)
+		{
+			in_addr ip{};
+			memcpy(&ip, record.address, sizeof(ip));
+			address.set_ipv4(ip);
+		}
+		else
+		{
+			in6_addr ip{};
+			memcpy(&ip, record.address, sizeof(ip));
+			address.set_ipv6(ip);
+		}
+
+		address.set_port(record.port);
+		return address;
+	}
+
+	bool is_same_peer(const peer_record& a, const peer_record& b)
+	{
+		return a.family == b.family && a.port == b.port && memcmp(a.address, b.address, sizeof(a.address)) == 0;
+	}
+
+	// Builds a segment in one pass, hashes have to be added in ascending order
+	class segment_writer
+	{
+	public:
+		segment_writer()
+		{
+			this->data_.resize(sizeof(segment_header));
+		}
+
+		void add(const routing_table::id& hash, const std::vector<peer_record>& peers)
+		{
+			if (peers.empty())
+			{
+				return;
+			}
+
+			index_entry entry{};
+			memcpy(entry.hash, hash.data(), sizeof(entry.hash));
+			entry.count = static_cast<uint32_t>(peers.size());
+			entry.offset = this->data_.size();
+			entry.checksum = utils::checksum::crc32(peers.data(), peers.size() * sizeof(peer_record));
+
+			for (const auto& peer : peers)
+			{
+				this->expires_ = std::max(this->expires_, peer.expires);
+			}
+
+			this->data_.append(reinterpret_cast<const char*>(peers.data()), peers.size() * sizeof(peer_record));
+			this->peer_count_ += peers.size();
+			this->index_.push_back(entry);
+		}
+
+		bool empty() const
+		{
+			return this->index_.empty();
+		}
+
+		std::string finish()
+		{
+			segment_header header{};
+			memcpy(header.magic, magic, sizeof(magic));
+			header.version = segment_version;
+			header.hash_count = this->index_.size();
+			header.peer_count = this->peer_count_;
+			header.index_offset = this->data_.size();
+			header.index_checksum = utils::checksum::crc32(this->index_.data(),
+			                                               this->index_.size() * sizeof(index_entry));
+			header.expires = this->expires_;
+			header.checksum = get_header_checksum(header);
+
+			memcpy(this->data_.data(), &header, sizeof(header));
+			this->data_.append(reinterpret_cast<const char*>(this->index_.data()),
+			                   this->index_.size() * sizeof(index_entry));
+
+			return std::move(this->data_);
+		}
+
+	private:
+		std::string data_{};
+		std::vector<index_entry> index_{};
+		uint64_t peer_count_{};
+		int64_t expires_{};
+	};
+}
+
+class peer_segments::segment
+{
+public:
+	segment(std::string file, const uint64_t sequence)
+		: file_(std::move(file))
+		  , sequence_(sequence)
+		  , mapping_(this->file_, utils::io::access_pattern::random)
+	{
+		const auto data = this->mapping_.get_data();
+		if (data.size() < sizeof(segment_header))
+		{
+			throw std::runtime_error{"Segment is truncated"};
+		}
+
+		this->header_ = reinterpret_cast<const segment_header*>(data.data());
+		const auto& header = *this->header_;
+
+		if (memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != segment_version
+			|| header.checksum != get_header_checksum(header))
+		{
+			throw std::runtime_error{"Not a valid segment"};
+		}
+
+		if (header.index_offset % alignof(index_entry) || header.index_offset > data.size()
+			|| header.hash_count > (data.size() - header.index_offset) / sizeof(index_entry))
+		{
+			throw std::runtime_error{"Segment index is truncated"};
+		}
+
+		this->index_ = reinterpret_cast<const index_entry*>(data.data() + header.index_offset);
+		this->count_ = static_cast<size_t>(header.hash_count);
+
+		// Only the index is read here, peer records are checked when a lookup reaches them
+		if (utils::checksum::crc32(this->index_, this->count_ * sizeof(index_entry)) != header.index_checksum)
+		{
+			throw std::runtime_error{"Segment index checksum mismatch"};
+		}
+
+		for (size_t i = 0; i < this->count_; ++i)
+		{
+			const auto& entry = this->index_[i];
+			if (entry.offset < sizeof(segment_header) || entry.offset % alignof(peer_record)
+				|| entry.offset > header.index_offset
+				|| entry.count > (header.index_offset - entry.offset) / sizeof(peer_record)
+				|| (i && memcmp(this->index_[i - 1].hash, entry.hash, sizeof(entry.hash)) >= 0))
+			{
+				throw std::runtime_error{"Segment index is corrupted"};
+			}
+		}
+	}
+
+	~segment()
+	{
+		if (this->obsolete_)
+		{
+			utils::io::remove_file(this->file_);
+		}
+	}
+
+	segment(const segment&) = delete;
+	segment& operator=(const segment&) = delete;
+
+	segment(segment&&) = delete;
+	segment& operator=(segment&&) = delete;
+
+	uint64_t get_sequence() const
+	{
+		return this->sequence_;
+	}
+
+	size_t get_hash_count() const
+	{
+		return this->count_;
+	}
+
+	uint64_t get_peer_count() const
+	{
+		return this->header_->peer_count;
+	}
+
+	size_t get_size() const
+	{
+		return this->mapping_.get_data().size();
+	}
+
+	clock::time_point get_expiry() const
+	{
+		return clock::time_point{std::chrono::seconds{this->header_->expires}};
+	}
+
+	// The file is removed once the last lookup using the segment is done
+	void set_obsolete() const
+	{
+		this->obsolete_ = true;
+	}
+
+	routing_table::id get_hash(const size_t index) const
+	{
+		routing_table::id hash{};
+		memcpy(hash.data(), this->index_[index].hash, hash.size());
+		return hash;
+	}
+
+	// Returns an empty range if the records of the entry are corrupted
+	std::pair<const peer_record*, size_t> get_peers(const size_t index) const
+	{
+		const auto& entry = this->index_[index];
+		const auto* records = reinterpret_cast<const peer_record*>(this->mapping_.get_data().data() + entry.offset);
+
+		if (utils::checksum::crc32(records, entry.count * sizeof(peer_record)) != entry.checksum)
+		{
+			return {};
+		}
+
+		return {records, entry.count};
+	}
+
+	std::optional<size_t> find(const routing_table::id& hash) const
+	{
+		const auto* end = this->index_ + this->count_;
+		const auto* entry = std::lower_bound(this->index_, end, hash, [](const index_entry& a, const routing_table::id& b)
+		{
+			return memcmp(a.hash, b.data(), b.size()) < 0;
+		});
+
+		if (entry == end || memcmp(entry->hash, hash.data(), hash.size()) != 0)
+		{
+			return std::nullopt;
+		}
+
+		return static_cast<size_t>(entry - this->index_);
+	}
+
+private:
+	std::string file_{};
+	uint64_t sequence_{};
+	// Lookups binary search the index and jump to single hashes, read-ahead would be wasted
+	utils::io::file_view mapping_;
+
+	const segment_header* header_{};
+	const index_entry* index_{};
+	size_t count_{};
+
+	mutable std::atomic<bool> obsolete_{false};
+};
+
+peer_segments::peer_segments(std::string directory, const config config)
+	: directory_(std::move(directory))
+	  , config_(config)
+{
+	this->load();
+
+	this->thread_ = std::thread([this]()
+	{
+		this->run_writer();
+	});
+}
+
+peer_segments::~peer_segments()
+{
+	this->submit();
+
+	this->state_.access([](state& state)
+	{
+		state.stop = true;
+	});
+
+	this->work_.notify_all();
+
+	if (this->thread_.joinable())
+	{
+		this->thread_.join();
+	}
+}
+
+std::string peer_segments::get_file(const uint64_t sequence) const
+{
+	char name[32]{};
+	snprintf(name, sizeof(name), "%016llx%s", static_cast<unsigned long long>(sequence), segment_extension);
+	return this->directory_ + "/" + name;
+}
+
+void peer_segments::load()
+{
+	if (!utils::io::directory_exists(this->directory_))
+	{
+		utils::io::create_directory(this->directory_);
+		return;
+	}
+
+	auto loaded = std::make_shared<tables>();
+	uint64_t next_sequence = 1;
+
+	for (const auto& file : utils::io::list_files(this->directory_))
+	{
+		const std::filesystem::path path{file};
+		if (path.extension() != segment_extension)
+		{
+			// Left behind by a write that did not finish
+			if (path.extension() == ".tmp")
+			{
+				utils::io::remove_file(file);
+			}
+
+			continue;
+		}
+
+		try
+		{
+			const auto sequence = static_cast<uint64_t>(std::stoull(path.stem().string(), nullptr, 16));
+			loaded->segments.push_back(std::make_shared<segment>(file, sequence));
+			next_sequence = std::max(next_sequence, sequence + 1);
+		}
+		catch (std::exception& e)
+		{
+			console::warn("Dropping peer segment %s: %s", file.data(), e.what());
+			utils::io::remove_file(file);
+		}
+	}
+
+	std::sort(loaded->segments.begin(), loaded->segments.end(), [](const auto& a, const auto& b)
+	{
+		return a->get_sequence() > b->get_sequence();
+	});
+
+	this->state_.access([&](state& state)
+	{
+		state.current = std::move(loaded);
+		state.next_sequence = next_sequence;
+	});
+}
+
+void peer_segments::insert_peer(std::vector<peer>& peers, const network::address& address,
+                                const clock::time_point expires) const
+{
+	for (auto& peer : peers)
+	{
+		if (peer.address == address)
+		{
+			peer.expires = std::max(peer.expires, expires);
+			return;
+		}
+	}
+
+	if (peers.size() < this->config_.max_peers_per_hash)
+	{
+		peers.push_back({address, expires});
+		return;
+	}
+
+	// Replace the peer closest to expiring
+	auto& oldest = *std::min_element(peers.begin(), peers.end(), [](const peer& a, const peer& b)
+	{
+		return a.expires < b.expires;
+	});
+
+	if (oldest.expires < expires)
+	{
+		oldest = {address, expires};
+	}
+}
+
+void peer_segments::insert(const id& hash, const std::vector<network::address>& peers, const clock::time_point now)
+{
+	if (peers.empty())
+	{
+		return;
+	}
+
+	if (this->memory_.empty())
+	{
+		this->memory_since_ = now;
+	}
+
+	auto& entry = this->memory_[hash];
+	const auto previous = entry.size();
+
+	for (const auto& address : peers)
+	{
+		this->insert_peer(entry, address, now + this->config_.ttl);
+	}
+
+	this->memory_peers_ += entry.size() - previous;
+}
+
+bool peer_segments::lookup(const id& hash, std::vector<network::address>& peers, const clock::time_point now)
+{
+	std::vector<peer> found{};
+	const auto add = [&](const network::address& address, const clock::time_point expires)
+	{
+		if (expires > now)
+		{
+			this->insert_peer(found, address, expires);
+		}
+	};
+
+	const auto collect = [&](const memtable& table)
+	{
+		const auto entry = table.find(hash);
+		if (entry == table.end())
+		{
+			return;
+		}
+
+		for (const auto& peer : entry->second)
+		{
+			add(peer.address, peer.expires);
+		}
+	};
+
+	collect(this->memory_);
+
+	const auto current = this->state_.access<std::shared_ptr<const tables>>([](const state& state)
+	{
+		return state.current;
+	});
+
+	for (const auto& table : current->flushing)
+	{
+		collect(*table);
+	}
+
+	for (const auto& entry : current->segments)
+	{
+		const auto index = entry->find(hash);
+		if (!index)
+		{
+			continue;
+		}
+
+		const auto records = entry->get_peers(*index);
+		for (size_t i = 0; i < records.second; ++i)
+		{
+			const auto& record = records.first[i];
+			add(to_address(record), clock::time_point{std::chrono::seconds{record.expires}});
+		}
+	}
+
+	peers.clear();
+	peers.reserve(found.size());
+
+	for (const auto& peer : found)
+	{
+		peers.push_back(peer.address);
+	}
+
+	if (peers.empty())
+	{
+		++this->misses_;
+		return false;
+	}
+
+	++this->hits_;
+	return true;
+}
+
+void peer_segments::run(const clock::time_point now)
+{
+	if (this->memory_peers_ >= this->config_.flush_peers
+		|| (this->memory_peers_ && (now - this->memory_since_) >= this->config_.flush_interval))
+	{
+		this->submit();
+	}
+}
+
+void peer_segments::submit()
+{
+	if (this->memory_.empty())
+	{
+		return;
+	}
+
+	auto table = std::make_shared<const memtable>(std::move(this->memory_));
+	this->memory_ = {};
+	this->memory_peers_ = 0;
+
+	// Lookups keep seeing the peers while they are written
+	this->state_.access([&](state& state)
+	{
+		auto next = std::make_shared<tables>(*state.current);
+		next->flushing.insert(next->flushing.begin(), table);
+		state.current = std::move(next);
+		state.pending.push_back(std::move(table));
+	});
+
+	this->work_.notify_one();
+}
+
+void peer_segments::flush()
+{
+	this->submit();
+
+	this->state_.access_with_lock([this](state& state, std::unique_lock<std::mutex>& lock)
+	{
+		this->idle_.wait(lock, [&state]()
+		{
+			return state.pending.empty() && !state.writing;
+		});
+	});
+}
+
+peer_segments::statistics peer_segments::get_statistics() const
+{
+	auto result = this->state_.access<statistics>([](const state& state)
+	{
+		auto totals = state.totals;
+
+		for (const auto& entry : state.current->segments)
+		{
+			++totals.segments;
+			totals.segment_hashes += entry->get_hash_count();
+			totals.segment_peers += entry->get_peer_count();
+			totals.mapped_bytes += entry->get_size();
+		}
+
+		return totals;
+	});
+
+	result.memory_peers = this->memory_peers_;
+	result.hits = this->hits_;
+	result.misses = this->misses_;
+
+	return result;
+}
+
+void peer_segments::run_writer()
+{
+	// Segments left over from the last run may have expired or be too many
+	this->merge();
+
+	while (true)
+	{
+		std::shared_ptr<const memtable> table{};
+
+		const auto stop = this->state_.access_with_lock<bool>(
+			[this, &table](state& state, std::unique_lock<std::mutex>& lock)
+			{
+				this->work_.wait(lock, [&state]()
+				{
+					return state.stop || !state.pending.empty();
+				});
+
+				if (state.pending.empty())
+				{
+					return true;
+				}
+
+				table = std::move(state.pending.front());
+				state.pending.erase(state.pending.begin());
+				state.writing = true;
+
+				return false;
+			});
+
+		if (stop)
+		{
+			return;
+		}
+
+		std::shared_ptr<const segment> written{};
+
+		try
+		{
+			const auto now = clock::now();
+			segment_writer writer{};
+			std::vector<peer_record> records{};
+
+			for (const auto& entry : *table)
+			{
+				records.clear();
+
+				for (const auto& peer : entry.second)
+				{
+					if (peer.expires > now)
+					{
+						records.push_back(to_record(peer.address, peer.expires));
+					}
+				}
+
+				writer.add(entry.first, records);
+			}
+
+			if (!writer.empty())
+			{
+				written = this->write_segment(writer.finish());
+			}
+
+			this->state_.access([](state& state)
+			{
+				++state.totals.flushes;
+			});
+		}
+		catch (std::exception& e)
+		{
+			console::error("Failed to write peer segment: %s", e.what());
+
+			this->state_.access([](state& state)
+			{
+				++state.totals.failed;
+			});
+		}
+
+		// A failed write drops the peers, the next searches find them again
+		this->publish(table, written, {});
+		this->merge();
+
+		this->state_.access([](state& state)
+		{
+			state.writing = false;
+		});
+
+		this->idle_.notify_all();
+	}
+}
+
+std::shared_ptr<const peer_segments::segment> peer_segments::write_segment(const std::string& data)
+{
+	const auto sequence = this->state_.access<uint64_t>([](state& state)
+	{
+		return state.next_sequence++;
+	});
+
+	const auto file = this->get_file(sequence);
+	if (!utils::io::write_file_atomic(file, data.data(), data.size()))
+	{
+		throw std::runtime_error{"Failed to write " + file};
+	}
+
+	return std::make_shared<segment>(file, sequence);
+}
+
+void peer_segments::merge()
+{
+	const auto current = this->state_.access<std::shared_ptr<const tables>>([](const state& state)
+	{
+		return state.current;
+	});
+
+	const auto now = clock::now();
+	std::vector<std::shared_ptr<const segment>> sources{};
+	std::vector<std::shared_ptr<const segment>> expired{};
+
+	for (const auto& entry : current->segments)
+	{
+		(entry->get_expiry() <= now ? expired : sources).push_back(entry);
+	}
+
+	if (sources.size() <= this->config_.max_segments)
+	{
+		if (!expired.empty())
+		{
+			this->publish({}, {}, expired);
+		}
+
+		return;
+	}
+
+	std::shared_ptr<const segment> merged{};
+
+	try
+	{
+		const auto start = std::chrono::steady_clock::now();
+
+		// Every source is sorted by hash, so the merge walks all of them side by side.
+		// Sources are ordered newest first, a peer keeps the latest expiry of any copy.
+		std::vector<size_t> positions(sources.size(), 0);
+		std::vector<peer_record> records{};
+		segment_writer writer{};
+
+		while (true)
+		{
+			std::optional<routing_table::id> next{};
+
+			for (size_t i = 0; i < sources.size(); ++i)
+			{
+				if (positions[i] < sources[i]->get_hash_count())
+				{
+					const auto hash = sources[i]->get_hash(positions[i]);
+					if (!next || hash < *next)
+					{
+						next = hash;
+					}
+				}
+			}
+
+			if (!next)
+			{
+				break;
+			}
+
+			records.clear();
+
+			for (size_t i = 0; i < sources.size(); ++i)
+			{
+				if (positions[i] >= sources[i]->get_hash_count() || sources[i]->get_hash(positions[i]) != *next)
+				{
+					continue;
+				}
+
+				const auto peers = sources[i]->get_peers(positions[i]++);
+				for (size_t j = 0; j < peers.second; ++j)
+				{
+					const auto& record = peers.first[j];
+					if (record.expires <= to_seconds(now))
+					{
+						continue;
+					}
+
+					const auto existing = std::find_if(records.begin(), records.end(), [&record](const peer_record& entry)
+					{
+						return is_same_peer(entry, record);
+					});
+
+					if (existing == records.end())
+					{
+						records.push_back(record);
+					}
+					else
+					{
+						existing->expires = std::max(existing->expires, record.expires);
+					}
+				}
+			}
+
+			if (records.size() > this->config_.max_peers_per_hash)
+			{
+				std::partial_sort(records.begin(), records.begin() + this->config_.max_peers_per_hash, records.end(),
+				                  [](const peer_record& a, const peer_record& b)
+				                  {
+					                  return a.expires > b.expires;
+				                  });
+
+				records.resize(this->config_.max_peers_per_hash);
+			}
+
+			writer.add(*next, records);
+		}
+
+		if (!writer.empty())
+		{
+			merged = this->write_segment(writer.finish());
+		}
+
+		console::log("Merged %zu peer segments in %lld ms", sources.size(),
+		             static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+			             std::chrono::steady_clock::now() - start).count()));
+
+		this->state_.access([](state& state)
+		{
+			++state.totals.merges;
+		});
+	}
+	catch (std::exception& e)
+	{
+		console::error("Failed to merge peer segments: %s", e.what());
+
+		this->state_.access([](state& state)
+		{
+			++state.totals.failed;
+		});
+
+		sources.clear();
+	}
+
+	sources.insert(sources.end(), expired.begin(), expired.end());
+	this->publish({}, merged, sources);
+}
+
+void peer_segments::publish(const std::shared_ptr<const memtable>& flushed, const std::shared_ptr<const segment>& written,
+                            const std::vector<std::shared_ptr<const segment>>& merged)
+{
+	this->state_.access([&](state& state)
+	{
+		auto next = std::make_shared<tables>(*state.current);
+
+		if (flushed)
+		{
+			next->flushing.erase(std::remove(next->flushing.begin(), next->flushing.end(), flushed),
+			                     next->flushing.end());
+		}
+
+		for (const auto& entry : merged)
+		{
+			entry->set_obsolete();
+			next->segments.erase(std::remove(next->segments.begin(), next->segments.end(), entry),
+			                     next->segments.end());
+		}
+
+		// A merge only covers segments older than itself, so new segments always go first
+		if (written)
+		{
+			next->segments.insert(next->segments.begin(), written);
+		}
+
+		state.current = std::move(next);
+	});
+}
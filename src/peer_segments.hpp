@@ -0,0 +1,123 @@
+#pragma once
+
+#include "routing_table.hpp"
+#include "utils/concurrency.hpp"
+
+// Search results persisted in immutable segment files, so a restart can answer searches right away.
+// New results collect in memory and are written to a new segment in the background once enough
+// gathered. Every segment holds its peers sorted by info hash, followed by an index block that
+// lookups binary search. Segments are mapped at startup, only the pages a lookup touches are read.
+// Once too many segments exist they are merged into one, dropping expired peers.
+class peer_segments
+{
+public:
+	using id = routing_table::id;
+	// Wall clock time so peers survive a restart
+	using clock = std::chrono::system_clock;
+
+	struct config
+	{
+		// Peers collected in memory before they are written out
+		size_t flush_peers{1 << 16};
+		clock::duration flush_interval{std::chrono::minutes(5)};
+		clock::duration ttl{std::chrono::hours(1)};
+		size_t max_peers_per_hash{256};
+		size_t max_segments{4};
+	};
+
+	struct statistics
+	{
+		size_t segments{};
+		uint64_t segment_hashes{};
+		uint64_t segment_peers{};
+		size_t mapped_bytes{};
+		size_t memory_peers{};
+		uint64_t hits{};
+		uint64_t misses{};
+		uint64_t flushes{};
+		uint64_t merges{};
+		uint64_t failed{};
+	};
+
+	// Opens every segment in the directory
+	peer_segments(std::string directory, config config);
+	// Writes the peers that are still in memory
+	~peer_segments();
+
+	peer_segments(const peer_segments&) = delete;
+	peer_segments& operator=(const peer_segments&) = delete;
+
+	peer_segments(peer_segments&&) = delete;
+	peer_segments& operator=(peer_segments&&) = delete;
+
+	void insert(const id& hash, const std::vector<network::address>& peers, clock::time_point now = clock::now());
+
+	// Fills peers with the live peers of the hash from memory and every segment
+	bool lookup(const id& hash, std::vector<network::address>& peers, clock::time_point now = clock::now());
+
+	// Hands the collected peers to the background thread once there are enough or they waited long enough
+	void run(clock::time_point now = clock::now());
+
+	// Writes the collected peers and blocks until every segment is written
+	void flush();
+
+	statistics get_statistics() const;
+
+private:
+	class segment;
+
+	struct peer
+	{
+		network::address address{};
+		clock::time_point expires{};
+	};
+
+	// Sorted, so a segment is written in a single pass
+	using memtable = std::map<id, std::vector<peer>>;
+
+	// Everything lookups can see, replaced as a whole by the background thread
+	struct tables
+	{
+		// Written but not yet mapped, newest first
+		std::vector<std::shared_ptr<const memtable>> flushing{};
+		// Newest first
+		std::vector<std::shared_ptr<const segment>> segments{};
+	};
+
+	struct state
+	{
+		std::shared_ptr<const tables> current{std::make_shared<tables>()};
+		std::vector<std::shared_ptr<const memtable>> pending{};
+		bool writing{false};
+		bool stop{false};
+		uint64_t next_sequence{1};
+		statistics totals{};
+	};
+
+	std::string directory_{};
+	config config_{};
+
+	memtable memory_{};
+	size_t memory_peers_{};
+	clock::time_point memory_since_{};
+
+	uint64_t hits_{};
+	uint64_t misses_{};
+
+	utils::concurrency::container<state> state_{};
+	std::condition_variable work_{};
+	std::condition_variable idle_{};
+	std::thread thread_{};
+
+	void load();
+	void submit();
+	void run_writer();
+
+	std::shared_ptr<const segment> write_segment(const std::string& data);
+	void merge();
+	void publish(const std::shared_ptr<const memtable>& flushed, const std::shared_ptr<const segment>& written,
+	             const std::vector<std::shared_ptr<const segment>>& merged);
+
+	std::string get_file(uint64_t sequence) const;
+	void insert_peer(std::vector<peer>& peers, const network::address& address, clock::time_point expires) const;
+};
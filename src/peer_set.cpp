@@ -0,0 +1,189 @@
+#include "std_include.hpp"
+#include "peer_set.hpp"
+
+namespace
+{
+	constexpr size_t initial_capacity = 16;
+	constexpr uint8_t ipv4_mapped_prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+}
+
+peer_set::peer_set(const size_t max_size)
+	: max_size_(max_size)
+{
+}
+
+bool peer_set::pack(const network::address& address, key& result)
+{
+	uint8_t bytes[16]{};
+
+	if (address.is_ipv4())
+	{
+		memcpy(bytes, ipv4_mapped_prefix, sizeof(ipv4_mapped_prefix));
+		memcpy(bytes + 12, &address.get_in_addr().sin_addr, 4);
+	}
+	else if (address.is_ipv6())
+	{
+		memcpy(bytes, &address.get_in6_addr().sin6_addr, 16);
+	}
+	else
+	{
+		return false;
+	}
+
+	memcpy(&result.high, bytes, 8);
+	memcpy(&result.low, bytes + 8, 8);
+	result.port = address.get_port();
+
+	return true;
+}
+
+network::address peer_set::unpack(const key& value)
+{
+	uint8_t bytes[16]{};
+	memcpy(bytes, &value.high, 8);
+	memcpy(bytes + 8, &value.low, 8);
+
+	network::address address{};
+
+	if (!memcmp(bytes, ipv4_mapped_prefix, sizeof(ipv4_mapped_prefix)))
+	{
+		in_addr ip{};
+		memcpy(&ip, bytes + 12, 4);
+		address.set_ipv4(ip);
+	}
+	else
+	{
+		in6_addr ip{};
+		memcpy(&ip, bytes, 16);
+		address.set_ipv6(ip);
+	}
+
+	address.set_port(value.port);
+	return address;
+}
+
+size_t peer_set::hash(const key& value)
+{
+	// splitmix64 finalizer over the folded key
+	auto x = value.high ^ (value.low * 0x9E3779B97F4A7C15ull) ^ (static_cast<uint64_t>(value.port) << 48);
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ull;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBull;
+	x ^= x >> 31;
+	return static_cast<size_t>(x);
+}
+
+size_t peer_set::find_slot(const key& value) const
+{
+	const auto mask = this->keys_.size() - 1;
+	auto slot = hash(value) & mask;
+
+	while (this->used_[slot] && !(this->keys_[slot] == value))
+	{
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+void peer_set::grow()
+{
+	auto keys = std::move(this->keys_);
+	auto used = std::move(this->used_);
+
+	const auto capacity = keys.empty() ? initial_capacity : keys.size() * 2;
+	this->keys_.assign(capacity, key{});
+	this->used_.assign(capacity, 0);
+
+	for (size_t i = 0; i < keys.size(); ++i)
+	{
+		if (used[i])
+		{
+			const auto slot = this->find_slot(keys[i]);
+			this->keys_[slot] = keys[i];
+			this->used_[slot] = 1;
+		}
+	}
+}
+
+bool peer_set::insert(const network::address& address)
+{
+	key value{};
+	if (!pack(address, value))
+	{
+		return false;
+	}
+
+	// Keep the load factor at or below one half
+	if ((this->size_ + 1) * 2 > this->keys_.size())
+	{
+		if (this->size_ >= this->max_size_)
+		{
+			return false;
+		}
+
+		this->grow();
+	}
+
+	const auto slot = this->find_slot(value);
+	if (this->used_[slot])
+	{
+		return false;
+	}
+
+	if (this->size_ >= this->max_size_)
+	{
+		return false;
+	}
+
+	this->keys_[slot] = value;
+	this->used_[slot] = 1;
+	++this->size_;
+
+	return true;
+}
+
+bool peer_set::contains(const network::address& address) const
+{
+	key value{};
+	if (this->keys_.empty() || !pack(address, value))
+	{
+		return false;
+	}
+
+	return this->used_[this->find_slot(value)] != 0;
+}
+
+std::vector<network::address> peer_set::get_addresses() const
+{
+	std::vector<network::address> addresses{};
+	addresses.reserve(this->size_);
+
+	for (size_t i = 0; i < this->keys_.size(); ++i)
+	{
+		if (this->used_[i])
+		{
+			addresses.emplace_back(unpack(this->keys_[i]));
+		}
+	}
+
+	return addresses;
+}
+
+size_t peer_set::size() const
+{
+	return this->size_;
+}
+
+bool peer_set::empty() const
+{
+	return this->size_ == 0;
+}
+
+void peer_set::clear()
+{
+	this->keys_.clear();
+	this->used_.clear();
+	this->size_ = 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "network/address.hpp"
+
+// Flat open addressing set of peer endpoints. IPv4 peers are packed as
+// IPv4-mapped IPv6 addresses, so every slot holds 16 address bytes and a port.
+class peer_set
+{
+public:
+	static constexpr size_t default_max_size = 0x10000;
+
+	peer_set(size_t max_size = default_max_size);
+
+	// Returns true if the peer was not part of the set yet, a full set rejects new peers
+	bool insert(const network::address& address);
+	bool contains(const network::address& address) const;
+
+	std::vector<network::address> get_addresses() const;
+	size_t size() const;
+	bool empty() const;
+	void clear();
+
+private:
+	struct key
+	{
+		uint64_t high{};
+		uint64_t low{};
+		uint16_t port{};
+
+		bool operator==(const key& obj) const
+		{
+			return this->high == obj.high && this->low == obj.low && this->port == obj.port;
+		}
+	};
+
+	size_t max_size_{};
+	size_t size_{};
+	std::vector<key> keys_{};
+	std::vector<uint8_t> used_{};
+
+	static bool pack(const network::address& address, key& result);
+	static network::address unpack(const key& value);
+	static size_t hash(const key& value);
+
+	size_t find_slot(const key& value) const;
+	void grow();
+};
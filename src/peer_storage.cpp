@@ -0,0 +1,364 @@
+#include "std_include.hpp"
+#include "peer_storage.hpp"
+
+namespace
+{
+	constexpr size_t ipv4_record_size = 6;
+	constexpr size_t ipv6_record_size = 18;
+
+	bool pack(const network::address& address, uint8_t* record, size_t& size)
+	{
+		if (address.is_ipv4())
+		{
+			const auto& in = address.get_in_addr();
+			memcpy(record, &in.sin_addr, 4);
+			memcpy(record + 4, &in.sin_port, 2);
+			size = ipv4_record_size;
+			return true;
+		}
+
+		if (address.is_ipv6())
+		{
+			const auto& in6 = address.get_in6_addr();
+			memcpy(record, &in6.sin6_addr, 16);
+			memcpy(record + 16, &in6.sin6_port, 2);
+			size = ipv6_record_size;
+			return true;
+		}
+
+		return false;
+	}
+
+	size_t hash_record(const uint8_t* record, const size_t size)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash = (hash ^ record[i]) * 1099511628211ull;
+		}
+
+		return static_cast<size_t>(hash ^ (hash >> 32));
+	}
+}
+
+packed_peer_storage::packed_peer_storage()
+	: packed_peer_storage(config{})
+{
+}
+
+packed_peer_storage::packed_peer_storage(const config& config, const clock::time_point now)
+	: config_(config)
+	  , start_(now)
+{
+	const auto ttl_buckets = (config.ttl + config.bucket_width - clock::duration{1}) / config.bucket_width;
+	this->ttl_buckets_ = static_cast<uint32_t>(std::max<int64_t>(1, ttl_buckets));
+
+	// A bucket is expired before the ring wraps around to it again
+	this->buckets_.resize(this->ttl_buckets_ + 2);
+}
+
+uint32_t packed_peer_storage::get_bucket(const clock::time_point now) const
+{
+	if (now <= this->start_)
+	{
+		return 0;
+	}
+
+	return static_cast<uint32_t>((now - this->start_) / this->config_.bucket_width);
+}
+
+bool packed_peer_storage::store(const id& hash, const network::address& peer, const clock::time_point now)
+{
+	uint8_t record[ipv6_record_size]{};
+	size_t record_size{};
+	if (!pack(peer, record, record_size))
+	{
+		return false;
+	}
+
+	const auto bucket = this->get_bucket(now);
+	this->advance(bucket);
+
+	auto entry = this->arenas_.find(hash);
+	if (entry == this->arenas_.end())
+	{
+		if (this->statistics_.peers >= this->config_.max_peers)
+		{
+			++this->statistics_.rejected;
+			return false;
+		}
+
+		entry = this->arenas_.emplace(hash, arena{}).first;
+		entry->second.newest = bucket;
+		this->buckets_[bucket % this->buckets_.size()].push_back(hash);
+	}
+
+	auto& arena = entry->second;
+	auto& peers = record_size == ipv4_record_size ? arena.v4 : arena.v6;
+
+	if (arena.newest != bucket)
+	{
+		arena.newest = bucket;
+		this->buckets_[bucket % this->buckets_.size()].push_back(hash);
+	}
+
+	if (!peers.index.empty())
+	{
+		const auto slot = find_slot(peers, record, record_size);
+		if (peers.index[slot])
+		{
+			const auto index = peers.index[slot] - 1;
+			if (peers.stamps[index] != bucket)
+			{
+				peers.stamps[index] = bucket;
+				unlink(peers, index);
+				link_last(peers, index);
+			}
+
+			return true;
+		}
+	}
+
+	if (this->statistics_.peers >= this->config_.max_peers
+		|| (arena.v4.stamps.size() + arena.v6.stamps.size()) >= this->config_.max_peers_per_hash)
+	{
+		++this->statistics_.rejected;
+		return false;
+	}
+
+	insert_record(peers, record, record_size, bucket);
+	++this->statistics_.peers;
+
+	return true;
+}
+
+size_t packed_peer_storage::encode(const id& hash, const int family, const size_t max_peers,
+                                   std::string& output) const
+{
+	const auto entry = this->arenas_.find(hash);
+	if (entry == this->arenas_.end())
+	{
+		return 0;
+	}
+
+	const auto& arena = entry->second;
+	const auto& peers = family == AF_INET ? arena.v4 : arena.v6;
+	const auto record_size = family == AF_INET ? ipv4_record_size : ipv6_record_size;
+
+	const auto available = peers.stamps.size();
+	const auto count = std::min(available, max_peers);
+	if (!count)
+	{
+		return 0;
+	}
+
+	// Rotate the starting point so large swarms hand out different peers each time
+	const auto start = arena.cursor % available;
+	arena.cursor = start + count;
+
+	const auto* data = reinterpret_cast<const char*>(peers.endpoints.data());
+	const auto first = std::min(count, available - start);
+
+	output.append(data + (start * record_size), first * record_size);
+	output.append(data, (count - first) * record_size);
+
+	return count;
+}
+
+void packed_peer_storage::expire(const clock::time_point now)
+{
+	this->advance(this->get_bucket(now));
+}
+
+void packed_peer_storage::advance(const uint32_t bucket)
+{
+	this->current_bucket_ = std::max(this->current_bucket_, bucket);
+
+	while (this->next_expiry_ + this->ttl_buckets_ <= this->current_bucket_)
+	{
+		this->expire_bucket(this->next_expiry_++);
+	}
+}
+
+size_t packed_peer_storage::remove_expired(peers& peers, const size_t record_size, const uint32_t cutoff)
+{
+	size_t removed = 0;
+
+	while (peers.first != no_record && peers.stamps[peers.first] <= cutoff)
+	{
+		const auto* record = peers.endpoints.data() + (peers.first * record_size);
+		remove_record(peers, find_slot(peers, record, record_size), record_size);
+		++removed;
+	}
+
+	return removed;
+}
+
+void packed_peer_storage::expire_bucket(const uint32_t bucket)
+{
+	auto& hashes = this->buckets_[bucket % this->buckets_.size()];
+
+	for (const auto& hash : hashes)
+	{
+		const auto entry = this->arenas_.find(hash);
+		if (entry == this->arenas_.end())
+		{
+			continue;
+		}
+
+		auto& arena = entry->second;
+		size_t removed{};
+
+		if (arena.newest <= bucket)
+		{
+			removed = arena.v4.stamps.size() + arena.v6.stamps.size();
+			this->arenas_.erase(entry);
+		}
+		else
+		{
+			removed = remove_expired(arena.v4, ipv4_record_size, bucket)
+				+ remove_expired(arena.v6, ipv6_record_size, bucket);
+		}
+
+		this->statistics_.peers -= removed;
+		this->statistics_.expired += removed;
+	}
+
+	hashes.clear();
+	hashes.shrink_to_fit();
+}
+
+size_t packed_peer_storage::find_slot(const peers& peers, const uint8_t* record, const size_t record_size)
+{
+	const auto mask = peers.index.size() - 1;
+	auto slot = hash_record(record, record_size) & mask;
+
+	while (peers.index[slot]
+		&& memcmp(peers.endpoints.data() + ((peers.index[slot] - 1) * record_size), record, record_size))
+	{
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+void packed_peer_storage::insert_record(peers& peers, const uint8_t* record, const size_t record_size,
+                                        const uint32_t stamp)
+{
+	const auto count = peers.stamps.size();
+	if ((count + 1) * 2 > peers.index.size())
+	{
+		rebuild_index(peers, record_size, std::max<size_t>(16, peers.index.size() * 2));
+	}
+
+	const auto slot = find_slot(peers, record, record_size);
+
+	peers.endpoints.insert(peers.endpoints.end(), record, record + record_size);
+	peers.stamps.push_back(stamp);
+	peers.older.push_back(no_record);
+	peers.newer.push_back(no_record);
+	peers.index[slot] = static_cast<uint32_t>(count + 1);
+
+	link_last(peers, static_cast<uint32_t>(count));
+}
+
+void packed_peer_storage::remove_record(peers& peers, size_t slot, const size_t record_size)
+{
+	const auto mask = peers.index.size() - 1;
+	const auto removed = peers.index[slot] - 1;
+	unlink(peers, removed);
+
+	// Backward shift deletion, later records of the probe sequence move up into the gap
+	for (auto next = (slot + 1) & mask; peers.index[next]; next = (next + 1) & mask)
+	{
+		const auto* record = peers.endpoints.data() + ((peers.index[next] - 1) * record_size);
+		const auto ideal = hash_record(record, record_size) & mask;
+
+		if (((next - ideal) & mask) >= ((next - slot) & mask))
+		{
+			peers.index[slot] = peers.index[next];
+			slot = next;
+		}
+	}
+
+	peers.index[slot] = 0;
+
+	// The last record fills the hole, the arena stays packed for encode
+	const auto last = static_cast<uint32_t>(peers.stamps.size() - 1);
+	if (removed != last)
+	{
+		auto* endpoints = peers.endpoints.data();
+		peers.index[find_slot(peers, endpoints + (last * record_size), record_size)] = removed + 1;
+
+		memcpy(endpoints + (removed * record_size), endpoints + (last * record_size), record_size);
+		peers.stamps[removed] = peers.stamps[last];
+
+		const auto older = peers.older[last];
+		const auto newer = peers.newer[last];
+		peers.older[removed] = older;
+		peers.newer[removed] = newer;
+		(older != no_record ? peers.newer[older] : peers.first) = removed;
+		(newer != no_record ? peers.older[newer] : peers.last) = removed;
+	}
+
+	peers.stamps.pop_back();
+	peers.older.pop_back();
+	peers.newer.pop_back();
+	peers.endpoints.resize(last * record_size);
+
+	if (peers.index.size() > 16 && peers.stamps.size() * 8 < peers.index.size())
+	{
+		rebuild_index(peers, record_size, peers.index.size() / 2);
+	}
+}
+
+void packed_peer_storage::rebuild_index(peers& peers, const size_t record_size, const size_t slots)
+{
+	peers.index.assign(slots, 0);
+
+	for (size_t i = 0; i < peers.stamps.size(); ++i)
+	{
+		const auto slot = find_slot(peers, peers.endpoints.data() + (i * record_size), record_size);
+		peers.index[slot] = static_cast<uint32_t>(i + 1);
+	}
+}
+
+void packed_peer_storage::link_last(peers& peers, const uint32_t record)
+{
+	peers.older[record] = peers.last;
+	peers.newer[record] = no_record;
+	(peers.last != no_record ? peers.newer[peers.last] : peers.first) = record;
+	peers.last = record;
+}
+
+void packed_peer_storage::unlink(peers& peers, const uint32_t record)
+{
+	const auto older = peers.older[record];
+	const auto newer = peers.newer[record];
+	(older != no_record ? peers.newer[older] : peers.first) = newer;
+	(newer != no_record ? peers.older[newer] : peers.last) = older;
+}
+
+peer_storage::statistics packed_peer_storage::get_statistics() const
+{
+	auto statistics = this->statistics_;
+	statistics.hashes = this->arenas_.size();
+	statistics.memory = 0;
+
+	for (const auto& entry : this->arenas_)
+	{
+		const auto& arena = entry.second;
+		statistics.memory += sizeof(entry) + arena.v4.endpoints.capacity() + arena.v6.endpoints.capacity()
+			+ (arena.v4.stamps.capacity() + arena.v6.stamps.capacity()) * sizeof(uint32_t)
+			+ (arena.v4.index.capacity() + arena.v6.index.capacity()) * sizeof(uint32_t)
+			+ (arena.v4.older.capacity() + arena.v4.newer.capacity() + arena.v6.older.capacity()
+				+ arena.v6.newer.capacity()) * sizeof(uint32_t);
+	}
+
+	for (const auto& bucket : this->buckets_)
+	{
+		statistics.memory += bucket.capacity() * sizeof(id);
+	}
+
+	return statistics;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "routing_table.hpp"
+
+// Storage for peers announced to this node through announce_peer
+class peer_storage
+{
+public:
+	using id = routing_table::id;
+	using clock = std::chrono::steady_clock;
+
+	struct statistics
+	{
+		size_t hashes{};
+		size_t peers{};
+		size_t memory{};
+		uint64_t rejected{};
+		uint64_t expired{};
+	};
+
+	virtual ~peer_storage() = default;
+
+	virtual bool store(const id& hash, const network::address& peer, clock::time_point now) = 0;
+
+	// Appends up to max_peers compact endpoints of the given family (6 bytes for AF_INET,
+	// 18 bytes for AF_INET6) in the format of a get_peers response, returns the count
+	virtual size_t encode(const id& hash, int family, size_t max_peers, std::string& output) const = 0;
+
+	virtual void expire(clock::time_point now) = 0;
+	virtual statistics get_statistics() const = 0;
+};
+
+// Keeps the peers of every info hash in packed arenas that already hold the wire format,
+// so answering is a copy. An open addressing index per arena finds a re-announced peer
+// without scanning, and a list through the records keeps them from the oldest announce to
+// the newest. Every bucket remembers which hashes it touched, expiring a bucket only visits
+// those hashes and only removes from the front of their lists.
+class packed_peer_storage final : public peer_storage
+{
+public:
+	struct config
+	{
+		size_t max_peers{1 << 22};
+		size_t max_peers_per_hash{1000};
+		clock::duration ttl{std::chrono::minutes(30)};
+		clock::duration bucket_width{std::chrono::minutes(1)};
+	};
+
+	packed_peer_storage();
+	packed_peer_storage(const config& config, clock::time_point now = clock::now());
+
+	bool store(const id& hash, const network::address& peer, clock::time_point now) override;
+	size_t encode(const id& hash, int family, size_t max_peers, std::string& output) const override;
+	void expire(clock::time_point now) override;
+	statistics get_statistics() const override;
+
+private:
+	static constexpr uint32_t no_record = UINT32_MAX;
+
+	struct peers
+	{
+		std::vector<uint8_t> endpoints{};
+		std::vector<uint32_t> stamps{};
+		// Record index plus one, zero marks a free slot. Never more than half full.
+		std::vector<uint32_t> index{};
+		// Announce order, the first record is the oldest
+		std::vector<uint32_t> older{};
+		std::vector<uint32_t> newer{};
+		uint32_t first{no_record};
+		uint32_t last{no_record};
+	};
+
+	struct arena
+	{
+		peers v4{};
+		peers v6{};
+		uint32_t newest{};
+		mutable size_t cursor{};
+	};
+
+	config config_{};
+	clock::time_point start_{};
+	uint32_t ttl_buckets_{};
+
+	uint32_t current_bucket_{};
+	uint32_t next_expiry_{};
+	std::vector<std::vector<id>> buckets_{};
+
+	std::unordered_map<id, arena, routing_table::id_hash> arenas_{};
+	statistics statistics_{};
+
+	uint32_t get_bucket(clock::time_point now) const;
+	void advance(uint32_t bucket);
+	void expire_bucket(uint32_t bucket);
+
+	static size_t remove_expired(peers& peers, size_t record_size, uint32_t cutoff);
+
+	static size_t find_slot(const peers& peers, const uint8_t* record, size_t record_size);
+	static void insert_record(peers& peers, const uint8_t* record, size_t record_size, uint32_t stamp);
+	static void remove_record(peers& peers, size_t slot, size_t record_size);
+	static void rebuild_index(peers& peers, size_t record_size, size_t slots);
+	static void link_last(peers& peers, uint32_t record);
+	static void unlink(peers& peers, uint32_t record);
+};
@@ -0,0 +1,227 @@
+#include "std_include.hpp"
+#include "pipeline.hpp"
+
+#include "network/reactor.hpp"
+
+pipeline::stage::stage(const size_t capacity)
+	: ring(capacity)
+{
+}
+
+pipeline::slot* pipeline::stage::begin_push()
+{
+	auto* entry = this->ring.begin_push();
+	if (!entry)
+	{
+		++this->dropped;
+	}
+
+	return entry;
+}
+
+void pipeline::stage::end_push()
+{
+	this->ring.end_push();
+	++this->packets;
+
+	const auto depth = this->ring.size();
+	if (depth > this->max_depth.load(std::memory_order_relaxed))
+	{
+		this->max_depth = depth;
+	}
+}
+
+pipeline::stage_statistics pipeline::stage::get_statistics() const
+{
+	stage_statistics statistics{};
+	statistics.packets = this->packets;
+	statistics.dropped = this->dropped;
+	statistics.depth = this->ring.size();
+	statistics.max_depth = this->max_depth;
+
+	return statistics;
+}
+
+pipeline::pipeline(network::io_backend& io, network::io_backend& io6, const size_t capacity)
+	: io_(&io)
+	  , io6_(&io6)
+	  , receive_v4_(capacity)
+	  , receive_v6_(capacity)
+	  , send_(capacity)
+	  , queue_(io)
+	  , queue6_(io6)
+{
+	this->threads_.emplace_back([this]()
+	{
+		this->run_receiver(*this->io_, this->receive_v4_, dht::protocol::v4);
+	});
+
+	this->threads_.emplace_back([this]()
+	{
+		this->run_receiver(*this->io6_, this->receive_v6_, dht::protocol::v6);
+	});
+
+	this->threads_.emplace_back([this]()
+	{
+		this->run_sender();
+	});
+}
+
+pipeline::~pipeline()
+{
+	this->stop_ = true;
+	this->send_event_.notify();
+
+	for (auto& thread : this->threads_)
+	{
+		if (thread.joinable())
+		{
+			thread.join();
+		}
+	}
+}
+
+void pipeline::send(const dht::protocol protocol, const network::endpoint& destination, const std::string_view data)
+{
+	auto* entry = this->send_.begin_push();
+	if (!entry)
+	{
+		return;
+	}
+
+	if (data.size() > entry->data.size())
+	{
+		++this->send_.dropped;
+		return;
+	}
+
+	entry->protocol = protocol;
+	entry->address.set_address(&destination.get_addr(), destination.get_size());
+	entry->size = data.size();
+	memcpy(entry->data.data(), data.data(), data.size());
+
+	this->send_.end_push();
+}
+
+void pipeline::flush()
+{
+	this->send_event_.notify();
+}
+
+void pipeline::wait_until(const clock::time_point time_point)
+{
+	this->receive_event_.wait_until(time_point);
+}
+
+size_t pipeline::receive(const packet_handler& handler)
+{
+	const auto count = this->receive(handler, this->receive_v4_) + this->receive(handler, this->receive_v6_);
+	if (count)
+	{
+		this->flush();
+	}
+
+	return count;
+}
+
+size_t pipeline::receive(const packet_handler& handler, stage& stage)
+{
+	size_t count = 0;
+	network::packet packet{};
+
+	while (const auto* entry = stage.ring.front())
+	{
+		packet.address = entry->address;
+		packet.data = std::string_view{entry->data.data(), entry->size};
+		packet.timestamp = entry->timestamp;
+
+		handler(entry->protocol, packet);
+		stage.ring.pop();
+		++count;
+	}
+
+	return count;
+}
+
+pipeline::statistics pipeline::get_statistics() const
+{
+	auto statistics = this->send_statistics_.access<pipeline::statistics>([](const pipeline::statistics& s)
+	{
+		return s;
+	});
+
+	statistics.receive_v4 = this->receive_v4_.get_statistics();
+	statistics.receive_v6 = this->receive_v6_.get_statistics();
+	statistics.send = this->send_.get_statistics();
+
+	return statistics;
+}
+
+void pipeline::run_receiver(network::io_backend& io, stage& stage, const dht::protocol protocol)
+{
+	network::packet_batch batch{};
+	network::reactor reactor{};
+
+	reactor.add_socket(io.get_descriptor(), [&]()
+	{
+		while (io.receive_batch(batch))
+		{
+			for (const auto& packet : batch)
+			{
+				auto* entry = stage.begin_push();
+				if (!entry)
+				{
+					continue;
+				}
+
+				entry->protocol = protocol;
+				entry->address = packet.address;
+				entry->timestamp = packet.timestamp;
+				entry->size = std::min(packet.data.size(), entry->data.size());
+				memcpy(entry->data.data(), packet.data.data(), entry->size);
+
+				stage.end_push();
+			}
+
+			this->receive_event_.notify();
+		}
+	});
+
+	// The reactor only returns on events, wake up regularly to notice shutdown
+	std::function<void()> check_stop{};
+	check_stop = [&]()
+	{
+		reactor.add_timer(100ms, check_stop);
+	};
+
+	check_stop();
+
+	while (!this->stop_)
+	{
+		reactor.run_once();
+	}
+}
+
+void pipeline::run_sender()
+{
+	while (!this->stop_)
+	{
+		this->send_event_.wait_until(clock::now() + 100ms);
+
+		while (const auto* entry = this->send_.ring.front())
+		{
+			auto& queue = entry->protocol == dht::protocol::v4 ? this->queue_ : this->queue6_;
+			queue.queue(entry->address, std::string_view{entry->data.data(), entry->size});
+			this->send_.ring.pop();
+		}
+
+		this->queue_.flush();
+		this->queue6_.flush();
+
+		this->send_statistics_.access([this](statistics& statistics)
+		{
+			statistics.send_v4 = this->queue_.get_statistics();
+			statistics.send_v6 = this->queue6_.get_statistics();
+		});
+	}
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "dht.hpp"
+#include "network/io_backend.hpp"
+#include "utils/concurrency.hpp"
+
+// Runs the receive and send side of a node on dedicated threads.
+// The thread that owns the dht drains the inbound rings and feeds the outbound ring.
+class pipeline
+{
+public:
+	using clock = std::chrono::steady_clock;
+	using packet_handler = std::function<void(dht::protocol protocol, const network::packet& packet)>;
+
+	struct stage_statistics
+	{
+		uint64_t packets{};
+		uint64_t dropped{};
+		size_t depth{};
+		size_t max_depth{};
+	};
+
+	struct statistics
+	{
+		stage_statistics receive_v4{};
+		stage_statistics receive_v6{};
+		stage_statistics send{};
+		network::send_queue::statistics send_v4{};
+		network::send_queue::statistics send_v6{};
+	};
+
+	pipeline(network::io_backend& io, network::io_backend& io6, size_t capacity = 512);
+	~pipeline();
+
+	pipeline(const pipeline&) = delete;
+	pipeline& operator=(const pipeline&) = delete;
+
+	pipeline(pipeline&&) = delete;
+	pipeline& operator=(pipeline&&) = delete;
+
+	// Protocol thread only
+	void send(dht::protocol protocol, const network::endpoint& destination, std::string_view data);
+	void flush();
+
+	void wait_until(clock::time_point time_point);
+	size_t receive(const packet_handler& handler);
+
+	statistics get_statistics() const;
+
+private:
+	struct slot
+	{
+		dht::protocol protocol{};
+		network::address address{};
+		std::chrono::system_clock::time_point timestamp{};
+		size_t size{};
+		std::array<char, 0x2000> data{};
+	};
+
+	struct stage
+	{
+		utils::concurrency::spsc_ring<slot> ring;
+		std::atomic<uint64_t> packets{0};
+		std::atomic<uint64_t> dropped{0};
+		std::atomic<size_t> max_depth{0};
+
+		stage(size_t capacity);
+
+		slot* begin_push();
+		void end_push();
+
+		stage_statistics get_statistics() const;
+	};
+
+	network::io_backend* io_{};
+	network::io_backend* io6_{};
+
+	stage receive_v4_;
+	stage receive_v6_;
+	stage send_;
+
+	utils::concurrency::event receive_event_{};
+	utils::concurrency::event send_event_{};
+
+	network::send_queue queue_;
+	network::send_queue queue6_;
+	utils::concurrency::container<statistics> send_statistics_{};
+
+	std::atomic_bool stop_{false};
+	std::vector<std::thread> threads_{};
+
+	void run_receiver(network::io_backend& io, stage& stage, dht::protocol protocol);
+	void run_sender();
+
+	size_t receive(const packet_handler& handler, stage& stage);
+};
@@ -0,0 +1,502 @@
+#include <std_include.hpp>
+
+#include "capture.hpp"
+#include "console.hpp"
+#include "dht.hpp"
+#include "utils/sha256.hpp"
+
+#include <random>
+
+// Feeds a packet capture recorded with --capture into dht::on_data, without any network access.
+// --routing-benchmark compares routing_table lookups against a linear scan over an array of nodes.
+// --storage-benchmark fills a packed_peer_storage with announced peers, answers from it and expires it.
+// --hash-benchmark hashes token sized messages and a large buffer with every SHA-256 backend the CPU supports.
+namespace
+{
+	struct options
+	{
+		std::string capture{};
+		std::string store{"./replay.store"};
+		size_t iterations{1};
+		// Replay with the recorded inter-packet gaps instead of as fast as possible
+		bool paced{false};
+		size_t routing_benchmark_nodes{0};
+		size_t storage_benchmark_peers{0};
+		size_t hash_benchmark_messages{0};
+	};
+
+	struct transmitter_statistics
+	{
+		uint64_t packets{};
+		uint64_t bytes{};
+	};
+
+	std::vector<capture::record> load_capture(const std::string& file)
+	{
+		capture::reader reader{file};
+		std::vector<capture::record> records{};
+
+		capture::record record{};
+		while (reader.read(record))
+		{
+			records.emplace_back(std::move(record));
+			record = {};
+		}
+
+		return records;
+	}
+
+	// Byte wise XOR comparison, like the dht library does while walking its buckets
+	bool is_closer(const dht::id& target, const dht::id& a, const dht::id& b)
+	{
+		for (size_t i = 0; i < target.size(); ++i)
+		{
+			const auto distance_a = static_cast<uint8_t>(a[i] ^ target[i]);
+			const auto distance_b = static_cast<uint8_t>(b[i] ^ target[i]);
+
+			if (distance_a != distance_b)
+			{
+				return distance_a < distance_b;
+			}
+		}
+
+		return false;
+	}
+
+	void run_routing_benchmark(const size_t node_count)
+	{
+		constexpr size_t lookups = 2000;
+		constexpr size_t k = 8;
+
+		std::mt19937_64 engine{1337};
+		const auto random_id = [&engine]()
+		{
+			dht::id value{};
+			for (auto& byte : value)
+			{
+				byte = static_cast<unsigned char>(engine());
+			}
+
+			return value;
+		};
+
+		routing_table table{random_id(), node_count};
+		std::vector<dht::node> nodes{};
+		nodes.reserve(node_count);
+
+		for (size_t i = 0; i < node_count; ++i)
+		{
+			dht::node node{};
+			node.id_ = random_id();
+			node.address = network::address{"127.0.0.1"};
+			node.address.set_port(static_cast<uint16_t>(i));
+
+			if (table.insert(node.id_, node.address))
+			{
+				nodes.emplace_back(std::move(node));
+			}
+		}
+
+		std::vector<dht::id> targets{};
+		for (size_t i = 0; i < lookups; ++i)
+		{
+			targets.emplace_back(random_id());
+		}
+
+		using clock = std::chrono::steady_clock;
+
+		size_t mismatches = 0;
+		std::vector<dht::node> results{};
+		std::vector<const dht::node*> order{};
+
+		const auto baseline_start = clock::now();
+		std::vector<dht::id> baseline_results{};
+
+		for (const auto& target : targets)
+		{
+			order.clear();
+			for (const auto& node : nodes)
+			{
+				order.push_back(&node);
+			}
+
+			const auto count = std::min(k, order.size());
+			std::partial_sort(order.begin(), order.begin() + static_cast<ptrdiff_t>(count), order.end(),
+			                  [&target](const dht::node* a, const dht::node* b)
+			                  {
+				                  return is_closer(target, a->id_, b->id_);
+			                  });
+
+			baseline_results.push_back(count ? order.front()->id_ : dht::id{});
+		}
+
+		const auto baseline_time = clock::now() - baseline_start;
+		const auto table_start = clock::now();
+
+		for (size_t i = 0; i < targets.size(); ++i)
+		{
+			table.find_closest(targets[i], k, results);
+			if (!results.empty() && results.front().id_ != baseline_results[i])
+			{
+				++mismatches;
+			}
+		}
+
+		const auto table_time = clock::now() - table_start;
+
+		const auto per_lookup = [](const clock::duration duration)
+		{
+			return std::chrono::duration<double, std::nano>(duration).count() / static_cast<double>(lookups);
+		};
+
+		console::log("%zu nodes, %zu lookups of the %zu closest nodes", nodes.size(), lookups, k);
+		console::log("Array scan: %.0f ns per lookup", per_lookup(baseline_time));
+		console::log("Routing table: %.0f ns per lookup (%zu mismatches)", per_lookup(table_time), mismatches);
+	}
+
+	void run_storage_benchmark(const size_t peer_count)
+	{
+		constexpr size_t peers_per_hash = 64;
+		constexpr size_t answer_size = 50;
+
+		using clock = peer_storage::clock;
+
+		packed_peer_storage::config config{};
+		config.max_peers = peer_count;
+
+		auto now = clock::now();
+		packed_peer_storage storage{config, now};
+
+		std::mt19937_64 engine{1337};
+		std::vector<dht::id> hashes(std::max<size_t>(1, peer_count / peers_per_hash));
+		for (auto& hash : hashes)
+		{
+			for (auto& byte : hash)
+			{
+				byte = static_cast<unsigned char>(engine());
+			}
+		}
+
+		std::vector<network::address> peers{};
+		peers.reserve(peer_count);
+
+		for (size_t i = 0; i < peer_count; ++i)
+		{
+			network::address peer{};
+			if (i % 8 == 0)
+			{
+				in6_addr ip{};
+				memcpy(&ip, &i, sizeof(i));
+				peer.set_ipv6(ip);
+			}
+			else
+			{
+				peer.set_ipv4(static_cast<uint32_t>(engine()));
+			}
+
+			peer.set_port(static_cast<uint16_t>(engine()));
+
+			peers.emplace_back(std::move(peer));
+		}
+
+		const auto per_operation = [](const clock::duration duration, const size_t count)
+		{
+			return std::chrono::duration<double, std::nano>(duration).count() / static_cast<double>(count);
+		};
+
+		const auto store_start = clock::now();
+		for (size_t i = 0; i < peer_count; ++i)
+		{
+			storage.store(hashes[i % hashes.size()], peers[i], now);
+		}
+
+		const auto store_time = clock::now() - store_start;
+		const auto statistics = storage.get_statistics();
+
+		// Re-announces only refresh the time bucket of the existing record
+		now += std::chrono::minutes(10);
+		const auto refresh_start = clock::now();
+		for (size_t i = 0; i < peer_count; i += 2)
+		{
+			storage.store(hashes[i % hashes.size()], peers[i], now);
+		}
+
+		const auto refresh_time = clock::now() - refresh_start;
+
+		std::string output{};
+		size_t encoded = 0;
+		const auto encode_start = clock::now();
+		for (size_t i = 0; i < hashes.size() * 4; ++i)
+		{
+			output.clear();
+			encoded += storage.encode(hashes[i % hashes.size()], AF_INET, answer_size, output);
+		}
+
+		const auto encode_time = clock::now() - encode_start;
+
+		// Half the peers were never refreshed and fall out first
+		now += std::chrono::minutes(25);
+		const auto expire_start = clock::now();
+		storage.expire(now);
+		const auto expire_time = clock::now() - expire_start;
+		const auto expired = storage.get_statistics();
+
+		console::log("%zu peers announced for %zu hashes, %zu stored, %llu rejected", peer_count, hashes.size(),
+		             statistics.peers, static_cast<unsigned long long>(statistics.rejected));
+		console::log("Store: %.0f ns per announce, %.1f bytes per peer", per_operation(store_time, peer_count),
+		             static_cast<double>(statistics.memory) / static_cast<double>(std::max<size_t>(1, statistics.peers)));
+		console::log("Refresh: %.0f ns per announce", per_operation(refresh_time, (peer_count + 1) / 2));
+		console::log("Encode: %.0f ns per response of up to %zu peers (%zu peers)",
+		             per_operation(encode_time, hashes.size() * 4), answer_size, encoded);
+		console::log("Expire: %.2f ms for %llu peers, %zu left",
+		             std::chrono::duration<double, std::milli>(expire_time).count(),
+		             static_cast<unsigned long long>(expired.expired), expired.peers);
+
+		// A full swarm re-announcing every bucket, while the buckets it leaves behind expire
+		packed_peer_storage popular{packed_peer_storage::config{}, now};
+		const auto swarm_size = std::min(peers.size(), packed_peer_storage::config{}.max_peers_per_hash);
+		constexpr size_t rounds = 60;
+
+		const auto popular_start = clock::now();
+		for (size_t round = 0; round < rounds; ++round)
+		{
+			now += std::chrono::minutes(1);
+			for (size_t i = 0; i < swarm_size; ++i)
+			{
+				popular.store(hashes.front(), peers[(i + round) % peers.size()], now);
+			}
+		}
+
+		const auto popular_time = clock::now() - popular_start;
+		console::log("Popular hash: %.0f ns per announce, %zu peers", per_operation(popular_time, swarm_size * rounds),
+		             popular.get_statistics().peers);
+	}
+
+	void run_hash_benchmark(const size_t message_count)
+	{
+		// Secret, address and port, like the tokens dht_hash produces
+		constexpr size_t message_size = 32;
+		constexpr size_t buffer_size = 1 << 20;
+
+		using clock = std::chrono::steady_clock;
+
+		std::mt19937_64 engine{1337};
+		std::string data(message_count * message_size + buffer_size, '\0');
+		for (auto& byte : data)
+		{
+			byte = static_cast<char>(engine());
+		}
+
+		std::vector<std::string_view> messages{};
+		messages.reserve(message_count);
+
+		for (size_t i = 0; i < message_count; ++i)
+		{
+			messages.emplace_back(data.data() + (i * message_size), message_size);
+		}
+
+		const std::string_view buffer{data.data() + (message_count * message_size), buffer_size};
+		std::vector<utils::sha256::digest> digests(message_count);
+
+		const auto per_operation = [](const clock::duration duration, const size_t count)
+		{
+			return std::chrono::duration<double, std::nano>(duration).count() / static_cast<double>(count);
+		};
+
+		const auto active = utils::sha256::get_backend();
+		std::optional<utils::sha256::digest> reference{};
+
+		for (const auto backend : {utils::sha256::backend::portable, utils::sha256::backend::sha_ni})
+		{
+			const auto* name = utils::sha256::get_backend_name(backend);
+			if (!utils::sha256::set_backend(backend))
+			{
+				console::log("%s: not supported by this CPU", name);
+				continue;
+			}
+
+			const auto single_start = clock::now();
+			for (size_t i = 0; i < message_count; ++i)
+			{
+				digests[i] = utils::sha256::compute(messages[i]);
+			}
+
+			const auto single_time = clock::now() - single_start;
+
+			const auto batch_start = clock::now();
+			utils::sha256::compute(messages.data(), messages.size(), digests.data());
+			const auto batch_time = clock::now() - batch_start;
+
+			constexpr size_t buffer_rounds = 16;
+			utils::sha256::digest digest{};
+
+			const auto buffer_start = clock::now();
+			for (size_t i = 0; i < buffer_rounds; ++i)
+			{
+				digest = utils::sha256::compute(buffer);
+			}
+
+			const auto buffer_time = clock::now() - buffer_start;
+			const auto seconds = std::chrono::duration<double>(buffer_time).count();
+
+			// Every backend has to agree with the first one
+			const auto matches = !reference || *reference == digest;
+			reference = digest;
+
+			console::log("%s: %.0f ns per message, %.0f ns per message in a batch, %.0f MB/s%s", name,
+			             per_operation(single_time, message_count), per_operation(batch_time, message_count),
+			             static_cast<double>(buffer_size * buffer_rounds) / (1024.0 * 1024.0) / seconds,
+			             matches ? "" : " (digest mismatch!)");
+		}
+
+		utils::sha256::set_backend(active);
+		console::log("Active backend: %s", utils::sha256::get_backend_name(active));
+	}
+
+	void unsafe_main(const options& options)
+	{
+		if (options.routing_benchmark_nodes)
+		{
+			run_routing_benchmark(options.routing_benchmark_nodes);
+			return;
+		}
+
+		if (options.storage_benchmark_peers)
+		{
+			run_storage_benchmark(options.storage_benchmark_peers);
+			return;
+		}
+
+		if (options.hash_benchmark_messages)
+		{
+			run_hash_benchmark(options.hash_benchmark_messages);
+			return;
+		}
+
+		const auto records = load_capture(options.capture);
+		if (records.empty())
+		{
+			throw std::runtime_error("Capture contains no packets");
+		}
+
+		size_t bytes = 0;
+		for (const auto& record : records)
+		{
+			bytes += record.data.size();
+		}
+
+		console::log("Loaded %zu packets (%zu bytes) from %s", records.size(), bytes, options.capture.data());
+
+		transmitter_statistics sent{};
+		dht dht{
+			[&sent](dht::protocol, const network::endpoint&, const std::string_view data)
+			{
+				++sent.packets;
+				sent.bytes += data.size();
+			},
+			options.store,
+			false,
+		};
+
+		using clock = std::chrono::steady_clock;
+
+		const auto start = clock::now();
+		auto next_frame = start;
+
+		for (size_t i = 0; i < options.iterations; ++i)
+		{
+			const auto iteration_start = clock::now();
+			const auto first_timestamp = records.front().timestamp;
+
+			for (const auto& record : records)
+			{
+				if (options.paced)
+				{
+					const auto offset = std::chrono::duration_cast<clock::duration>(record.timestamp - first_timestamp);
+					std::this_thread::sleep_until(iteration_start + offset);
+				}
+
+				const auto now = clock::now();
+				if (now >= next_frame)
+				{
+					next_frame = now + dht.run_frame();
+				}
+
+				const auto protocol = record.address.is_ipv4() ? dht::protocol::v4 : dht::protocol::v6;
+				dht.on_data(protocol, record.address, record.data);
+			}
+		}
+
+		const auto elapsed = std::chrono::duration<double>(clock::now() - start).count();
+		const auto packets = static_cast<double>(records.size() * options.iterations);
+		const auto megabytes = static_cast<double>(bytes * options.iterations) / (1024.0 * 1024.0);
+
+		console::log("Replayed %.0f packets in %.3f s: %.0f packets/s, %.2f MiB/s", packets, elapsed,
+		             packets / elapsed, megabytes / elapsed);
+		console::log("Node sent %llu packets (%llu bytes)", static_cast<unsigned long long>(sent.packets),
+		             static_cast<unsigned long long>(sent.bytes));
+	}
+
+	options parse_options(const int argc, const char** argv)
+	{
+		options options{};
+
+		for (int i = 1; i < argc; ++i)
+		{
+			const std::string_view argument{argv[i]};
+
+			if (argument == "--paced")
+			{
+				options.paced = true;
+			}
+			else if (argument == "--iterations" && (i + 1) < argc)
+			{
+				options.iterations = static_cast<size_t>(std::max(1, atoi(argv[++i])));
+			}
+			else if (argument == "--store" && (i + 1) < argc)
+			{
+				options.store = argv[++i];
+			}
+			else if (argument == "--routing-benchmark" && (i + 1) < argc)
+			{
+				options.routing_benchmark_nodes = static_cast<size_t>(std::max(1, atoi(argv[++i])));
+			}
+			else if (argument == "--storage-benchmark" && (i + 1) < argc)
+			{
+				options.storage_benchmark_peers = static_cast<size_t>(std::max(1, atoi(argv[++i])));
+			}
+			else if (argument == "--hash-benchmark" && (i + 1) < argc)
+			{
+				options.hash_benchmark_messages = static_cast<size_t>(std::max(1, atoi(argv[++i])));
+			}
+			else
+			{
+				options.capture = argv[i];
+			}
+		}
+
+		if (options.capture.empty() && !options.routing_benchmark_nodes && !options.storage_benchmark_peers
+			&& !options.hash_benchmark_messages)
+		{
+			throw std::runtime_error(
+				"Usage: anon-replay <capture> [--paced] [--iterations <count>] [--store <file>] | --routing-benchmark <nodes> | --storage-benchmark <peers> | --hash-benchmark <messages>");
+		}
+
+		return options;
+	}
+}
+
+int main(const int argc, const char** argv)
+{
+	try
+	{
+		unsafe_main(parse_options(argc, argv));
+	}
+	catch (std::exception& e)
+	{
+		console::error("Fatal error: %s\n", e.what());
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,331 @@
+#include "std_include.hpp"
+#include "routing_table.hpp"
+
+namespace
+{
+	uint32_t load_word(const routing_table::id& value, const size_t word)
+	{
+		const auto* data = value.data() + (word * 4);
+		return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+			(static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
+	}
+
+	void store_word(routing_table::id& value, const size_t word, const uint32_t data)
+	{
+		auto* target = value.data() + (word * 4);
+		target[0] = static_cast<unsigned char>(data >> 24);
+		target[1] = static_cast<unsigned char>(data >> 16);
+		target[2] = static_cast<unsigned char>(data >> 8);
+		target[3] = static_cast<unsigned char>(data);
+	}
+}
+
+size_t routing_table::id_hash::operator()(const id& value) const noexcept
+{
+	// Node ids are uniformly distributed, a slice of them is a good enough hash
+	size_t hash{};
+	memcpy(&hash, value.data(), sizeof(hash));
+	return hash;
+}
+
+routing_table::routing_table(const id& local_id, const size_t bucket_size)
+	: local_id_(local_id)
+	  , bucket_size_(bucket_size)
+{
+}
+
+size_t routing_table::get_bucket(const id& local_id, const id& node_id)
+{
+	for (size_t i = 0; i < local_id.size(); ++i)
+	{
+		const auto distance = static_cast<uint8_t>(local_id[i] ^ node_id[i]);
+		if (!distance)
+		{
+			continue;
+		}
+
+		size_t bit = 0;
+		while (!(distance & (0x80 >> bit)))
+		{
+			++bit;
+		}
+
+		return (i * 8) + bit;
+	}
+
+	return bucket_count - 1;
+}
+
+bool routing_table::insert(const id& node_id, const network::address& address, const clock::time_point seen,
+                           std::optional<node>* evicted)
+{
+	const auto existing = this->indices_.find(node_id);
+	if (existing != this->indices_.end())
+	{
+		this->addresses_[existing->second] = address;
+		this->last_seen_[existing->second] = std::max(this->last_seen_[existing->second], seen);
+		return true;
+	}
+
+	const auto bucket = get_bucket(this->local_id_, node_id);
+	if (bucket == bucket_count - 1)
+	{
+		return false;
+	}
+
+	if (this->bucket_sizes_[bucket] >= this->bucket_size_)
+	{
+		size_t oldest = this->size();
+		for (size_t i = 0; i < this->size(); ++i)
+		{
+			if (this->buckets_[i] == bucket && (oldest == this->size() || this->last_seen_[i] < this->last_seen_[oldest]))
+			{
+				oldest = i;
+			}
+		}
+
+		if (oldest == this->size() || (seen - this->last_seen_[oldest]) < stale_time)
+		{
+			return false;
+		}
+
+		if (evicted)
+		{
+			*evicted = node{this->get_id(oldest), this->addresses_[oldest]};
+		}
+
+		this->erase(oldest);
+	}
+
+	const auto index = static_cast<uint32_t>(this->size());
+
+	for (size_t i = 0; i < word_count; ++i)
+	{
+		this->words_[i].push_back(load_word(node_id, i));
+	}
+
+	this->addresses_.push_back(address);
+	this->last_seen_.push_back(seen);
+	this->buckets_.push_back(static_cast<uint8_t>(bucket));
+
+	++this->bucket_sizes_[bucket];
+	this->indices_[node_id] = index;
+
+	return true;
+}
+
+bool routing_table::remove(const id& node_id)
+{
+	const auto entry = this->indices_.find(node_id);
+	if (entry == this->indices_.end())
+	{
+		return false;
+	}
+
+	this->erase(entry->second);
+	return true;
+}
+
+bool routing_table::contains(const id& node_id) const
+{
+	return this->indices_.find(node_id) != this->indices_.end();
+}
+
+std::optional<network::address> routing_table::get_address(const id& node_id) const
+{
+	const auto entry = this->indices_.find(node_id);
+	if (entry == this->indices_.end())
+	{
+		return std::nullopt;
+	}
+
+	return this->addresses_[entry->second];
+}
+
+std::optional<routing_table::id> routing_table::find_id(const network::address& address) const
+{
+	for (size_t i = 0; i < this->addresses_.size(); ++i)
+	{
+		if (this->addresses_[i] == address)
+		{
+			return this->get_id(i);
+		}
+	}
+
+	return std::nullopt;
+}
+
+void routing_table::erase(const size_t index)
+{
+	const auto last = this->size() - 1;
+	const auto node_id = this->get_id(index);
+
+	--this->bucket_sizes_[this->buckets_[index]];
+	this->indices_.erase(node_id);
+
+	if (index != last)
+	{
+		for (auto& column : this->words_)
+		{
+			column[index] = column[last];
+		}
+
+		this->addresses_[index] = this->addresses_[last];
+		this->last_seen_[index] = this->last_seen_[last];
+		this->buckets_[index] = this->buckets_[last];
+		this->indices_[this->get_id(index)] = static_cast<uint32_t>(index);
+	}
+
+	for (auto& column : this->words_)
+	{
+		column.pop_back();
+	}
+
+	this->addresses_.pop_back();
+	this->last_seen_.pop_back();
+	this->buckets_.pop_back();
+}
+
+routing_table::id routing_table::get_id(const size_t index) const
+{
+	id value{};
+	for (size_t i = 0; i < word_count; ++i)
+	{
+		store_word(value, i, this->words_[i][index]);
+	}
+
+	return value;
+}
+
+bool routing_table::is_closer(const id& target, const uint32_t a, const uint32_t b) const
+{
+	for (size_t i = 0; i < word_count; ++i)
+	{
+		const auto word = load_word(target, i);
+		const auto distance_a = this->words_[i][a] ^ word;
+		const auto distance_b = this->words_[i][b] ^ word;
+
+		if (distance_a != distance_b)
+		{
+			return distance_a < distance_b;
+		}
+	}
+
+	return false;
+}
+
+size_t routing_table::find_closest(const id& target, const size_t count, std::vector<node>& results) const
+{
+	results.clear();
+
+	const auto size = this->size();
+	if (!count || !size)
+	{
+		return 0;
+	}
+
+	// The first 64 bits of the distance decide nearly every comparison, the scan over
+	// the two leading columns has no dependencies between iterations and vectorizes
+	const auto target_high = static_cast<uint64_t>(load_word(target, 0)) << 32 | load_word(target, 1);
+	const auto* high = this->words_[0].data();
+	const auto* low = this->words_[1].data();
+
+	this->distances_.resize(size);
+	auto* distances = this->distances_.data();
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		distances[i] = ((static_cast<uint64_t>(high[i]) << 32) | low[i]) ^ target_high;
+	}
+
+	const auto less = [this, &target](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b)
+	{
+		if (a.first != b.first)
+		{
+			return a.first < b.first;
+		}
+
+		return this->is_closer(target, a.second, b.second);
+	};
+
+	// Bounded max-heap of the best candidates so far, nearly every other
+	// entry is rejected by a single comparison against the current worst one
+	auto& heap = this->heap_;
+	heap.clear();
+
+	const auto seed = std::min(count, size);
+	for (size_t i = 0; i < seed; ++i)
+	{
+		heap.emplace_back(distances[i], static_cast<uint32_t>(i));
+	}
+
+	std::make_heap(heap.begin(), heap.end(), less);
+	auto threshold = heap.front().first;
+
+	for (size_t i = seed; i < size; ++i)
+	{
+		if (distances[i] > threshold)
+		{
+			continue;
+		}
+
+		const std::pair<uint64_t, uint32_t> candidate{distances[i], static_cast<uint32_t>(i)};
+		if (!less(candidate, heap.front()))
+		{
+			continue;
+		}
+
+		std::pop_heap(heap.begin(), heap.end(), less);
+		heap.back() = candidate;
+		std::push_heap(heap.begin(), heap.end(), less);
+		threshold = heap.front().first;
+	}
+
+	std::sort_heap(heap.begin(), heap.end(), less);
+
+	results.reserve(heap.size());
+	for (const auto& entry : heap)
+	{
+		node result{};
+		result.id_ = this->get_id(entry.second);
+		result.address = this->addresses_[entry.second];
+		results.emplace_back(std::move(result));
+	}
+
+	return results.size();
+}
+
+std::vector<routing_table::node> routing_table::get_nodes() const
+{
+	std::vector<node> nodes{};
+	nodes.reserve(this->size());
+
+	for (size_t i = 0; i < this->size(); ++i)
+	{
+		node result{};
+		result.id_ = this->get_id(i);
+		result.address = this->addresses_[i];
+		nodes.emplace_back(std::move(result));
+	}
+
+	return nodes;
+}
+
+size_t routing_table::size() const
+{
+	return this->addresses_.size();
+}
+
+void routing_table::clear()
+{
+	for (auto& column : this->words_)
+	{
+		column.clear();
+	}
+
+	this->addresses_.clear();
+	this->last_seen_.clear();
+	this->buckets_.clear();
+	this->bucket_sizes_ = {};
+	this->indices_.clear();
+}
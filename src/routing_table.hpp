@@ -0,0 +1,73 @@
+#pragma once
+
+#include "network/address.hpp"
+#include <array>
+#include <unordered_map>
+
+// Kademlia k-bucket table that keeps node ids in a structure-of-arrays layout.
+// Every id is split into five big-endian 32-bit words with one column per word,
+// which turns the XOR distance scan of find_closest into plain vectorizable loops.
+class routing_table
+{
+public:
+	using id = std::array<unsigned char, 20>;
+	using clock = std::chrono::steady_clock;
+
+	struct node
+	{
+		id id_{};
+		network::address address{};
+	};
+
+	static constexpr size_t default_bucket_size = 8;
+
+	struct id_hash
+	{
+		size_t operator()(const id& value) const noexcept;
+	};
+
+	routing_table(const id& local_id = {}, size_t bucket_size = default_bucket_size);
+
+	// Adds or refreshes a node. A full bucket only accepts the node if one of its entries went stale,
+	// the replaced entry is written to evicted.
+	bool insert(const id& node_id, const network::address& address, clock::time_point seen = clock::now(),
+	            std::optional<node>* evicted = nullptr);
+	bool remove(const id& node_id);
+	bool contains(const id& node_id) const;
+	std::optional<network::address> get_address(const id& node_id) const;
+	// Linear scan over the address column, meant for the rare removal of a failed node
+	std::optional<id> find_id(const network::address& address) const;
+
+	// Writes up to count nodes ordered by XOR distance to target, returns how many were written
+	size_t find_closest(const id& target, size_t count, std::vector<node>& results) const;
+
+	std::vector<node> get_nodes() const;
+	size_t size() const;
+	void clear();
+
+	static size_t get_bucket(const id& local_id, const id& node_id);
+
+private:
+	static constexpr size_t word_count = 5;
+	static constexpr size_t bucket_count = 161;
+	static constexpr auto stale_time = std::chrono::minutes(15);
+
+	id local_id_{};
+	size_t bucket_size_{};
+
+	std::array<std::vector<uint32_t>, word_count> words_{};
+	std::vector<network::address> addresses_{};
+	std::vector<clock::time_point> last_seen_{};
+	std::vector<uint8_t> buckets_{};
+
+	std::array<size_t, bucket_count> bucket_sizes_{};
+	std::unordered_map<id, uint32_t, id_hash> indices_{};
+
+	// Scratch space for find_closest
+	mutable std::vector<uint64_t> distances_{};
+	mutable std::vector<std::pair<uint64_t, uint32_t>> heap_{};
+
+	id get_id(size_t index) const;
+	void erase(size_t index);
+	bool is_closer(const id& target, uint32_t a, uint32_t b) const;
+};
@@ -52,6 +52,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #define ZeroMemory(x, y) memset(x, 0, y)
 
@@ -70,6 +73,7 @@
 #include <cstdint>
 #include <csignal>
 #include <cstdarg>
+#include <cstring>
 
 #include <map>
 #include <atomic>
@@ -87,9 +91,9 @@
 #include <sstream>
 #include <optional>
 #include <unordered_set>
+#include <numeric>
 
 #include <dht.h>
-#include <SHA256.h>
 
 #ifdef _WIN32
 #pragma warning(pop)
@@ -0,0 +1,225 @@
+#include <std_include.hpp>
+
+#include "bencode.hpp"
+
+namespace utils::bencode
+{
+	namespace
+	{
+		constexpr size_t max_depth = 32;
+
+		std::optional<std::string_view> read_string(const std::string_view data, size_t& offset)
+		{
+			size_t length = 0;
+			size_t digits = 0;
+
+			while (offset < data.size() && data[offset] >= '0' && data[offset] <= '9')
+			{
+				length = length * 10 + static_cast<size_t>(data[offset++] - '0');
+				if (++digits > 9)
+				{
+					return {};
+				}
+			}
+
+			if (!digits || offset >= data.size() || data[offset++] != ':' || length > data.size() - offset)
+			{
+				return {};
+			}
+
+			const auto value = data.substr(offset, length);
+			offset += length;
+			return value;
+		}
+
+		std::optional<int64_t> read_integer(const std::string_view data, size_t& offset)
+		{
+			if (offset >= data.size() || data[offset] != 'i')
+			{
+				return {};
+			}
+
+			const auto end = data.find('e', ++offset);
+			if (end == std::string_view::npos || end == offset)
+			{
+				return {};
+			}
+
+			bool negative = false;
+			if (data[offset] == '-')
+			{
+				negative = true;
+				++offset;
+			}
+
+			if (offset == end)
+			{
+				return {};
+			}
+
+			int64_t value = 0;
+			for (; offset < end; ++offset)
+			{
+				const auto c = data[offset];
+				if (c < '0' || c > '9')
+				{
+					return {};
+				}
+
+				// Remote input, anything beyond int64 is malformed
+				const auto digit = static_cast<int64_t>(c - '0');
+				if (value > (INT64_MAX - digit) / 10)
+				{
+					return {};
+				}
+
+				value = value * 10 + digit;
+			}
+
+			++offset;
+			return negative ? -value : value;
+		}
+
+		bool skip_value(const std::string_view data, size_t& offset, const size_t depth = 0)
+		{
+			if (offset >= data.size() || depth > max_depth)
+			{
+				return false;
+			}
+
+			const auto type = data[offset];
+			if (type == 'i')
+			{
+				return read_integer(data, offset).has_value();
+			}
+
+			if (type == 'l' || type == 'd')
+			{
+				++offset;
+
+				while (offset < data.size() && data[offset] != 'e')
+				{
+					if (type == 'd' && !read_string(data, offset))
+					{
+						return false;
+					}
+
+					if (!skip_value(data, offset, depth + 1))
+					{
+						return false;
+					}
+				}
+
+				if (offset >= data.size())
+				{
+					return false;
+				}
+
+				++offset;
+				return true;
+			}
+
+			return read_string(data, offset).has_value();
+		}
+
+		std::optional<size_t> find_offset(const std::string_view dictionary, const std::string_view key)
+		{
+			if (dictionary.empty() || dictionary[0] != 'd')
+			{
+				return {};
+			}
+
+			size_t offset = 1;
+			while (offset < dictionary.size() && dictionary[offset] != 'e')
+			{
+				const auto current = read_string(dictionary, offset);
+				if (!current)
+				{
+					return {};
+				}
+
+				if (*current == key)
+				{
+					return offset;
+				}
+
+				if (!skip_value(dictionary, offset))
+				{
+					return {};
+				}
+			}
+
+			return {};
+		}
+	}
+
+	std::optional<std::string_view> find_value(const std::string_view dictionary, const std::string_view key)
+	{
+		const auto start = find_offset(dictionary, key);
+		if (!start)
+		{
+			return {};
+		}
+
+		auto offset = *start;
+		if (!skip_value(dictionary, offset))
+		{
+			return {};
+		}
+
+		return dictionary.substr(*start, offset - *start);
+	}
+
+	std::optional<std::string_view> find_string(const std::string_view dictionary, const std::string_view key)
+	{
+		auto offset = find_offset(dictionary, key);
+		if (!offset)
+		{
+			return {};
+		}
+
+		return read_string(dictionary, *offset);
+	}
+
+	std::optional<int64_t> find_integer(const std::string_view dictionary, const std::string_view key)
+	{
+		auto offset = find_offset(dictionary, key);
+		if (!offset)
+		{
+			return {};
+		}
+
+		return read_integer(dictionary, *offset);
+	}
+
+	bool find_strings(const std::string_view dictionary, const std::string_view key,
+	                  std::vector<std::string_view>& strings)
+	{
+		auto offset = find_offset(dictionary, key);
+		if (!offset || *offset >= dictionary.size() || dictionary[*offset] != 'l')
+		{
+			return false;
+		}
+
+		++*offset;
+		while (*offset < dictionary.size() && dictionary[*offset] != 'e')
+		{
+			if (dictionary[*offset] >= '0' && dictionary[*offset] <= '9')
+			{
+				const auto value = read_string(dictionary, *offset);
+				if (!value)
+				{
+					return false;
+				}
+
+				strings.push_back(*value);
+			}
+			else if (!skip_value(dictionary, *offset, 1))
+			{
+				return false;
+			}
+		}
+
+		return *offset < dictionary.size();
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// Minimal bencode reader, just enough to look at KRPC messages without copying them
+namespace utils::bencode
+{
+	// Raw encoded value stored under key in a dictionary
+	std::optional<std::string_view> find_value(std::string_view dictionary, std::string_view key);
+
+	// Contents of the byte string stored under key in a dictionary
+	std::optional<std::string_view> find_string(std::string_view dictionary, std::string_view key);
+
+	std::optional<int64_t> find_integer(std::string_view dictionary, std::string_view key);
+
+	// Appends the byte strings of the list stored under key, other list elements are skipped
+	bool find_strings(std::string_view dictionary, std::string_view key, std::vector<std::string_view>& strings);
+}
@@ -0,0 +1,48 @@
+#include <std_include.hpp>
+
+#include "checksum.hpp"
+
+namespace utils::checksum
+{
+	namespace
+	{
+		struct crc32_table
+		{
+			uint32_t entries[256]{};
+
+			constexpr crc32_table()
+			{
+				for (uint32_t i = 0; i < 256; ++i)
+				{
+					uint32_t value = i;
+					for (int bit = 0; bit < 8; ++bit)
+					{
+						value = (value & 1) ? (0xEDB88320u ^ (value >> 1)) : (value >> 1);
+					}
+
+					this->entries[i] = value;
+				}
+			}
+		};
+
+		constexpr crc32_table table{};
+	}
+
+	uint32_t crc32(const void* data, const size_t size, uint32_t crc)
+	{
+		const auto* bytes = static_cast<const uint8_t*>(data);
+		crc = ~crc;
+
+		for (size_t i = 0; i < size; ++i)
+		{
+			crc = table.entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+		}
+
+		return ~crc;
+	}
+
+	uint32_t crc32(const std::string_view data, const uint32_t crc)
+	{
+		return crc32(data.data(), data.size(), crc);
+	}
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace utils::checksum
+{
+	// CRC-32 (IEEE 802.3), pass the previous result as crc to continue over several buffers
+	uint32_t crc32(const void* data, size_t size, uint32_t crc = 0);
+	uint32_t crc32(std::string_view data, uint32_t crc = 0);
+}
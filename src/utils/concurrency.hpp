@@ -1,6 +1,10 @@
 #pragma once
 
 #include <mutex>
+#include <atomic>
+#include <vector>
+#include <condition_variable>
+#include <chrono>
 
 namespace utils::concurrency
 {
@@ -43,4 +47,123 @@ namespace utils::concurrency
 		mutable MutexType mutex_{};
 		T object_{};
 	};
+
+	// Lock-free ring for exactly one producer and one consumer thread.
+	// Slots are filled and consumed in place to avoid copying large entries.
+	template <typename T>
+	class spsc_ring
+	{
+	public:
+		spsc_ring(const size_t capacity)
+		{
+			size_t size = 1;
+			while (size < capacity)
+			{
+				size <<= 1;
+			}
+
+			this->entries_.resize(size);
+			this->mask_ = size - 1;
+		}
+
+		spsc_ring(const spsc_ring&) = delete;
+		spsc_ring& operator=(const spsc_ring&) = delete;
+
+		// Producer: returns the next free slot or nullptr if the ring is full
+		T* begin_push()
+		{
+			const auto tail = this->tail_.load(std::memory_order_relaxed);
+			if ((tail - this->head_cache_) >= this->entries_.size())
+			{
+				this->head_cache_ = this->head_.load(std::memory_order_acquire);
+				if ((tail - this->head_cache_) >= this->entries_.size())
+				{
+					return nullptr;
+				}
+			}
+
+			return &this->entries_[tail & this->mask_];
+		}
+
+		// Producer: publishes the slot returned by begin_push
+		void end_push()
+		{
+			this->tail_.store(this->tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		// Consumer: returns the oldest entry or nullptr if the ring is empty
+		T* front()
+		{
+			const auto head = this->head_.load(std::memory_order_relaxed);
+			if (head == this->tail_cache_)
+			{
+				this->tail_cache_ = this->tail_.load(std::memory_order_acquire);
+				if (head == this->tail_cache_)
+				{
+					return nullptr;
+				}
+			}
+
+			return &this->entries_[head & this->mask_];
+		}
+
+		// Consumer: releases the entry returned by front
+		void pop()
+		{
+			this->head_.store(this->head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		size_t size() const
+		{
+			const auto head = this->head_.load(std::memory_order_acquire);
+			const auto tail = this->tail_.load(std::memory_order_acquire);
+			return tail - head;
+		}
+
+		size_t capacity() const
+		{
+			return this->entries_.size();
+		}
+
+	private:
+		std::vector<T> entries_{};
+		size_t mask_{};
+
+		alignas(64) std::atomic<size_t> head_{0};
+		size_t tail_cache_{0};
+
+		alignas(64) std::atomic<size_t> tail_{0};
+		size_t head_cache_{0};
+	};
+
+	// Auto-resetting wakeup signal, notifying only takes the lock when the waiter might be asleep
+	class event
+	{
+	public:
+		void notify()
+		{
+			if (!this->signaled_.exchange(true))
+			{
+				std::lock_guard<std::mutex> _{this->mutex_};
+				this->condition_.notify_one();
+			}
+		}
+
+		template <typename Clock, typename Duration>
+		void wait_until(const std::chrono::time_point<Clock, Duration>& time_point)
+		{
+			std::unique_lock<std::mutex> lock{this->mutex_};
+			this->condition_.wait_until(lock, time_point, [this]()
+			{
+				return this->signaled_.load();
+			});
+
+			this->signaled_ = false;
+		}
+
+	private:
+		std::mutex mutex_{};
+		std::condition_variable condition_{};
+		std::atomic_bool signaled_{false};
+	};
 }
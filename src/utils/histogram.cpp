@@ -0,0 +1,69 @@
+#include <std_include.hpp>
+
+#include "histogram.hpp"
+#include <cmath>
+
+namespace utils
+{
+	namespace
+	{
+		size_t get_bucket(uint64_t value)
+		{
+			size_t bucket = 0;
+			while (value)
+			{
+				value >>= 1;
+				++bucket;
+			}
+
+			return bucket;
+		}
+	}
+
+	void histogram::add(const uint64_t value)
+	{
+		++this->buckets_.at(get_bucket(value));
+		++this->count_;
+		this->max_ = std::max(this->max_, value);
+	}
+
+	void histogram::clear()
+	{
+		this->buckets_ = {};
+		this->count_ = 0;
+		this->max_ = 0;
+	}
+
+	uint64_t histogram::count() const
+	{
+		return this->count_;
+	}
+
+	uint64_t histogram::max() const
+	{
+		return this->max_;
+	}
+
+	uint64_t histogram::percentile(const double percentile) const
+	{
+		if (!this->count_)
+		{
+			return 0;
+		}
+
+		const auto target = static_cast<uint64_t>(std::ceil(static_cast<double>(this->count_) * percentile / 100.0));
+
+		uint64_t seen = 0;
+		for (size_t i = 0; i < this->buckets_.size(); ++i)
+		{
+			seen += this->buckets_[i];
+			if (seen >= target && seen > 0)
+			{
+				const auto bound = i >= 64 ? UINT64_MAX : (uint64_t{1} << i) - 1;
+				return std::min(bound, this->max_);
+			}
+		}
+
+		return this->max_;
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace utils
+{
+	// Power of two buckets, bucket i counts values in [2^(i-1), 2^i)
+	class histogram
+	{
+	public:
+		void add(uint64_t value);
+		void clear();
+
+		uint64_t count() const;
+		uint64_t max() const;
+
+		// Upper bound of the bucket that contains the given percentile (0 - 100)
+		uint64_t percentile(double percentile) const;
+
+	private:
+		std::array<uint64_t, 65> buckets_{};
+		uint64_t count_{};
+		uint64_t max_{};
+	};
+}
@@ -4,8 +4,62 @@
 #include <fstream>
 #include <ios>
 
+#ifdef _WIN32
+#include <io.h>
+#endif
+
 namespace utils::io
 {
+	namespace
+	{
+#ifdef _WIN32
+		bool write_all(const HANDLE handle, const void* data, const size_t size)
+		{
+			const auto* bytes = static_cast<const char*>(data);
+			size_t written = 0;
+
+			while (written < size)
+			{
+				const auto chunk = static_cast<DWORD>(std::min(size - written, size_t{0x40000000}));
+
+				DWORD result{};
+				if (!WriteFile(handle, bytes + written, chunk, &result, nullptr) || !result)
+				{
+					return false;
+				}
+
+				written += result;
+			}
+
+			return true;
+		}
+#else
+		bool write_all(const int fd, const void* data, const size_t size)
+		{
+			const auto* bytes = static_cast<const char*>(data);
+			size_t written = 0;
+
+			while (written < size)
+			{
+				const auto result = write(fd, bytes + written, size - written);
+				if (result < 0 && errno == EINTR)
+				{
+					continue;
+				}
+
+				if (result <= 0)
+				{
+					return false;
+				}
+
+				written += static_cast<size_t>(result);
+			}
+
+			return true;
+		}
+#endif
+	}
+
 	bool remove_file(const std::string& file)
 	{
 		return remove(file.data()) == 0;
@@ -18,7 +72,8 @@ namespace utils::io
 
 	bool file_exists(const std::string& file)
 	{
-		return std::ifstream(file).good();
+		std::error_code error{};
+		return std::filesystem::is_regular_file(file, error);
 	}
 
 	bool write_file(const std::string& file, const std::string& data, const bool append)
@@ -52,6 +107,96 @@ namespace utils::io
 		return false;
 	}
 
+	bool write_file_atomic(const std::string& file, const void* data, const size_t size)
+	{
+		const auto pos = file.find_last_of("/\\");
+		if (pos != std::string::npos)
+		{
+			create_directory(file.substr(0, pos));
+		}
+
+		const auto temporary = file + ".tmp";
+
+#ifdef _WIN32
+		const auto handle = CreateFileA(temporary.data(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+		                                nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		// The rename is written through, the contents have to reach the disk before it
+		const auto synced = write_all(handle, data, size) && FlushFileBuffers(handle);
+		CloseHandle(handle);
+
+		if (!synced)
+		{
+			remove_file(temporary);
+			return false;
+		}
+
+		return MoveFileExA(temporary.data(), file.data(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE;
+#else
+		const auto fd = open(temporary.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		const auto synced = write_all(fd, data, size) && fsync(fd) == 0;
+		close(fd);
+
+		if (!synced || rename(temporary.data(), file.data()) != 0)
+		{
+			remove_file(temporary);
+			return false;
+		}
+
+		// The rename itself is only durable once the directory is synced
+		const auto directory = pos == std::string::npos ? std::string{"."} : file.substr(0, pos);
+		const auto directory_fd = open(directory.empty() ? "/" : directory.data(), O_RDONLY | O_CLOEXEC);
+		if (directory_fd >= 0)
+		{
+			fsync(directory_fd);
+			close(directory_fd);
+		}
+
+		return true;
+#endif
+	}
+
+	bool append_file_sync(const std::string& file, const void* data, const size_t size)
+	{
+#ifdef _WIN32
+		const auto handle = CreateFileA(file.data(), FILE_APPEND_DATA, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+		                                FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		const auto synced = write_all(handle, data, size) && FlushFileBuffers(handle);
+		CloseHandle(handle);
+
+		return synced;
+#else
+		const auto fd = open(file.data(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+#ifdef __APPLE__
+		const auto synced = write_all(fd, data, size) && fsync(fd) == 0;
+#else
+		const auto synced = write_all(fd, data, size) && fdatasync(fd) == 0;
+#endif
+		close(fd);
+
+		return synced;
+#endif
+	}
+
 	std::string read_file(const std::string& file)
 	{
 		std::string data;
@@ -64,41 +209,23 @@ namespace utils::io
 		if (!data) return false;
 		data->clear();
 
-		if (file_exists(file))
+		try
 		{
-			std::ifstream stream(file, std::ios::binary);
-			if (!stream.is_open()) return false;
-
-			stream.seekg(0, std::ios::end);
-			const std::streamsize size = stream.tellg();
-			stream.seekg(0, std::ios::beg);
-
-			if (size > -1)
-			{
-				data->resize(static_cast<uint32_t>(size));
-				stream.read(const_cast<char*>(data->data()), size);
-				stream.close();
-				return true;
-			}
+			const file_view view{file, access_pattern::sequential};
+			data->assign(view.data(), view.size());
+			return true;
+		}
+		catch (const std::exception&)
+		{
+			return false;
 		}
-
-		return false;
 	}
 
 	size_t file_size(const std::string& file)
 	{
-		if (file_exists(file))
-		{
-			std::ifstream stream(file, std::ios::binary);
-
-			if (stream.good())
-			{
-				stream.seekg(0, std::ios::end);
-				return static_cast<size_t>(stream.tellg());
-			}
-		}
-
-		return 0;
+		std::error_code error{};
+		const auto size = std::filesystem::file_size(file, error);
+		return error ? 0 : static_cast<size_t>(size);
 	}
 
 	bool create_directory(const std::string& directory)
@@ -134,4 +261,334 @@ namespace utils::io
 		                      std::filesystem::copy_options::overwrite_existing |
 		                      std::filesystem::copy_options::recursive);
 	}
+
+	file_view::file_view(const std::string& file, const access_pattern pattern)
+	{
+#ifdef _WIN32
+		// Shared for deletion, a mapped file can still be replaced or removed
+		const auto handle = CreateFileA(file.data(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		                                nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			throw std::runtime_error{"Failed to open " + file};
+		}
+
+		this->file_ = handle;
+
+		LARGE_INTEGER size{};
+		if (!GetFileSizeEx(handle, &size))
+		{
+			this->close();
+			throw std::runtime_error{"Failed to get the size of " + file};
+		}
+
+		this->size_ = static_cast<size_t>(size.QuadPart);
+		if (!this->size_)
+		{
+			this->close();
+			return;
+		}
+
+		this->mapping_ = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (this->mapping_)
+		{
+			this->data_ = static_cast<const char*>(MapViewOfFile(this->mapping_, FILE_MAP_READ, 0, 0, 0));
+		}
+#else
+		const auto fd = open(file.data(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			throw std::runtime_error{"Failed to open " + file};
+		}
+
+		struct stat info{};
+		if (fstat(fd, &info) != 0)
+		{
+			::close(fd);
+			throw std::runtime_error{"Failed to get the size of " + file};
+		}
+
+		this->size_ = static_cast<size_t>(info.st_size);
+		if (!this->size_)
+		{
+			::close(fd);
+			return;
+		}
+
+		// The mapping keeps the file referenced, the descriptor is not needed anymore
+		auto* data = mmap(nullptr, this->size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+
+		if (data != MAP_FAILED)
+		{
+			this->data_ = static_cast<const char*>(data);
+		}
+#endif
+
+		if (!this->data_)
+		{
+			this->close();
+			throw std::runtime_error{"Failed to map " + file};
+		}
+
+		this->advise(pattern);
+	}
+
+	file_view::~file_view()
+	{
+		this->close();
+	}
+
+	file_view::file_view(file_view&& obj) noexcept
+	{
+		this->operator=(std::move(obj));
+	}
+
+	file_view& file_view::operator=(file_view&& obj) noexcept
+	{
+		if (this != &obj)
+		{
+			this->close();
+
+#ifdef _WIN32
+			this->file_ = obj.file_;
+			this->mapping_ = obj.mapping_;
+			obj.file_ = {};
+			obj.mapping_ = {};
+#endif
+			this->data_ = obj.data_;
+			this->size_ = obj.size_;
+			obj.data_ = {};
+			obj.size_ = {};
+		}
+
+		return *this;
+	}
+
+	std::string_view file_view::get_data() const
+	{
+		return {this->data(), this->size()};
+	}
+
+	const char* file_view::data() const
+	{
+		return this->data_;
+	}
+
+	size_t file_view::size() const
+	{
+		return this->data_ ? this->size_ : 0;
+	}
+
+	bool file_view::empty() const
+	{
+		return this->size() == 0;
+	}
+
+	void file_view::advise(const access_pattern pattern) const
+	{
+#ifdef _WIN32
+		// The memory manager has no per-mapping hints, its read-ahead adapts on its own
+		(void)pattern;
+#else
+		if (!this->data_)
+		{
+			return;
+		}
+
+		auto advice = MADV_NORMAL;
+		if (pattern == access_pattern::sequential)
+		{
+			advice = MADV_SEQUENTIAL;
+		}
+		else if (pattern == access_pattern::random)
+		{
+			advice = MADV_RANDOM;
+		}
+
+		madvise(const_cast<char*>(this->data_), this->size_, advice);
+#endif
+	}
+
+	void file_view::close()
+	{
+#ifdef _WIN32
+		if (this->data_)
+		{
+			UnmapViewOfFile(this->data_);
+		}
+
+		if (this->mapping_)
+		{
+			CloseHandle(this->mapping_);
+		}
+
+		if (this->file_)
+		{
+			CloseHandle(this->file_);
+		}
+
+		this->file_ = {};
+		this->mapping_ = {};
+#else
+		if (this->data_)
+		{
+			munmap(const_cast<char*>(this->data_), this->size_);
+		}
+#endif
+
+		this->data_ = {};
+		this->size_ = {};
+	}
+
+	file_reader::file_reader(const std::string& file, const size_t chunk_size)
+		: file_(fopen(file.data(), "rb"))
+	{
+		if (!this->file_)
+		{
+			throw std::runtime_error{"Failed to open " + file};
+		}
+
+		// Chunks are buffered here, a second buffer in stdio would only copy them again
+		setvbuf(this->file_, nullptr, _IONBF, 0);
+		this->buffer_.resize(std::max<size_t>(chunk_size, 1));
+
+#ifdef __linux__
+		posix_fadvise(fileno(this->file_), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	}
+
+	file_reader::~file_reader()
+	{
+		fclose(this->file_);
+	}
+
+	bool file_reader::fill()
+	{
+		this->position_ = 0;
+		this->end_ = fread(this->buffer_.data(), 1, this->buffer_.size(), this->file_);
+		return this->end_ != 0;
+	}
+
+	bool file_reader::read(void* data, size_t size)
+	{
+		auto* target = static_cast<char*>(data);
+
+		while (size)
+		{
+			if (this->position_ == this->end_)
+			{
+				// Large reads go straight into the target
+				if (size >= this->buffer_.size())
+				{
+					return fread(target, 1, size, this->file_) == size;
+				}
+
+				if (!this->fill())
+				{
+					return false;
+				}
+			}
+
+			const auto length = std::min(size, this->end_ - this->position_);
+			memcpy(target, this->buffer_.data() + this->position_, length);
+
+			this->position_ += length;
+			target += length;
+			size -= length;
+		}
+
+		return true;
+	}
+
+	std::string_view file_reader::read_chunk()
+	{
+		if (this->position_ == this->end_ && !this->fill())
+		{
+			return {};
+		}
+
+		const std::string_view chunk{this->buffer_.data() + this->position_, this->end_ - this->position_};
+		this->position_ = this->end_;
+
+		return chunk;
+	}
+
+	file_writer::file_writer(const std::string& file, const bool append, const size_t chunk_size)
+		: chunk_size_(std::max<size_t>(chunk_size, 1))
+	{
+		const auto pos = file.find_last_of("/\\");
+		if (pos != std::string::npos)
+		{
+			create_directory(file.substr(0, pos));
+		}
+
+		this->file_ = fopen(file.data(), append ? "ab" : "wb");
+		if (!this->file_)
+		{
+			throw std::runtime_error{"Failed to open " + file};
+		}
+
+		setvbuf(this->file_, nullptr, _IONBF, 0);
+		this->buffer_.reserve(this->chunk_size_);
+	}
+
+	file_writer::~file_writer()
+	{
+		this->flush();
+		fclose(this->file_);
+	}
+
+	bool file_writer::write(const void* data, const size_t size)
+	{
+		if ((this->buffer_.size() + size) > this->chunk_size_)
+		{
+			this->flush();
+		}
+
+		// Chunk sized writes skip the buffer
+		if (size >= this->chunk_size_)
+		{
+			this->failed_ |= fwrite(data, 1, size, this->file_) != size;
+		}
+		else
+		{
+			this->buffer_.append(static_cast<const char*>(data), size);
+		}
+
+		return !this->failed_;
+	}
+
+	bool file_writer::write(const std::string_view data)
+	{
+		return this->write(data.data(), data.size());
+	}
+
+	bool file_writer::flush()
+	{
+		if (!this->buffer_.empty())
+		{
+			this->failed_ |= fwrite(this->buffer_.data(), 1, this->buffer_.size(), this->file_) != this->buffer_.size();
+			this->buffer_.clear();
+		}
+
+		this->failed_ |= fflush(this->file_) != 0;
+		return !this->failed_;
+	}
+
+	bool file_writer::sync()
+	{
+		if (!this->flush())
+		{
+			return false;
+		}
+
+#ifdef _WIN32
+		this->failed_ |= _commit(_fileno(this->file_)) != 0;
+#else
+		this->failed_ |= fsync(fileno(this->file_)) != 0;
+#endif
+
+		return !this->failed_;
+	}
 }
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <filesystem>
+#include <cstdio>
 
 namespace utils::io
 {
@@ -11,6 +13,11 @@ namespace utils::io
 	bool file_exists(const std::string& file);
 	bool write_file(const std::string& file, const std::string& data, bool append = false);
 	bool write_file(const std::string& file, const void* data, size_t size, bool append = false);
+	// Writes a temporary file, syncs it and renames it over file, readers see the old or the new content
+	bool write_file_atomic(const std::string& file, const void* data, size_t size);
+	// Appends and waits until the data reached the disk
+	bool append_file_sync(const std::string& file, const void* data, size_t size);
+	// Reads the whole file with a single open, use file_view or file_reader to avoid the copy
 	bool read_file(const std::string& file, std::string* data);
 	std::string read_file(const std::string& file);
 	size_t file_size(const std::string& file);
@@ -19,4 +26,108 @@ namespace utils::io
 	bool directory_is_empty(const std::string& directory);
 	std::vector<std::string> list_files(const std::string& directory);
 	void copy_folder(const std::filesystem::path& src, const std::filesystem::path& target);
+
+	constexpr size_t default_chunk_size = 1 << 20;
+
+	enum class access_pattern
+	{
+		normal,
+		// Read front to back once, pages ahead are fetched early and dropped soon
+		sequential,
+		// Scattered reads, read-ahead would only waste memory
+		random,
+	};
+
+	// Read-only mapping of a whole file, pages are only read once they are touched.
+	// The file must not shrink while it is mapped.
+	class file_view
+	{
+	public:
+		file_view() = default;
+		// Throws if the file can't be opened or mapped, an empty file gives an empty view
+		explicit file_view(const std::string& file, access_pattern pattern = access_pattern::normal);
+		~file_view();
+
+		file_view(const file_view&) = delete;
+		file_view& operator=(const file_view&) = delete;
+
+		file_view(file_view&& obj) noexcept;
+		file_view& operator=(file_view&& obj) noexcept;
+
+		std::string_view get_data() const;
+		const char* data() const;
+		size_t size() const;
+		bool empty() const;
+
+		void advise(access_pattern pattern) const;
+
+	private:
+#ifdef _WIN32
+		void* file_{};
+		void* mapping_{};
+#endif
+		const char* data_{};
+		size_t size_{};
+
+		void close();
+	};
+
+	// Reads a file front to back, only a single chunk is held in memory
+	class file_reader
+	{
+	public:
+		// Throws if the file can't be opened
+		explicit file_reader(const std::string& file, size_t chunk_size = default_chunk_size);
+		~file_reader();
+
+		file_reader(const file_reader&) = delete;
+		file_reader& operator=(const file_reader&) = delete;
+
+		file_reader(file_reader&&) = delete;
+		file_reader& operator=(file_reader&&) = delete;
+
+		// Copies the next size bytes, returns false if the file ends before
+		bool read(void* data, size_t size);
+
+		// The next chunk of the file, empty at its end. Valid until the next read.
+		std::string_view read_chunk();
+
+	private:
+		FILE* file_{};
+		std::vector<char> buffer_{};
+		size_t position_{};
+		size_t end_{};
+
+		bool fill();
+	};
+
+	// Collects writes into chunks, so many small writes cost a single system call
+	class file_writer
+	{
+	public:
+		// Throws if the file can't be opened
+		explicit file_writer(const std::string& file, bool append = false, size_t chunk_size = default_chunk_size);
+		// Writes what is still buffered
+		~file_writer();
+
+		file_writer(const file_writer&) = delete;
+		file_writer& operator=(const file_writer&) = delete;
+
+		file_writer(file_writer&&) = delete;
+		file_writer& operator=(file_writer&&) = delete;
+
+		// Returns false once any write failed
+		bool write(const void* data, size_t size);
+		bool write(std::string_view data);
+
+		bool flush();
+		// Flushes and waits until the data reached the disk
+		bool sync();
+
+	private:
+		FILE* file_{};
+		std::string buffer_{};
+		size_t chunk_size_{};
+		bool failed_{};
+	};
 }
@@ -0,0 +1,432 @@
+#include <std_include.hpp>
+
+#include "sha256.hpp"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SHA256_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+#endif
+
+namespace utils::sha256
+{
+	namespace
+	{
+		using compress_function = void(*)(uint32_t* state, const uint8_t* blocks, size_t count);
+
+		alignas(16) constexpr uint32_t round_constants[64] = {
+			0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+			0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+			0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+			0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+			0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+			0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+			0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+			0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+		};
+
+		constexpr uint32_t rotate_right(const uint32_t value, const int bits)
+		{
+			return (value >> bits) | (value << (32 - bits));
+		}
+
+		uint32_t load_big_endian(const uint8_t* data)
+		{
+			return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+				(static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
+		}
+
+		void compress_portable(uint32_t* state, const uint8_t* blocks, size_t count)
+		{
+			uint32_t schedule[64];
+
+			for (; count; --count, blocks += 64)
+			{
+				for (size_t i = 0; i < 16; ++i)
+				{
+					schedule[i] = load_big_endian(blocks + (i * 4));
+				}
+
+				for (size_t i = 16; i < 64; ++i)
+				{
+					const auto s0 = rotate_right(schedule[i - 15], 7) ^ rotate_right(schedule[i - 15], 18) ^
+						(schedule[i - 15] >> 3);
+					const auto s1 = rotate_right(schedule[i - 2], 17) ^ rotate_right(schedule[i - 2], 19) ^
+						(schedule[i - 2] >> 10);
+					schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+				}
+
+				auto a = state[0];
+				auto b = state[1];
+				auto c = state[2];
+				auto d = state[3];
+				auto e = state[4];
+				auto f = state[5];
+				auto g = state[6];
+				auto h = state[7];
+
+				for (size_t i = 0; i < 64; ++i)
+				{
+					const auto s1 = rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+					const auto choice = (e & f) ^ (~e & g);
+					const auto t1 = h + s1 + choice + round_constants[i] + schedule[i];
+					const auto s0 = rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+					const auto majority = (a & b) ^ (a & c) ^ (b & c);
+					const auto t2 = s0 + majority;
+
+					h = g;
+					g = f;
+					f = e;
+					e = d + t1;
+					d = c;
+					c = b;
+					b = a;
+					a = t1 + t2;
+				}
+
+				state[0] += a;
+				state[1] += b;
+				state[2] += c;
+				state[3] += d;
+				state[4] += e;
+				state[5] += f;
+				state[6] += g;
+				state[7] += h;
+			}
+		}
+
+#ifdef SHA256_X86
+		bool has_sha_extensions()
+		{
+			// SSSE3 and SSE4.1 for the shuffles and blends around the SHA instructions
+			constexpr auto ssse3 = 1u << 9;
+			constexpr auto sse41 = 1u << 19;
+			constexpr auto sha = 1u << 29;
+
+#ifdef _MSC_VER
+			int registers[4]{};
+			__cpuid(registers, 0);
+			if (registers[0] < 7)
+			{
+				return false;
+			}
+
+			__cpuid(registers, 1);
+			const auto features = static_cast<uint32_t>(registers[2]);
+
+			__cpuidex(registers, 7, 0);
+			const auto extended = static_cast<uint32_t>(registers[1]);
+#else
+			unsigned int eax{}, ebx{}, ecx{}, edx{};
+			if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			{
+				return false;
+			}
+
+			const auto features = ecx;
+
+			if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+			{
+				return false;
+			}
+
+			const auto extended = ebx;
+#endif
+
+			return (features & ssse3) && (features & sse41) && (extended & sha);
+		}
+
+		// Four rounds per step, the message schedule for the next steps is expanded alongside
+#ifndef _MSC_VER
+		__attribute__((target("sha,sse4.1")))
+#endif
+		void compress_sha_ni(uint32_t* state, const uint8_t* blocks, size_t count)
+		{
+			const auto byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+			// The instructions want the state as ABEF and CDGH
+			auto low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+			auto high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+
+			low = _mm_shuffle_epi32(low, 0xB1);
+			high = _mm_shuffle_epi32(high, 0x1B);
+			auto abef = _mm_alignr_epi8(low, high, 8);
+			auto cdgh = _mm_blend_epi16(high, low, 0xF0);
+
+			for (; count; --count, blocks += 64)
+			{
+				const auto abef_start = abef;
+				const auto cdgh_start = cdgh;
+
+				__m128i words[4];
+
+				for (size_t i = 0; i < 16; ++i)
+				{
+					auto& current = words[i % 4];
+
+					if (i < 4)
+					{
+						current = _mm_shuffle_epi8(
+							_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + (i * 16))), byte_swap);
+					}
+					else
+					{
+						const auto& previous = words[(i + 3) % 4];
+						current = _mm_sha256msg1_epu32(current, words[(i + 1) % 4]);
+						current = _mm_add_epi32(current, _mm_alignr_epi8(previous, words[(i + 2) % 4], 4));
+						current = _mm_sha256msg2_epu32(current, previous);
+					}
+
+					auto message = _mm_add_epi32(
+						current, _mm_load_si128(reinterpret_cast<const __m128i*>(round_constants + (i * 4))));
+					cdgh = _mm_sha256rnds2_epu32(cdgh, abef, message);
+					message = _mm_shuffle_epi32(message, 0x0E);
+					abef = _mm_sha256rnds2_epu32(abef, cdgh, message);
+				}
+
+				abef = _mm_add_epi32(abef, abef_start);
+				cdgh = _mm_add_epi32(cdgh, cdgh_start);
+			}
+
+			low = _mm_shuffle_epi32(abef, 0x1B);
+			high = _mm_shuffle_epi32(cdgh, 0xB1);
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_blend_epi16(low, high, 0xF0));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), _mm_alignr_epi8(high, low, 8));
+		}
+#endif
+
+		struct selection
+		{
+			backend active{backend::portable};
+			compress_function compress{&compress_portable};
+
+			selection()
+			{
+				if (is_supported(backend::sha_ni))
+				{
+					this->select(backend::sha_ni);
+				}
+			}
+
+			void select(const backend backend)
+			{
+				this->active = backend;
+				this->compress = &compress_portable;
+
+#ifdef SHA256_X86
+				if (backend == backend::sha_ni)
+				{
+					this->compress = &compress_sha_ni;
+				}
+#endif
+			}
+		};
+
+		selection& get_selection()
+		{
+			static selection selection{};
+			return selection;
+		}
+	}
+
+	backend get_backend()
+	{
+		return get_selection().active;
+	}
+
+	const char* get_backend_name(const backend backend)
+	{
+		switch (backend)
+		{
+		case backend::sha_ni:
+			return "SHA-NI";
+		case backend::portable:
+		default:
+			return "portable";
+		}
+	}
+
+	bool is_supported(const backend backend)
+	{
+		if (backend == backend::portable)
+		{
+			return true;
+		}
+
+#ifdef SHA256_X86
+		static const auto sha_extensions = has_sha_extensions();
+		return sha_extensions;
+#else
+		return false;
+#endif
+	}
+
+	bool set_backend(const backend backend)
+	{
+		if (!is_supported(backend))
+		{
+			return false;
+		}
+
+		get_selection().select(backend);
+		return true;
+	}
+
+	void hasher::update(const void* data, size_t size)
+	{
+		if (!size)
+		{
+			return;
+		}
+
+		const auto compress = get_selection().compress;
+		const auto* bytes = static_cast<const uint8_t*>(data);
+		this->length_ += size;
+
+		if (this->buffered_)
+		{
+			const auto length = std::min(size, this->buffer_.size() - this->buffered_);
+			memcpy(this->buffer_.data() + this->buffered_, bytes, length);
+
+			this->buffered_ += length;
+			bytes += length;
+			size -= length;
+
+			if (this->buffered_ < this->buffer_.size())
+			{
+				return;
+			}
+
+			compress(this->state_.data(), this->buffer_.data(), 1);
+			this->buffered_ = 0;
+		}
+
+		// Whole blocks are compressed in place
+		const auto blocks = size / 64;
+		if (blocks)
+		{
+			compress(this->state_.data(), bytes, blocks);
+			bytes += blocks * 64;
+			size -= blocks * 64;
+		}
+
+		memcpy(this->buffer_.data(), bytes, size);
+		this->buffered_ = size;
+	}
+
+	void hasher::update(const std::string_view data)
+	{
+		this->update(data.data(), data.size());
+	}
+
+	digest hasher::finish()
+	{
+		const auto compress = get_selection().compress;
+		const auto bits = this->length_ * 8;
+
+		this->buffer_[this->buffered_++] = 0x80;
+
+		// The length needs the last 8 bytes of a block
+		if (this->buffered_ > 56)
+		{
+			memset(this->buffer_.data() + this->buffered_, 0, this->buffer_.size() - this->buffered_);
+			compress(this->state_.data(), this->buffer_.data(), 1);
+			this->buffered_ = 0;
+		}
+
+		memset(this->buffer_.data() + this->buffered_, 0, 56 - this->buffered_);
+		for (size_t i = 0; i < 8; ++i)
+		{
+			this->buffer_[63 - i] = static_cast<uint8_t>(bits >> (i * 8));
+		}
+
+		compress(this->state_.data(), this->buffer_.data(), 1);
+
+		digest result{};
+		for (size_t i = 0; i < this->state_.size(); ++i)
+		{
+			result[i * 4] = static_cast<uint8_t>(this->state_[i] >> 24);
+			result[i * 4 + 1] = static_cast<uint8_t>(this->state_[i] >> 16);
+			result[i * 4 + 2] = static_cast<uint8_t>(this->state_[i] >> 8);
+			result[i * 4 + 3] = static_cast<uint8_t>(this->state_[i]);
+		}
+
+		*this = {};
+		return result;
+	}
+
+	digest compute(const void* data, const size_t size)
+	{
+		hasher hasher{};
+		hasher.update(data, size);
+		return hasher.finish();
+	}
+
+	digest compute(const std::string_view data)
+	{
+		return compute(data.data(), data.size());
+	}
+
+	void compute(const std::string_view* messages, const size_t count, digest* results)
+	{
+		// Messages of a batch are independent, the block function is only looked up once
+		hasher hasher{};
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			hasher.update(messages[i]);
+			results[i] = hasher.finish();
+		}
+	}
+
+	void compute_legacy(const void* data, size_t size, uint8_t* output, const size_t output_size)
+	{
+		const auto compress = get_selection().compress;
+		const auto* bytes = static_cast<const uint8_t*>(data);
+
+		auto state = initial_state;
+		std::array<uint8_t, 64> block{};
+		uint64_t bits = 0;
+
+		const auto blocks = size / 64;
+		if (blocks)
+		{
+			compress(state.data(), bytes, blocks);
+			bytes += blocks * 64;
+			size -= blocks * 64;
+			bits += blocks * 512;
+		}
+
+		memcpy(block.data(), bytes, size);
+
+		for (size_t i = 0; i < output_size; ++i)
+		{
+			// The buffered length is never reset, so every round pads the same tail again
+			const auto end = size < 56 ? size_t{56} : size_t{64};
+			block[size] = 0x80;
+			memset(block.data() + size + 1, 0, end - size - 1);
+
+			if (size >= 56)
+			{
+				compress(state.data(), block.data(), 1);
+				memset(block.data(), 0, 56);
+			}
+
+			bits += size * 8;
+			for (size_t j = 0; j < 8; ++j)
+			{
+				block[63 - j] = static_cast<uint8_t>(bits >> (j * 8));
+			}
+
+			compress(state.data(), block.data(), 1);
+
+			const auto index = i % 32;
+			output[i] = static_cast<uint8_t>(state[index / 4] >> (24 - (index % 4) * 8));
+		}
+	}
+}
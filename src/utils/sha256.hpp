@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+// SHA-256 with the block function picked once at runtime. x86 CPUs with the SHA extensions
+// run them, everything else the portable implementation. Both produce the same digests.
+namespace utils::sha256
+{
+	using digest = std::array<uint8_t, 32>;
+
+	constexpr std::array<uint32_t, 8> initial_state{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	enum class backend
+	{
+		portable,
+		sha_ni,
+	};
+
+	backend get_backend();
+	const char* get_backend_name(backend backend);
+	bool is_supported(backend backend);
+
+	// For benchmarks, has to happen before any thread hashes. Returns false if the CPU lacks the backend.
+	bool set_backend(backend backend);
+
+	class hasher
+	{
+	public:
+		void update(const void* data, size_t size);
+		void update(std::string_view data);
+
+		// Pads the message, the hasher starts over afterwards
+		digest finish();
+
+	private:
+		std::array<uint32_t, 8> state_{initial_state};
+
+		std::array<uint8_t, 64> buffer_{};
+		size_t buffered_{};
+		uint64_t length_{};
+	};
+
+	digest compute(const void* data, size_t size);
+	digest compute(std::string_view data);
+
+	// Hashes independent messages in one call, results[i] belongs to messages[i]
+	void compute(const std::string_view* messages, size_t count, digest* results);
+
+	// Not SHA-256. Reproduces the old hash library, which padded its running state again on every
+	// digest() call and handed out byte i after the (i + 1)-th call. Only for ids other nodes still
+	// derive that way.
+	void compute_legacy(const void* data, size_t size, uint8_t* output, size_t output_size);
+}